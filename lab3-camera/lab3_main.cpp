@@ -66,8 +66,9 @@ mat4 T2(1.0f), R2(1.0f);	// TASK 3
 void loadModels()
 {
 	///////////////////////////////////////////////////////////////////////////
-	// Load models (both vertex buffers and textures).
+	// Load models (both vertex buffers and textures). Only the GPU needs them.
 	///////////////////////////////////////////////////////////////////////////
+	loader_settings.keep_cpu_data = false;
 	cityModel = loadModelFromOBJ("../scenes/city.obj");
 	carModel = loadModelFromOBJ("../scenes/car.obj");
 	groundModel = loadModelFromOBJ("../scenes/ground_plane.obj");
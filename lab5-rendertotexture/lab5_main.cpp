@@ -208,7 +208,8 @@ void initGL()
 	// enable backface culling
 	glEnable(GL_CULL_FACE);
 
-	// Load some models.
+	// Load some models. Only the GPU needs them.
+	labhelper::loader_settings.keep_cpu_data = false;
 	landingpadModel = labhelper::loadModelFromOBJ("../scenes/landingpad.obj");
 	cameraModel = labhelper::loadModelFromOBJ("../scenes/wheatley.obj");
 	fighterModel = labhelper::loadModelFromOBJ("../scenes/NewShip.obj");
@@ -113,8 +113,9 @@ void initGL()
 	                                                   "../lab6-shadowmaps/simple.frag");
 
 	///////////////////////////////////////////////////////////////////////
-	// Load models and set up model matrices
+	// Load models and set up model matrices. Only the GPU needs them.
 	///////////////////////////////////////////////////////////////////////
+	labhelper::loader_settings.keep_cpu_data = false;
 	fighterModel = labhelper::loadModelFromOBJ("../scenes/NewShip.obj");
 	landingpadModel = labhelper::loadModelFromOBJ("../scenes/landingpad.obj");
 	sphereModel = labhelper::loadModelFromOBJ("../scenes/sphere.obj");
@@ -173,7 +174,8 @@ void drawScene(GLuint currentShaderProgram,
                const mat4& viewMatrix,
                const mat4& projectionMatrix,
                const mat4& lightViewMatrix,
-               const mat4& lightProjectionMatrix)
+               const mat4& lightProjectionMatrix,
+               bool depthOnly)
 {
 	glUseProgram(currentShaderProgram);
 
@@ -208,7 +210,11 @@ void drawScene(GLuint currentShaderProgram,
 	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
 	                          inverse(transpose(viewMatrix * modelMatrix)));
 
-	labhelper::render(landingpadModel);
+	// The shadow map pass only needs the positions
+	if(depthOnly)
+		labhelper::renderDepthOnly(landingpadModel);
+	else
+		labhelper::render(landingpadModel);
 
 	// Fighter
 	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
@@ -217,7 +223,10 @@ void drawScene(GLuint currentShaderProgram,
 	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
 	                          inverse(transpose(viewMatrix * fighterModelMatrix)));
 
-	labhelper::render(fighterModel);
+	if(depthOnly)
+		labhelper::renderDepthOnly(fighterModel);
+	else
+		labhelper::render(fighterModel);
 }
 
 
@@ -308,7 +317,7 @@ void display(void)
 	}
 
 	// Rendering shadowmap
-	drawScene(simpleShaderProgram, lightViewMatrix, lightProjMatrix, lightViewMatrix, lightProjMatrix);
+	drawScene(simpleShaderProgram, lightViewMatrix, lightProjMatrix, lightViewMatrix, lightProjMatrix, true);
 
 	// Task 3.2
 	if (usePolygonOffset) {
@@ -327,7 +336,7 @@ void display(void)
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	drawBackground(viewMatrix, projMatrix);
-	drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
+	drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix, false);
 	debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
 
 	CHECK_GL_ERROR();
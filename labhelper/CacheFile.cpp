@@ -0,0 +1,105 @@
+#include "CacheFile.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+#include <functional>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace labhelper
+{
+bool SourceFile::stat(const std::string& directory)
+{
+	struct stat info;
+	if(::stat((directory + filename).c_str(), &info) != 0)
+		return false;
+	size = int64_t(info.st_size);
+	time = int64_t(info.st_mtime);
+	return true;
+}
+
+bool CacheWriter::save(const std::string& path) const
+{
+	// Other threads and processes may be writing the same cache, so each
+	// writes its own file, and the last rename wins
+	const size_t writer = std::hash<std::thread::id>()(std::this_thread::get_id());
+	const std::string temporary_path =
+	    path + "." + std::to_string(getpid()) + "." + std::to_string(writer) + ".tmp";
+	std::ofstream file(temporary_path, std::ios::binary);
+	file.write((const char*)bytes.data(), bytes.size());
+	file.close();
+	// The rename replaces a cache that is already there, in one step, so
+	// that readers see either the old or the new file
+#ifdef _WIN32
+	const bool saved = file && MoveFileExA(temporary_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	const bool saved = file && std::rename(temporary_path.c_str(), path.c_str()) == 0;
+#endif
+	if(!saved)
+		std::remove(temporary_path.c_str());
+	return saved;
+}
+
+bool MappedFile::open(const std::string& path)
+{
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+	                   nullptr);
+	LARGE_INTEGER file_size;
+	if(file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+		return false;
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mapping == nullptr)
+		return false;
+	data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size = size_t(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	void* mapped = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapped == MAP_FAILED)
+		return false;
+	data = (const uint8_t*)mapped;
+	size = size_t(info.st_size);
+#endif
+	return data != nullptr;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if(data != nullptr)
+		UnmapViewOfFile(data);
+	if(mapping != nullptr)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	if(data != nullptr)
+		munmap((void*)data, size);
+#endif
+}
+} // namespace labhelper
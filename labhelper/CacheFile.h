@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// Helpers for the binary caches that are kept next to the files they were
+// made from (the mesh cache of Model.cpp and the texture cache of
+// TextureCache.cpp). A cache records the size and modification time of
+// its source files, and is thrown away when they no longer match.
+///////////////////////////////////////////////////////////////////////////
+struct SourceFile
+{
+	std::string filename;
+	int64_t size, time;
+	bool stat(const std::string& directory);
+};
+
+struct CacheWriter
+{
+	std::vector<uint8_t> bytes;
+	void write(const void* data, size_t size)
+	{
+		bytes.insert(bytes.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	}
+	template<typename T>
+	void write(const T& value)
+	{
+		write(&value, sizeof(T));
+	}
+	void write(const std::string& s)
+	{
+		write(uint32_t(s.size()));
+		write(s.data(), s.size());
+	}
+	void align()
+	{
+		bytes.resize((bytes.size() + 15) & ~size_t(15), 0);
+	}
+	// Write to a temporary file first and rename it, so that an interrupted
+	// write never leaves a broken cache behind
+	bool save(const std::string& path) const;
+};
+
+// Reads from a mapped cache file. Any read past the end clears 'ok'.
+struct CacheReader
+{
+	const uint8_t* data;
+	size_t size, offset = 0;
+	bool ok = true;
+	const void* read(size_t count)
+	{
+		if(!ok || count > size - offset)
+		{
+			ok = false;
+			return nullptr;
+		}
+		offset += count;
+		return data + offset - count;
+	}
+	template<typename T>
+	T read()
+	{
+		T value;
+		memset(&value, 0, sizeof(T));
+		const void* src = read(sizeof(T));
+		if(src != nullptr)
+			memcpy(&value, src, sizeof(T));
+		return value;
+	}
+	std::string readString()
+	{
+		const uint32_t length = read<uint32_t>();
+		const char* src = (const char*)read(length);
+		return src != nullptr ? std::string(src, length) : std::string();
+	}
+	void align()
+	{
+		offset = std::min(size, (offset + 15) & ~size_t(15));
+	}
+};
+
+// A read only memory mapping of a whole file
+struct MappedFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void *file = (void*)-1, *mapping = nullptr;
+#endif
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool open(const std::string& path);
+	~MappedFile();
+};
+} // namespace labhelper
@@ -0,0 +1,356 @@
+#include "MeshOptimizer.h"
+#include "Model.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+
+namespace labhelper
+{
+// The cache size Tipsify optimizes for. Smaller than most hardware caches,
+// which is the safe direction to be wrong in.
+static const int TIPSIFY_CACHE_SIZE = 16;
+// Runs of triangles shorter than this are merged with the next one before
+// sorting for overdraw, so that the sort does not break up the mesh more
+// than it helps
+static const size_t MIN_CLUSTER_TRIANGLES = 64;
+
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texture_coordinate;
+	bool operator==(const Vertex& other) const
+	{
+		return memcmp(this, &other, sizeof(Vertex)) == 0;
+	}
+};
+
+struct VertexHash
+{
+	size_t operator()(const Vertex& v) const
+	{
+		// FNV-1a over the bits
+		const uint8_t* bytes = (const uint8_t*)&v;
+		uint64_t hash = 14695981039346656037ull;
+		for(size_t i = 0; i < sizeof(Vertex); i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return size_t(hash);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Tipsify. Reorders the triangles of 'indices' and returns in
+// 'cluster_starts' the first triangle of each run after a jump.
+///////////////////////////////////////////////////////////////////////////
+static void tipsify(std::vector<uint32_t>& indices, uint32_t number_of_vertices, int cache_size,
+                    std::vector<uint32_t>& cluster_starts)
+{
+	const uint32_t number_of_triangles = uint32_t(indices.size() / 3);
+	// Triangles around each vertex, and how many are not yet emitted
+	std::vector<uint32_t> live(number_of_vertices, 0);
+	for(uint32_t index : indices)
+		live[index]++;
+	std::vector<uint32_t> adjacency_start(number_of_vertices + 1, 0);
+	for(uint32_t v = 0; v < number_of_vertices; v++)
+		adjacency_start[v + 1] = adjacency_start[v] + live[v];
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(adjacency_start.begin(), adjacency_start.end() - 1);
+		for(uint32_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<uint32_t> cache_time(number_of_vertices, 0);
+	std::vector<bool> emitted(number_of_triangles, false);
+	std::vector<uint32_t> dead_ends, candidates, output;
+	output.reserve(indices.size());
+	uint32_t time = cache_size + 1;
+	uint32_t scan = 0;
+	int fanning = number_of_vertices > 0 ? 0 : -1;
+	cluster_starts.assign(1, 0);
+	while(fanning >= 0)
+	{
+		// Emit all remaining triangles around the fanning vertex
+		candidates.clear();
+		for(uint32_t a = adjacency_start[fanning]; a < adjacency_start[fanning + 1]; a++)
+		{
+			const uint32_t triangle = adjacency[a];
+			if(emitted[triangle])
+				continue;
+			for(int k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices[triangle * 3 + k];
+				output.push_back(v);
+				dead_ends.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if(time - cache_time[v] > uint32_t(cache_size))
+				{
+					cache_time[v] = time;
+					time++;
+				}
+			}
+			emitted[triangle] = true;
+		}
+
+		// Continue with the candidate that will still be in the cache after
+		// its triangles are emitted, and has been there the longest
+		int next = -1, best_priority = -1;
+		for(uint32_t v : candidates)
+		{
+			if(live[v] == 0)
+				continue;
+			int priority = 0;
+			if(time - cache_time[v] + 2 * live[v] <= uint32_t(cache_size))
+				priority = int(time - cache_time[v]);
+			if(priority > best_priority)
+			{
+				best_priority = priority;
+				next = int(v);
+			}
+		}
+		if(next == -1)
+		{
+			// Dead end: go back to a recently used vertex, or on to any
+			// vertex that still has triangles
+			while(!dead_ends.empty() && next == -1)
+			{
+				const uint32_t v = dead_ends.back();
+				dead_ends.pop_back();
+				if(live[v] > 0)
+					next = int(v);
+			}
+			while(next == -1 && scan < number_of_vertices)
+			{
+				if(live[scan] > 0)
+					next = int(scan);
+				scan++;
+			}
+			const uint32_t triangles_so_far = uint32_t(output.size() / 3);
+			if(next != -1 && triangles_so_far - cluster_starts.back() >= MIN_CLUSTER_TRIANGLES)
+				cluster_starts.push_back(triangles_so_far);
+		}
+		fanning = next;
+	}
+	indices.swap(output);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Sort the runs of triangles found by tipsify() so that the ones facing
+// away from the center of the mesh are drawn first
+///////////////////////////////////////////////////////////////////////////
+static void sortClustersForOverdraw(std::vector<uint32_t>& indices, const std::vector<uint32_t>& cluster_starts,
+                                    const std::vector<Vertex>& vertices)
+{
+	const uint32_t number_of_triangles = uint32_t(indices.size() / 3);
+	if(cluster_starts.size() < 2)
+		return;
+	glm::vec3 mesh_center(0.0f);
+	for(const Vertex& v : vertices)
+		mesh_center += v.position;
+	mesh_center /= float(vertices.size());
+
+	struct Cluster
+	{
+		uint32_t first, end;
+		float sort_key;
+	};
+	std::vector<Cluster> clusters(cluster_starts.size());
+	for(size_t c = 0; c < clusters.size(); c++)
+	{
+		Cluster& cluster = clusters[c];
+		cluster.first = cluster_starts[c];
+		cluster.end = c + 1 < clusters.size() ? cluster_starts[c + 1] : number_of_triangles;
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for(uint32_t t = cluster.first; t < cluster.end; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+			// Area weighted
+			const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			const float a = glm::length(n);
+			center += a * (p0 + p1 + p2) / 3.0f;
+			normal += n;
+			area += a;
+		}
+		center = area > 0.0f ? center / area : mesh_center;
+		const float normal_length = glm::length(normal);
+		cluster.sort_key =
+		    normal_length > 0.0f ? glm::dot(center - mesh_center, normal / normal_length) : -INFINITY;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(),
+	                 [](const Cluster& a, const Cluster& b) { return a.sort_key > b.sort_key; });
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for(const Cluster& cluster : clusters)
+		sorted.insert(sorted.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.end * 3);
+	indices.swap(sorted);
+}
+
+void optimizeMeshes(Model* model)
+{
+	std::vector<glm::vec3> positions, normals;
+	std::vector<glm::vec2> texture_coordinates;
+	std::vector<uint32_t> indices;
+	positions.reserve(model->m_positions.size());
+	normals.reserve(model->m_positions.size());
+	texture_coordinates.reserve(model->m_positions.size());
+	indices.reserve(model->m_indices.size());
+
+	std::unordered_map<Vertex, uint32_t, VertexHash> vertex_map;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> mesh_indices, cluster_starts, remap;
+	for(auto& mesh : model->m_meshes)
+	{
+		///////////////////////////////////////////////////////////////////
+		// Merge identical vertices
+		///////////////////////////////////////////////////////////////////
+		vertex_map.clear();
+		vertices.clear();
+		mesh_indices.resize(mesh.m_number_of_indices);
+		for(uint32_t i = 0; i < mesh.m_number_of_indices; i++)
+		{
+			const uint32_t source = mesh.m_base_vertex + model->m_indices[mesh.m_start_index + i];
+			Vertex v;
+			memset(&v, 0, sizeof(v));
+			v.position = model->m_positions[source];
+			v.normal = model->m_normals[source];
+			v.texture_coordinate = model->m_texture_coordinates[source];
+			auto inserted = vertex_map.insert(std::make_pair(v, uint32_t(vertices.size())));
+			if(inserted.second)
+				vertices.push_back(v);
+			mesh_indices[i] = inserted.first->second;
+		}
+
+		///////////////////////////////////////////////////////////////////
+		// Reorder triangles, then vertices in order of first use
+		///////////////////////////////////////////////////////////////////
+		tipsify(mesh_indices, uint32_t(vertices.size()), TIPSIFY_CACHE_SIZE, cluster_starts);
+		sortClustersForOverdraw(mesh_indices, cluster_starts, vertices);
+		remap.assign(vertices.size(), UINT32_MAX);
+		const uint32_t base_vertex = uint32_t(positions.size());
+		uint32_t next_vertex = 0;
+		for(uint32_t& index : mesh_indices)
+		{
+			if(remap[index] == UINT32_MAX)
+			{
+				remap[index] = next_vertex++;
+				positions.push_back(vertices[index].position);
+				normals.push_back(vertices[index].normal);
+				texture_coordinates.push_back(vertices[index].texture_coordinate);
+			}
+			index = remap[index];
+		}
+
+		mesh.m_start_index = uint32_t(indices.size());
+		mesh.m_number_of_indices = uint32_t(mesh_indices.size());
+		mesh.m_base_vertex = base_vertex;
+		mesh.m_number_of_vertices = next_vertex;
+		indices.insert(indices.end(), mesh_indices.begin(), mesh_indices.end());
+	}
+	model->m_positions.swap(positions);
+	model->m_normals.swap(normals);
+	model->m_texture_coordinates.swap(texture_coordinates);
+	model->m_indices.swap(indices);
+}
+
+// Octahedral encoding, rounded to the 16 bit value of the four around the
+// exact one that decodes closest to the normal
+static uint32_t encodeOctahedral(glm::vec3 n)
+{
+	const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if(!(l1 > 0.0f))
+		return 0;
+	n /= l1;
+	glm::vec2 e(n.x, n.y);
+	if(n.z < 0.0f)
+	{
+		e = (1.0f - glm::abs(glm::vec2(n.y, n.x)))
+		    * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	const glm::vec2 base = glm::floor(glm::clamp(e, -1.0f, 1.0f) * 32767.0f);
+	uint32_t best = 0;
+	float best_dot = -2.0f;
+	for(int i = 0; i < 4; i++)
+	{
+		const glm::vec2 q = glm::min(base + glm::vec2(i & 1, i >> 1), glm::vec2(32767.0f));
+		const glm::vec2 d = q / 32767.0f;
+		glm::vec3 decoded(d.x, d.y, 1.0f - std::abs(d.x) - std::abs(d.y));
+		if(decoded.z < 0.0f)
+		{
+			decoded.x = (1.0f - std::abs(d.y)) * (d.x >= 0.0f ? 1.0f : -1.0f);
+			decoded.y = (1.0f - std::abs(d.x)) * (d.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		const float dot = glm::dot(glm::normalize(decoded), n / glm::length(n));
+		if(dot > best_dot)
+		{
+			best_dot = dot;
+			best = uint32_t(uint16_t(int16_t(q.x))) | (uint32_t(uint16_t(int16_t(q.y))) << 16);
+		}
+	}
+	return best;
+}
+
+void compressVertices(Model* model, CompressedVertices& compressed)
+{
+	const size_t number_of_vertices = model->m_positions.size();
+	compressed.positions.resize(number_of_vertices * 4);
+	compressed.normals.resize(number_of_vertices);
+	compressed.texture_coordinates.resize(number_of_vertices);
+	for(auto& mesh : model->m_meshes)
+	{
+		const uint32_t first = mesh.m_base_vertex, end = mesh.m_base_vertex + mesh.m_number_of_vertices;
+		glm::vec3 min_position(INFINITY), max_position(-INFINITY);
+		for(uint32_t i = first; i < end; i++)
+		{
+			min_position = glm::min(min_position, model->m_positions[i]);
+			max_position = glm::max(max_position, model->m_positions[i]);
+		}
+		if(first == end)
+			min_position = max_position = glm::vec3(0.0f);
+		mesh.m_position_offset = min_position;
+		mesh.m_position_scale = max_position - min_position;
+		glm::vec3 inverse_scale;
+		for(int c = 0; c < 3; c++)
+			inverse_scale[c] = mesh.m_position_scale[c] > 0.0f ? 65535.0f / mesh.m_position_scale[c] : 0.0f;
+		for(uint32_t i = first; i < end; i++)
+		{
+			const glm::vec3 q = glm::round((model->m_positions[i] - min_position) * inverse_scale);
+			for(int c = 0; c < 3; c++)
+				compressed.positions[i * 4 + c] = uint16_t(glm::clamp(q[c], 0.0f, 65535.0f));
+			compressed.positions[i * 4 + 3] = 0;
+			compressed.normals[i] = encodeOctahedral(model->m_normals[i]);
+			compressed.texture_coordinates[i] = glm::packHalf2x16(model->m_texture_coordinates[i]);
+		}
+	}
+}
+
+float averageCacheMissRatio(const uint32_t* indices, size_t number_of_indices, size_t number_of_vertices,
+                            int cache_size)
+{
+	if(number_of_indices < 3)
+		return 0.0f;
+	// A vertex is in the FIFO cache if it was added in the last
+	// 'cache_size' misses
+	std::vector<size_t> added(number_of_vertices, 0);
+	size_t misses = 0;
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		const uint32_t v = indices[i];
+		if(added[v] == 0 || misses + 1 - added[v] > size_t(cache_size))
+		{
+			misses++;
+			added[v] = misses;
+		}
+	}
+	return float(misses) / float(number_of_indices / 3);
+}
+} // namespace labhelper
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace labhelper
+{
+class Model;
+
+///////////////////////////////////////////////////////////////////////////
+// Rebuild the vertices and indices of each mesh of a model for rendering:
+//  - Vertices with the same position, normal and texture coordinate are
+//    merged, so each one is transformed once per cache hit instead of
+//    once per triangle corner.
+//  - Triangles are reordered with Tipsify (Sander et al., "Fast Triangle
+//    Reordering for Vertex Locality and Reduced Overdraw", 2007) for the
+//    post-transform vertex cache. The runs between the points where it
+//    has to jump to another part of the mesh are then sorted so that
+//    triangles facing outwards from the mesh, which tend to hide the
+//    others, are drawn first.
+//  - Vertices are reordered into the order in which the triangles first
+//    use them, for locality of the vertex fetches.
+// The meshes may share vertices on input, each gets its own on output.
+///////////////////////////////////////////////////////////////////////////
+void optimizeMeshes(Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+// The average number of vertices transformed per triangle (ACMR) for a
+// FIFO post-transform cache of 'cache_size' vertices. 3 is no reuse, 0.5
+// is the best a large regular mesh can get.
+///////////////////////////////////////////////////////////////////////////
+float averageCacheMissRatio(const uint32_t* indices, size_t number_of_indices, size_t number_of_vertices,
+                            int cache_size = 16);
+
+///////////////////////////////////////////////////////////////////////////
+// The compressed vertex format, 16 instead of 32 bytes per vertex:
+//  - Positions as 16 bit unsigned normalized integers (plus one of
+//    padding) within the bounding box of the mesh. The shader computes
+//    Mesh::m_position_offset + Mesh::m_position_scale * position.
+//  - Normals octahedral encoded into two 16 bit signed normalized
+//    integers, see Cigolle et al. "A Survey of Efficient Representations
+//    for Independent Unit Vectors", 2014.
+//  - Texture coordinates as two half floats.
+// compressVertices() also sets the position offset and scale of each mesh.
+///////////////////////////////////////////////////////////////////////////
+struct CompressedVertices
+{
+	std::vector<uint16_t> positions;
+	std::vector<uint32_t> normals;
+	std::vector<uint32_t> texture_coordinates;
+};
+void compressVertices(Model* model, CompressedVertices& compressed);
+} // namespace labhelper
@@ -1,62 +1,25 @@
 #include "Model.h"
+#include "ObjParser.h"
+#include "MeshOptimizer.h"
+#include "TextureLoader.h"
+#include "CacheFile.h"
 #include <iostream>
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include <tiny_obj_loader.h>
 //#include <experimental/tinyobj_loader_opt.h>
 #include <algorithm>
 #include <sstream>
+#include <map>
+#include <fstream>
 #include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <atomic>
 #include <GL/glew.h>
-#include <stb_image.h>
 
 namespace labhelper
 {
-bool Texture::load(const std::string& _directory, const std::string& _filename, int _components)
-{
-	filename = _filename;
-	directory = _directory;
-	valid = true;
-	int components;
-	data = stbi_load((directory + filename).c_str(), &width, &height, &components, _components);
-	if(data == nullptr)
-	{
-		std::cout << "ERROR: loadModelFromOBJ(): Failed to load texture: " << filename << " in " << _directory
-		          << "\n";
-		exit(1);
-	}
-	glGenTextures(1, &gl_id);
-	glBindTexture(GL_TEXTURE_2D, gl_id);
-	GLenum format, internal_format;
-	if(_components == 1)
-	{
-		format = GL_R;
-		internal_format = GL_R8;
-	}
-	else if(_components == 3)
-	{
-		format = GL_RGB;
-		internal_format = GL_RGB;
-	}
-	else if(_components == 4)
-	{
-		format = GL_RGBA;
-		internal_format = GL_RGBA;
-	}
-	else
-	{
-		std::cout << "Texture loading not implemented for this number of compenents.\n";
-		exit(1);
-	}
-	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
-	return true;
-}
-
 ///////////////////////////////////////////////////////////////////////////
 // Destructor
 ///////////////////////////////////////////////////////////////////////////
@@ -64,63 +27,54 @@ Model::~Model()
 {
 	for(auto& material : m_materials)
 	{
-		if(material.m_color_texture.valid)
-			glDeleteTextures(1, &material.m_color_texture.gl_id);
-		if(material.m_reflectivity_texture.valid)
-			glDeleteTextures(1, &material.m_reflectivity_texture.gl_id);
-		if(material.m_shininess_texture.valid)
-			glDeleteTextures(1, &material.m_shininess_texture.gl_id);
-		if(material.m_metalness_texture.valid)
-			glDeleteTextures(1, &material.m_metalness_texture.gl_id);
-		if(material.m_fresnel_texture.valid)
-			glDeleteTextures(1, &material.m_fresnel_texture.gl_id);
-		if(material.m_emission_texture.valid)
-			glDeleteTextures(1, &material.m_emission_texture.gl_id);
-	}
-	glDeleteBuffers(1, &m_positions_bo);
-	glDeleteBuffers(1, &m_normals_bo);
-	glDeleteBuffers(1, &m_texture_coordinates_bo);
-}
-
-Model* loadModelFromOBJ(std::string path)
-{
-	///////////////////////////////////////////////////////////////////////
-	// Separate filename into directory, base filename and extension
-	// NOTE: This can be made a LOT simpler as soon as compilers properly
-	//		 support std::filesystem (C++17)
-	///////////////////////////////////////////////////////////////////////
-	size_t separator = path.find_last_of("\\/");
-	std::string filename, extension, directory;
-	if(separator != std::string::npos)
-	{
-		filename = path.substr(separator + 1, path.size() - separator - 1);
-		directory = path.substr(0, separator + 1);
-	}
-	else
-	{
-		filename = path;
-		directory = "./";
+		Texture* textures[] = { &material.m_color_texture,     &material.m_reflectivity_texture,
+			                    &material.m_shininess_texture, &material.m_metalness_texture,
+			                    &material.m_fresnel_texture,   &material.m_emission_texture };
+		for(Texture* texture : textures)
+			releaseTexture(texture);
 	}
-	separator = filename.find_last_of(".");
-	if(separator == std::string::npos)
+	// Models that were never uploaded may not have a GL context
+	if(m_vaob != 0)
 	{
-		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
-		exit(1);
+		glDeleteBuffers(1, &m_positions_bo);
+		glDeleteBuffers(1, &m_normals_bo);
+		glDeleteBuffers(1, &m_texture_coordinates_bo);
+		glDeleteBuffers(1, &m_vertices_bo);
+		glDeleteBuffers(1, &m_indices_bo);
+		glDeleteVertexArrays(1, &m_vaob);
+		glDeleteVertexArrays(1, &m_positions_vaob);
 	}
-	extension = filename.substr(separator, filename.size() - separator);
-	filename = filename.substr(0, separator);
+}
 
+// Below this, generating the vertices of a model is not worth a thread
+static const uint32_t MIN_VERTICES_PER_THREAD = 1 << 18;
+
+///////////////////////////////////////////////////////////////////////////
+// Parse an OBJ file (and its MTL files) into a Model, without textures and
+// GPU buffers. Every triangle gets three vertices of its own here, they are
+// merged by optimizeMeshes() afterwards.
+///////////////////////////////////////////////////////////////////////////
+static Model* parseOBJ(const std::string& directory, const std::string& obj_filename)
+{
 	///////////////////////////////////////////////////////////////////////
-	// Parse the OBJ file using tinyobj
+	// Parse the OBJ file, with tinyobj or the parallel parser
 	///////////////////////////////////////////////////////////////////////
-	std::cout << "Loading " << path << "..." << std::flush;
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 	std::string err;
 	// Expect '.mtl' file in the same directory and triangulate meshes
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err,
-	                            (directory + filename + extension).c_str(), directory.c_str(), true);
+	bool ret;
+	if(loader_settings.use_parallel_parser)
+	{
+		ret = parseOBJParallel(&attrib, &shapes, &materials, &err, (directory + obj_filename).c_str(),
+		                       directory.c_str(), loader_settings.parser_threads);
+	}
+	else
+	{
+		ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, (directory + obj_filename).c_str(),
+		                       directory.c_str(), true);
+	}
 	if(!err.empty())
 	{ // `err` may contain warning message.
 		std::cerr << err << std::endl;
@@ -130,63 +84,90 @@ Model* loadModelFromOBJ(std::string path)
 		exit(1);
 	}
 	Model* model = new Model;
-	model->m_name = filename;
-	model->m_filename = path;
 
 	///////////////////////////////////////////////////////////////////////
-	// Transform all materials into our datastructure
+	// Transform all materials into our datastructure. The textures are
+	// loaded later, by loadTextures().
 	///////////////////////////////////////////////////////////////////////
 	for(const auto& m : materials)
 	{
 		Material material;
 		material.m_name = m.name;
 		material.m_color = glm::vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
-		if(m.diffuse_texname != "")
-		{
-			material.m_color_texture.load(directory, m.diffuse_texname, 4);
-		}
+		material.m_color_texture.filename = m.diffuse_texname;
 		material.m_reflectivity = m.specular[0];
-		if(m.specular_texname != "")
-		{
-			material.m_reflectivity_texture.load(directory, m.specular_texname, 1);
-		}
+		material.m_reflectivity_texture.filename = m.specular_texname;
 		material.m_metalness = m.metallic;
-		if(m.metallic_texname != "")
-		{
-			material.m_metalness_texture.load(directory, m.metallic_texname, 1);
-		}
+		material.m_metalness_texture.filename = m.metallic_texname;
 		material.m_fresnel = m.sheen;
-		if(m.sheen_texname != "")
-		{
-			material.m_fresnel_texture.load(directory, m.sheen_texname, 1);
-		}
+		material.m_fresnel_texture.filename = m.sheen_texname;
 		material.m_shininess = m.roughness;
-		if(m.roughness_texname != "")
-		{
-			material.m_shininess_texture.load(directory, m.roughness_texname, 1);
-		}
+		material.m_shininess_texture.filename = m.roughness_texname;
 		material.m_emission = m.emission[0];
-		if(m.emissive_texname != "")
+		material.m_emission_texture.filename = m.emissive_texname;
+		material.m_transparency = m.transmittance[0];
+		auto casts_shadows = m.unknown_parameter.find("casts_shadows");
+		if(casts_shadows != m.unknown_parameter.end())
 		{
-			material.m_emission_texture.load(directory, m.emissive_texname, 4);
+			material.m_casts_shadows = atoi(casts_shadows->second.c_str()) != 0;
 		}
-		material.m_transparency = m.transmittance[0];
 		model->m_materials.push_back(material);
 	}
 
 	///////////////////////////////////////////////////////////////////////
-	// A vertex in the OBJ file may have different indices for position,
-	// normal and texture coordinate. We will not even attempt to use
-	// indexed lookups, but will store a simple vertex stream per mesh.
+	// Now we will turn all shapes into Meshes. A shape that has several
+	// materials will be split into several meshes with unique names, one
+	// per material in the order the materials first appear in the shape.
+	// The faces of each material are counted first, so that every mesh
+	// gets its final range of vertices before any vertex is written.
+	// Faces without a material are dropped.
 	///////////////////////////////////////////////////////////////////////
-	uint64_t number_of_vertices = 0;
-	for(const auto& shape : shapes)
+	struct ShapeMeshes
+	{
+		// The Mesh of each material in the shape, or -1
+		std::vector<int> mesh_of_material;
+		std::vector<Mesh> meshes;
+	};
+	std::vector<ShapeMeshes> shape_meshes(shapes.size());
+	uint32_t number_of_vertices = 0;
+	for(size_t s = 0; s < shapes.size(); s++)
 	{
-		number_of_vertices += shape.mesh.indices.size();
+		const tinyobj::shape_t& shape = shapes[s];
+		ShapeMeshes& split = shape_meshes[s];
+		split.mesh_of_material.assign(materials.size(), -1);
+		std::vector<uint32_t> faces_per_mesh;
+		for(int material_index : shape.mesh.material_ids)
+		{
+			if(material_index < 0 || material_index >= int(materials.size()))
+				continue;
+			int& mesh_index = split.mesh_of_material[material_index];
+			if(mesh_index == -1)
+			{
+				mesh_index = int(split.meshes.size());
+				Mesh mesh;
+				mesh.m_name = shape.name + "_" + materials[material_index].name;
+				mesh.m_material_idx = material_index;
+				split.meshes.push_back(mesh);
+				faces_per_mesh.push_back(0);
+			}
+			faces_per_mesh[mesh_index]++;
+		}
+		if(split.meshes.size() == 1)
+			split.meshes[0].m_name = shape.name;
+		for(size_t m = 0; m < split.meshes.size(); m++)
+		{
+			Mesh& mesh = split.meshes[m];
+			mesh.m_start_index = number_of_vertices;
+			mesh.m_base_vertex = number_of_vertices;
+			mesh.m_number_of_vertices = faces_per_mesh[m] * 3;
+			mesh.m_number_of_indices = mesh.m_number_of_vertices;
+			number_of_vertices += mesh.m_number_of_vertices;
+		}
 	}
 	model->m_positions.resize(number_of_vertices);
 	model->m_normals.resize(number_of_vertices);
 	model->m_texture_coordinates.resize(number_of_vertices);
+	model->m_indices.resize(number_of_vertices);
 
 	///////////////////////////////////////////////////////////////////////
 	// For each vertex _position_ auto generate a normal that will be used
@@ -222,131 +203,604 @@ Model* loadModelFromOBJ(std::string path)
 	}
 
 	///////////////////////////////////////////////////////////////////////
-	// Now we will turn all shapes into Meshes. A shape that has several
-	// materials will be split into several meshes with unique names
+	// Generate the vertices, each face straight into the next free slot
+	// of its mesh. The shapes are independent, so large models are done
+	// on several threads.
 	///////////////////////////////////////////////////////////////////////
-	int vertices_so_far = 0;
-	for(const auto& shape : shapes)
-	{
-		///////////////////////////////////////////////////////////////////
-		// The shapes in an OBJ file may several different materials.
-		// If so, we will split the shape into one Mesh per Material
-		///////////////////////////////////////////////////////////////////
-		int next_material_index = shape.mesh.material_ids[0];
-		int next_material_starting_face = 0;
-		std::vector<bool> finished_materials(materials.size(), false);
-		int number_of_materials_in_shape = 0;
-		while(next_material_index != -1)
+	auto generateVertices = [&](size_t s) {
+		const tinyobj::shape_t& shape = shapes[s];
+		const ShapeMeshes& split = shape_meshes[s];
+		std::vector<uint32_t> next_vertex(split.meshes.size());
+		for(size_t m = 0; m < split.meshes.size(); m++)
+			next_vertex[m] = split.meshes[m].m_start_index;
+		for(size_t i = 0; i < shape.mesh.material_ids.size(); i++)
 		{
-			int current_material_index = next_material_index;
-			int current_material_starting_face = next_material_starting_face;
-			next_material_index = -1;
-			next_material_starting_face = -1;
-			// Process a new Mesh with a unique material
-			Mesh mesh;
-			mesh.m_name = shape.name + "_" + materials[current_material_index].name;
-			mesh.m_material_idx = current_material_index;
-			mesh.m_start_index = vertices_so_far;
-			number_of_materials_in_shape += 1;
-
-			uint64_t number_of_faces = shape.mesh.indices.size() / 3;
-			for(int i = current_material_starting_face; i < number_of_faces; i++)
+			const int material_index = shape.mesh.material_ids[i];
+			if(material_index < 0 || material_index >= int(materials.size()))
+				continue;
+			const int mesh_index = split.mesh_of_material[material_index];
+			const uint32_t v = next_vertex[mesh_index];
+			next_vertex[mesh_index] += 3;
+			for(int j = 0; j < 3; j++)
 			{
-				if(shape.mesh.material_ids[i] != current_material_index)
+				const tinyobj::index_t& index = shape.mesh.indices[i * 3 + j];
+				model->m_indices[v + j] = v + j - split.meshes[mesh_index].m_base_vertex;
+				model->m_positions[v + j] = glm::vec3(attrib.vertices[index.vertex_index * 3 + 0],
+				                                      attrib.vertices[index.vertex_index * 3 + 1],
+				                                      attrib.vertices[index.vertex_index * 3 + 2]);
+				if(index.normal_index == -1)
 				{
-					if(next_material_index >= 0)
-						continue;
-					else if(finished_materials[shape.mesh.material_ids[i]])
-						continue;
-					else
-					{ // Found a new material that we have not processed.
-						next_material_index = shape.mesh.material_ids[i];
-						next_material_starting_face = i;
-					}
+					// No normal, use the autogenerated
+					model->m_normals[v + j] = glm::vec3(auto_normals[index.vertex_index]);
 				}
 				else
 				{
-					///////////////////////////////////////////////////////
-					// Now we generate the vertices
-					///////////////////////////////////////////////////////
-					for(int j = 0; j < 3; j++)
-					{
-						int v = shape.mesh.indices[i * 3 + j].vertex_index;
-						model->m_positions[vertices_so_far + j] =
-						    glm::vec3(attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 0],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 1],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 2]);
-						if(shape.mesh.indices[i * 3 + j].normal_index == -1)
-						{
-							// No normal, use the autogenerated
-							model->m_normals[vertices_so_far + j] = glm::vec3(
-							    auto_normals[shape.mesh.indices[i * 3 + j].vertex_index]);
-						}
-						else
-						{
-							model->m_normals[vertices_so_far + j] =
-							    glm::vec3(attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 0],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 1],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 2]);
-						}
-						if(shape.mesh.indices[i * 3 + j].texcoord_index == -1)
-						{
-							// No UV coordinates. Use null.
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(0.0f);
-						}
-						else
-						{
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 0],
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 1]);
-						}
-					}
-					vertices_so_far += 3;
+					model->m_normals[v + j] = glm::vec3(attrib.normals[index.normal_index * 3 + 0],
+					                                    attrib.normals[index.normal_index * 3 + 1],
+					                                    attrib.normals[index.normal_index * 3 + 2]);
+				}
+				if(index.texcoord_index == -1)
+				{
+					// No UV coordinates. Use null.
+					model->m_texture_coordinates[v + j] = glm::vec2(0.0f);
+				}
+				else
+				{
+					model->m_texture_coordinates[v + j] = glm::vec2(attrib.texcoords[index.texcoord_index * 2 + 0],
+					                                                attrib.texcoords[index.texcoord_index * 2 + 1]);
 				}
 			}
-			///////////////////////////////////////////////////////////////
-			// Finalize and push this mesh to the list
-			///////////////////////////////////////////////////////////////
-			mesh.m_number_of_vertices = vertices_so_far - mesh.m_start_index;
-			model->m_meshes.push_back(mesh);
-			finished_materials[current_material_index] = true;
 		}
-		if(number_of_materials_in_shape == 1)
+	};
+	int threads = loader_settings.parser_threads;
+	if(threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+	if(number_of_vertices < MIN_VERTICES_PER_THREAD * 2)
+		threads = 1;
+	threads = std::min(threads, int(shapes.size()));
+	std::atomic<size_t> next_shape(0);
+	auto worker = [&]() {
+		for(size_t s = next_shape++; s < shapes.size(); s = next_shape++)
+			generateVertices(s);
+	};
+	std::vector<std::thread> workers;
+	for(int i = 1; i < threads; i++)
+		workers.push_back(std::thread(worker));
+	worker();
+	for(auto& thread : workers)
+		thread.join();
+
+	for(auto& split : shape_meshes)
+		model->m_meshes.insert(model->m_meshes.end(), split.meshes.begin(), split.meshes.end());
+	return model;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Load the textures named by the materials of a model
+///////////////////////////////////////////////////////////////////////////
+static void loadTextures(Model* model, const std::string& directory)
+{
+	for(auto& material : model->m_materials)
+	{
+		if(material.m_color_texture.filename != "")
+			material.m_color_texture.load(directory, material.m_color_texture.filename, 4);
+		if(material.m_reflectivity_texture.filename != "")
+			material.m_reflectivity_texture.load(directory, material.m_reflectivity_texture.filename, 1);
+		if(material.m_metalness_texture.filename != "")
+			material.m_metalness_texture.load(directory, material.m_metalness_texture.filename, 1);
+		if(material.m_fresnel_texture.filename != "")
+			material.m_fresnel_texture.load(directory, material.m_fresnel_texture.filename, 1);
+		if(material.m_shininess_texture.filename != "")
+			material.m_shininess_texture.load(directory, material.m_shininess_texture.filename, 1);
+		if(material.m_emission_texture.filename != "")
+			material.m_emission_texture.load(directory, material.m_emission_texture.filename, 4);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Create the vertex buffers and vertex array objects of a model
+///////////////////////////////////////////////////////////////////////////
+struct VertexStream
+{
+	const void* data;
+	// Bytes per vertex
+	size_t size;
+	GLint components;
+	GLenum type;
+	bool normalized;
+};
+
+void uploadModel(Model* model)
+{
+	if(model->m_vaob != 0)
+		return;
+	for(auto& material : model->m_materials)
+	{
+		Texture* textures[] = { &material.m_color_texture,     &material.m_reflectivity_texture,
+			                    &material.m_shininess_texture, &material.m_metalness_texture,
+			                    &material.m_fresnel_texture,   &material.m_emission_texture };
+		for(Texture* texture : textures)
+			uploadTexture(texture);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// The index buffer holds 16 bit indices for the meshes that have few
+	// enough vertices, and 32 bit indices for the rest. Each mesh starts on
+	// a 4 byte boundary.
+	///////////////////////////////////////////////////////////////////////
+	std::vector<uint8_t> index_data;
+	for(auto& mesh : model->m_meshes)
+	{
+		index_data.resize((index_data.size() + 3) & ~size_t(3));
+		mesh.m_index_buffer_offset = uint32_t(index_data.size());
+		const uint32_t* indices = &model->m_indices[mesh.m_start_index];
+		if(mesh.m_number_of_vertices <= 65536)
+		{
+			index_data.resize(index_data.size() + mesh.m_number_of_indices * sizeof(uint16_t));
+			uint16_t* dst = (uint16_t*)&index_data[mesh.m_index_buffer_offset];
+			for(uint32_t i = 0; i < mesh.m_number_of_indices; i++)
+				dst[i] = uint16_t(indices[i]);
+		}
+		else
 		{
-			model->m_meshes.back().m_name = shape.name;
+			index_data.resize(index_data.size() + mesh.m_number_of_indices * sizeof(uint32_t));
+			memcpy(&index_data[mesh.m_index_buffer_offset], indices, mesh.m_number_of_indices * sizeof(uint32_t));
 		}
 	}
+	glGenBuffers(1, &model->m_indices_bo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->m_indices_bo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_data.size(), index_data.data(), GL_STATIC_DRAW);
+
+	///////////////////////////////////////////////////////////////////////
+	// The position, normal and texture coordinate streams, as floats or
+	// compressed
+	///////////////////////////////////////////////////////////////////////
+	model->m_compressed_vertices = loader_settings.compress_vertices;
+	model->m_interleaved_vertices = loader_settings.interleave_vertices;
+	CompressedVertices compressed;
+	VertexStream streams[3];
+	if(model->m_compressed_vertices)
+	{
+		compressVertices(model, compressed);
+		streams[0] = { compressed.positions.data(), 4 * sizeof(uint16_t), 3, GL_UNSIGNED_SHORT, true };
+		streams[1] = { compressed.normals.data(), sizeof(uint32_t), 2, GL_SHORT, true };
+		streams[2] = { compressed.texture_coordinates.data(), sizeof(uint32_t), 2, GL_HALF_FLOAT, false };
+	}
+	else
+	{
+		streams[0] = { model->m_positions.data(), sizeof(glm::vec3), 3, GL_FLOAT, false };
+		streams[1] = { model->m_normals.data(), sizeof(glm::vec3), 3, GL_FLOAT, false };
+		streams[2] = { model->m_texture_coordinates.data(), sizeof(glm::vec2), 2, GL_FLOAT, false };
+	}
+	const size_t number_of_vertices = model->m_positions.size();
 
 	///////////////////////////////////////////////////////////////////////
-	// Upload to GPU
+	// Upload to GPU. Either each stream in a buffer of its own, or all in
+	// one buffer: the positions first, so that passes that only need them
+	// read nothing else, and then the other attributes interleaved.
+	///////////////////////////////////////////////////////////////////////
+	GLuint buffers[3];
+	size_t offsets[3], strides[3];
+	if(model->m_interleaved_vertices)
+	{
+		const size_t attributes_offset = (number_of_vertices * streams[0].size + 15) & ~size_t(15);
+		const size_t attributes_stride = streams[1].size + streams[2].size;
+		std::vector<uint8_t> data(attributes_offset + number_of_vertices * attributes_stride);
+		memcpy(data.data(), streams[0].data, number_of_vertices * streams[0].size);
+		for(size_t i = 0; i < number_of_vertices; i++)
+		{
+			uint8_t* dst = &data[attributes_offset + i * attributes_stride];
+			memcpy(dst, (const uint8_t*)streams[1].data + i * streams[1].size, streams[1].size);
+			memcpy(dst + streams[1].size, (const uint8_t*)streams[2].data + i * streams[2].size, streams[2].size);
+		}
+		glGenBuffers(1, &model->m_vertices_bo);
+		glBindBuffer(GL_ARRAY_BUFFER, model->m_vertices_bo);
+		glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+		for(int i = 0; i < 3; i++)
+			buffers[i] = model->m_vertices_bo;
+		offsets[0] = 0;
+		offsets[1] = attributes_offset;
+		offsets[2] = attributes_offset + streams[1].size;
+		strides[0] = streams[0].size;
+		strides[1] = strides[2] = attributes_stride;
+	}
+	else
+	{
+		glGenBuffers(1, &model->m_positions_bo);
+		glGenBuffers(1, &model->m_normals_bo);
+		glGenBuffers(1, &model->m_texture_coordinates_bo);
+		buffers[0] = model->m_positions_bo;
+		buffers[1] = model->m_normals_bo;
+		buffers[2] = model->m_texture_coordinates_bo;
+		for(int i = 0; i < 3; i++)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+			glBufferData(GL_ARRAY_BUFFER, number_of_vertices * streams[i].size, streams[i].data, GL_STATIC_DRAW);
+			offsets[i] = 0;
+			strides[i] = streams[i].size;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// One vertex array object with all attributes, and one with only the
+	// positions for depth only passes
 	///////////////////////////////////////////////////////////////////////
 	glGenVertexArrays(1, &model->m_vaob);
-	glBindVertexArray(model->m_vaob);
-	glGenBuffers(1, &model->m_positions_bo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->m_positions_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_positions.size() * sizeof(glm::vec3), &model->m_positions[0].x,
-	             GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);
-	glEnableVertexAttribArray(0);
-	glGenBuffers(1, &model->m_normals_bo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->m_normals_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_normals.size() * sizeof(glm::vec3), &model->m_normals[0].x,
-	             GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, false, 0, 0);
-	glEnableVertexAttribArray(1);
-	glGenBuffers(1, &model->m_texture_coordinates_bo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->m_texture_coordinates_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_texture_coordinates.size() * sizeof(glm::vec2),
-	             &model->m_texture_coordinates[0].x, GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);
-	glEnableVertexAttribArray(2);
-
-	std::cout << "done.\n";
+	glGenVertexArrays(1, &model->m_positions_vaob);
+	for(GLuint vaob : { model->m_vaob, model->m_positions_vaob })
+	{
+		glBindVertexArray(vaob);
+		const int number_of_attributes = vaob == model->m_vaob ? 3 : 1;
+		for(int i = 0; i < number_of_attributes; i++)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+			glVertexAttribPointer(i, streams[i].components, streams[i].type, streams[i].normalized,
+			                      GLsizei(strides[i]), (GLvoid*)offsets[i]);
+			glEnableVertexAttribArray(i);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->m_indices_bo);
+	}
+
+	if(!loader_settings.keep_cpu_data)
+	{
+		std::vector<glm::vec3>().swap(model->m_positions);
+		std::vector<glm::vec3>().swap(model->m_normals);
+		std::vector<glm::vec2>().swap(model->m_texture_coordinates);
+		std::vector<uint32_t>().swap(model->m_indices);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Binary mesh cache. The file holds everything parseOBJ() produces, plus
+// the size and modification time of the OBJ and MTL files it was made
+// from. The vertex arrays are 16 byte aligned in the file, so that they
+// can be used straight from the mapped file.
+///////////////////////////////////////////////////////////////////////////
+LoaderSettings loader_settings;
+
+// Change when the layout of the cache or the output of parseOBJ() changes
+static const uint32_t MESH_CACHE_MAGIC = 0x434d484c; // "LHMC"
+static const uint32_t MESH_CACHE_VERSION = 3;
+
+// The OBJ file and the material libraries it names
+static std::vector<SourceFile> findSourceFiles(const std::string& directory, const std::string& obj_filename)
+{
+	std::vector<SourceFile> sources(1);
+	sources[0].filename = obj_filename;
+	std::ifstream obj_file(directory + obj_filename);
+	std::string line;
+	while(std::getline(obj_file, line))
+	{
+		std::istringstream fields(line);
+		std::string keyword, mtl_filename;
+		fields >> keyword;
+		if(keyword != "mtllib")
+			continue;
+		while(fields >> mtl_filename)
+		{
+			SourceFile source;
+			source.filename = mtl_filename;
+			sources.push_back(source);
+		}
+	}
+	return sources;
+}
+
+// The textures named by the material libraries, with the number of
+// components loadTextures() loads them with
+static std::vector<std::pair<std::string, int>> findMaterialTextures(const std::string& directory,
+                                                                    const std::vector<SourceFile>& sources)
+{
+	std::vector<std::pair<std::string, int>> found;
+	for(size_t i = 1; i < sources.size(); i++)
+	{
+		std::ifstream mtl_file(directory + sources[i].filename);
+		if(!mtl_file)
+			continue;
+		std::map<std::string, int> material_map;
+		std::vector<tinyobj::material_t> materials;
+		std::string warning;
+		tinyobj::LoadMtl(&material_map, &materials, &mtl_file, &warning);
+		for(const auto& m : materials)
+		{
+			const std::pair<std::string, int> textures[] = {
+				{ m.diffuse_texname, 4 }, { m.specular_texname, 1 }, { m.metallic_texname, 1 },
+				{ m.sheen_texname, 1 },   { m.roughness_texname, 1 }, { m.emissive_texname, 4 }
+			};
+			for(const auto& texture : textures)
+			{
+				if(texture.first != "")
+					found.push_back(std::make_pair(directory + texture.first, texture.second));
+			}
+		}
+	}
+	return found;
+}
+
+// Start decoding the textures of the material libraries, to have them
+// decoded by the time loadTextures() asks for them
+static void prefetchMaterialTextures(const std::string& directory, const std::string& obj_filename)
+{
+	for(const auto& texture : findMaterialTextures(directory, findSourceFiles(directory, obj_filename)))
+		prefetchTexture(texture.first, texture.second);
+}
+
+ModelFiles findModelFiles(const std::string& path)
+{
+	size_t separator = path.find_last_of("\\/");
+	const std::string directory = separator != std::string::npos ? path.substr(0, separator + 1) : "./";
+	const std::string obj_filename = separator != std::string::npos ? path.substr(separator + 1) : path;
+	ModelFiles files;
+	const std::vector<SourceFile> sources = findSourceFiles(directory, obj_filename);
+	for(const auto& source : sources)
+		files.sources.push_back(directory + source.filename);
+	for(const auto& texture : findMaterialTextures(directory, sources))
+	{
+		if(std::find(files.textures.begin(), files.textures.end(), texture.first) == files.textures.end())
+			files.textures.push_back(texture.first);
+	}
+	return files;
+}
+
+static void writeMeshCache(const Model* model, const std::string& cache_path, const std::string& directory,
+                           const std::string& obj_filename)
+{
+	CacheWriter out;
+	out.write(MESH_CACHE_MAGIC);
+	out.write(MESH_CACHE_VERSION);
+	std::vector<SourceFile> sources = findSourceFiles(directory, obj_filename);
+	out.write(uint32_t(sources.size()));
+	for(auto& source : sources)
+	{
+		if(!source.stat(directory))
+			return;
+		out.write(source.filename);
+		out.write(source.size);
+		out.write(source.time);
+	}
+
+	out.write(uint32_t(model->m_materials.size()));
+	for(const auto& material : model->m_materials)
+	{
+		out.write(material.m_name);
+		out.write(material.m_color);
+		out.write(material.m_reflectivity);
+		out.write(material.m_shininess);
+		out.write(material.m_metalness);
+		out.write(material.m_fresnel);
+		out.write(material.m_emission);
+		out.write(material.m_transparency);
+		out.write(uint8_t(material.m_casts_shadows));
+		out.write(material.m_color_texture.filename);
+		out.write(material.m_reflectivity_texture.filename);
+		out.write(material.m_shininess_texture.filename);
+		out.write(material.m_metalness_texture.filename);
+		out.write(material.m_fresnel_texture.filename);
+		out.write(material.m_emission_texture.filename);
+	}
+	out.write(uint32_t(model->m_meshes.size()));
+	for(const auto& mesh : model->m_meshes)
+	{
+		out.write(mesh.m_name);
+		out.write(mesh.m_material_idx);
+		out.write(mesh.m_start_index);
+		out.write(mesh.m_number_of_indices);
+		out.write(mesh.m_base_vertex);
+		out.write(mesh.m_number_of_vertices);
+	}
+	const uint64_t number_of_vertices = model->m_positions.size();
+	const uint64_t number_of_indices = model->m_indices.size();
+	out.write(number_of_vertices);
+	out.write(number_of_indices);
+	out.align();
+	out.write(model->m_positions.data(), number_of_vertices * sizeof(glm::vec3));
+	out.align();
+	out.write(model->m_normals.data(), number_of_vertices * sizeof(glm::vec3));
+	out.align();
+	out.write(model->m_texture_coordinates.data(), number_of_vertices * sizeof(glm::vec2));
+	out.align();
+	out.write(model->m_indices.data(), number_of_indices * sizeof(uint32_t));
+
+	if(!out.save(cache_path))
+		std::cout << " (could not write " << cache_path << ")" << std::flush;
+}
+
+// Does every mesh stay within the arrays of the model? A damaged cache must
+// not make the renderers read past them.
+static bool meshesInRange(const Model* model)
+{
+	for(const auto& mesh : model->m_meshes)
+	{
+		if(mesh.m_material_idx >= model->m_materials.size()
+		   || uint64_t(mesh.m_start_index) + mesh.m_number_of_indices > model->m_indices.size()
+		   || uint64_t(mesh.m_base_vertex) + mesh.m_number_of_vertices > model->m_positions.size())
+			return false;
+		for(uint32_t i = 0; i < mesh.m_number_of_indices; i++)
+		{
+			if(model->m_indices[mesh.m_start_index + i] >= mesh.m_number_of_vertices)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Returns nullptr if there is no cache, or if it is out of date or damaged
+static Model* loadMeshCache(const std::string& cache_path, const std::string& directory)
+{
+	MappedFile file;
+	if(!file.open(cache_path))
+		return nullptr;
+	CacheReader in;
+	in.data = file.data;
+	in.size = file.size;
+	if(in.read<uint32_t>() != MESH_CACHE_MAGIC || in.read<uint32_t>() != MESH_CACHE_VERSION)
+		return nullptr;
+	const uint32_t number_of_sources = in.read<uint32_t>();
+	for(uint32_t i = 0; i < number_of_sources && in.ok; i++)
+	{
+		SourceFile source;
+		source.filename = in.readString();
+		const int64_t size = in.read<int64_t>(), time = in.read<int64_t>();
+		if(!source.stat(directory) || source.size != size || source.time != time)
+			return nullptr;
+	}
+
+	// Every material and mesh takes at least one byte, which keeps a damaged
+	// count from allocating gigabytes
+	const uint32_t number_of_materials = in.read<uint32_t>();
+	if(!in.ok || number_of_materials > in.size - in.offset)
+		return nullptr;
+	Model* model = new Model;
+	model->m_materials.resize(number_of_materials);
+	for(auto& material : model->m_materials)
+	{
+		material.m_name = in.readString();
+		material.m_color = in.read<glm::vec3>();
+		material.m_reflectivity = in.read<float>();
+		material.m_shininess = in.read<float>();
+		material.m_metalness = in.read<float>();
+		material.m_fresnel = in.read<float>();
+		material.m_emission = in.read<float>();
+		material.m_transparency = in.read<float>();
+		material.m_casts_shadows = in.read<uint8_t>() != 0;
+		material.m_color_texture.filename = in.readString();
+		material.m_reflectivity_texture.filename = in.readString();
+		material.m_shininess_texture.filename = in.readString();
+		material.m_metalness_texture.filename = in.readString();
+		material.m_fresnel_texture.filename = in.readString();
+		material.m_emission_texture.filename = in.readString();
+		if(!in.ok)
+			break;
+	}
+	const uint32_t number_of_meshes = in.ok ? in.read<uint32_t>() : 0;
+	if(!in.ok || number_of_meshes > in.size - in.offset)
+	{
+		delete model;
+		return nullptr;
+	}
+	model->m_meshes.resize(number_of_meshes);
+	for(auto& mesh : model->m_meshes)
+	{
+		mesh.m_name = in.readString();
+		mesh.m_material_idx = in.read<uint32_t>();
+		mesh.m_start_index = in.read<uint32_t>();
+		mesh.m_number_of_indices = in.read<uint32_t>();
+		mesh.m_base_vertex = in.read<uint32_t>();
+		mesh.m_number_of_vertices = in.read<uint32_t>();
+		if(!in.ok)
+			break;
+	}
+	const uint64_t number_of_vertices = in.read<uint64_t>();
+	const uint64_t number_of_indices = in.read<uint64_t>();
+	// Bounded by the file size, so that the byte counts below can not wrap
+	if(number_of_vertices > in.size / sizeof(glm::vec3) || number_of_indices > in.size / sizeof(uint32_t))
+	{
+		delete model;
+		return nullptr;
+	}
+	in.align();
+	const void* positions = in.read(number_of_vertices * sizeof(glm::vec3));
+	in.align();
+	const void* normals = in.read(number_of_vertices * sizeof(glm::vec3));
+	in.align();
+	const void* texture_coordinates = in.read(number_of_vertices * sizeof(glm::vec2));
+	in.align();
+	const void* indices = in.read(number_of_indices * sizeof(uint32_t));
+	if(!in.ok)
+	{
+		delete model;
+		return nullptr;
+	}
+	model->m_positions.resize(number_of_vertices);
+	model->m_normals.resize(number_of_vertices);
+	model->m_texture_coordinates.resize(number_of_vertices);
+	memcpy(model->m_positions.data(), positions, number_of_vertices * sizeof(glm::vec3));
+	memcpy(model->m_normals.data(), normals, number_of_vertices * sizeof(glm::vec3));
+	memcpy(model->m_texture_coordinates.data(), texture_coordinates, number_of_vertices * sizeof(glm::vec2));
+	model->m_indices.resize(number_of_indices);
+	memcpy(model->m_indices.data(), indices, number_of_indices * sizeof(uint32_t));
+	if(!meshesInRange(model))
+	{
+		delete model;
+		return nullptr;
+	}
+	return model;
+}
+
+Model* loadModelFromOBJ(std::string path)
+{
+	///////////////////////////////////////////////////////////////////////
+	// Separate filename into directory, base filename and extension
+	// NOTE: This can be made a LOT simpler as soon as compilers properly
+	//		 support std::filesystem (C++17)
+	///////////////////////////////////////////////////////////////////////
+	size_t separator = path.find_last_of("\\/");
+	std::string filename, extension, directory;
+	if(separator != std::string::npos)
+	{
+		filename = path.substr(separator + 1, path.size() - separator - 1);
+		directory = path.substr(0, separator + 1);
+	}
+	else
+	{
+		filename = path;
+		directory = "./";
+	}
+	separator = filename.find_last_of(".");
+	if(separator == std::string::npos)
+	{
+		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
+		exit(1);
+	}
+	extension = filename.substr(separator, filename.size() - separator);
+	filename = filename.substr(0, separator);
+
+	///////////////////////////////////////////////////////////////////////
+	// Load the binary cache of the OBJ file if it is up to date, and
+	// parse the OBJ file (and refresh the cache) otherwise
+	///////////////////////////////////////////////////////////////////////
+	std::cout << "Loading " << path << "..." << std::flush;
+	const std::string cache_path = directory + filename + ".meshcache";
+	Model* model = nullptr;
+	if(loader_settings.use_mesh_cache)
+	{
+		model = loadMeshCache(cache_path, directory);
+	}
+	const bool cached = model != nullptr;
+	if(!cached)
+	{
+		prefetchMaterialTextures(directory, filename + extension);
+		model = parseOBJ(directory, filename + extension);
+		optimizeMeshes(model);
+		if(loader_settings.use_mesh_cache)
+		{
+			writeMeshCache(model, cache_path, directory, filename + extension);
+		}
+	}
+	model->m_name = filename;
+	model->m_filename = path;
+	loadTextures(model, directory);
+	if(loader_settings.upload_to_gpu)
+		uploadModel(model);
+
+	std::cout << (cached ? "done (cached).\n" : "done.\n");
 	return model;
 }
 
 void saveModelToOBJ(Model* model, std::string path)
 {
+	// The vertices and indices are gone once uploaded without
+	// LoaderSettings::keep_cpu_data
+	if(!model->m_meshes.empty()
+	   && (model->m_positions.empty() || model->m_indices.empty()
+	       || model->m_normals.size() != model->m_positions.size()
+	       || model->m_texture_coordinates.size() != model->m_positions.size()))
+	{
+		std::cout << "ERROR: saveModelToOBJ(): " << model->m_filename
+		          << " has no vertices on the CPU to save. Load it with loader_settings.keep_cpu_data.\n";
+		return;
+	}
+
 	///////////////////////////////////////////////////////////////////////
 	// Separate filename into directory, base filename and extension
 	// NOTE: This can be made a LOT simpler as soon as compilers properly
@@ -395,6 +849,8 @@ void saveModelToOBJ(Model* model, std::string path)
 		mat_file << "Ke " << mat.m_emission << " " << mat.m_emission << " " << mat.m_emission << "\n";
 		mat_file << "Tf " << mat.m_transparency << " " << mat.m_transparency << " " << mat.m_transparency
 		         << "\n";
+		if(!mat.m_casts_shadows)
+			mat_file << "casts_shadows 0\n";
 		if(mat.m_color_texture.valid)
 			mat_file << "map_Kd " << mat.m_color_texture.filename << "\n";
 		if(mat.m_reflectivity_texture.valid)
@@ -421,35 +877,39 @@ void saveModelToOBJ(Model* model, std::string path)
 	}
 	obj_file << "# Exported by Chalmers Graphics Group\n";
 	obj_file << "mtllib " << filename << ".mtl\n";
-	int vertex_counter = 1;
+	uint32_t vertex_counter = 1;
 	for(auto mesh : model->m_meshes)
 	{
 		obj_file << "o " << mesh.m_name << "\n";
 		obj_file << "g " << mesh.m_name << "\n";
 		obj_file << "usemtl " << model->m_materials[mesh.m_material_idx].m_name << "\n";
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		const uint32_t first = mesh.m_base_vertex, end = mesh.m_base_vertex + mesh.m_number_of_vertices;
+		for(uint32_t i = first; i < end; i++)
 		{
 			obj_file << "v " << model->m_positions[i].x << " " << model->m_positions[i].y << " "
 			         << model->m_positions[i].z << "\n";
 		}
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = first; i < end; i++)
 		{
 			obj_file << "vn " << model->m_normals[i].x << " " << model->m_normals[i].y << " "
 			         << model->m_normals[i].z << "\n";
 		}
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = first; i < end; i++)
 		{
 			obj_file << "vt " << model->m_texture_coordinates[i].x << " " << model->m_texture_coordinates[i].y
 			         << "\n";
 		}
-		int number_of_faces = mesh.m_number_of_vertices / 3;
-		for(int i = 0; i < number_of_faces; i++)
+		for(uint32_t i = 0; i < mesh.m_number_of_indices; i += 3)
 		{
-			obj_file << "f " << vertex_counter << "/" << vertex_counter << "/" << vertex_counter << " "
-			         << vertex_counter + 1 << "/" << vertex_counter + 1 << "/" << vertex_counter + 1 << " "
-			         << vertex_counter + 2 << "/" << vertex_counter + 2 << "/" << vertex_counter + 2 << "\n";
-			vertex_counter += 3;
+			obj_file << "f";
+			for(uint32_t j = 0; j < 3; j++)
+			{
+				const uint32_t v = vertex_counter + model->m_indices[mesh.m_start_index + i + j];
+				obj_file << " " << v << "/" << v << "/" << v;
+			}
+			obj_file << "\n";
 		}
+		vertex_counter += mesh.m_number_of_vertices;
 	}
 }
 
@@ -465,9 +925,37 @@ void freeModel(Model* model)
 ///////////////////////////////////////////////////////////////////////
 // Loop through all Meshes in the Model and render them
 ///////////////////////////////////////////////////////////////////////
+// Shaders that decode compressed vertices have these uniforms
+struct VertexUniforms
+{
+	GLint position_offset, position_scale;
+	VertexUniforms(const Model* model, GLint program)
+	{
+		glUniform1i(glGetUniformLocation(program, "compressed_vertices"), model->m_compressed_vertices);
+		position_offset = glGetUniformLocation(program, "vertex_position_offset");
+		position_scale = glGetUniformLocation(program, "vertex_position_scale");
+	}
+};
+
+static void drawMesh(const Model* model, const Mesh& mesh, const VertexUniforms& uniforms)
+{
+	if(model->m_compressed_vertices)
+	{
+		glUniform3fv(uniforms.position_offset, 1, &mesh.m_position_offset.x);
+		glUniform3fv(uniforms.position_scale, 1, &mesh.m_position_scale.x);
+	}
+	glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)mesh.m_number_of_indices,
+	                         mesh.m_number_of_vertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+	                         (GLvoid*)(size_t)mesh.m_index_buffer_offset, (GLint)mesh.m_base_vertex);
+}
+
 void render(const Model* model, const bool submitMaterials)
 {
+	uploadLoadedTextures();
 	glBindVertexArray(model->m_vaob);
+	GLint current_program = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+	VertexUniforms uniforms(model, current_program);
 	for(auto& mesh : model->m_meshes)
 	{
 		if(submitMaterials)
@@ -492,8 +980,6 @@ void render(const Model* model, const bool submitMaterials)
 				glBindTextures(4, 1, &material.m_shininess_texture.gl_id);
 			if(has_emission_texture)
 				glBindTextures(5, 1, &material.m_emission_texture.gl_id);
-			GLint current_program = 0;
-			glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
 			glUniform1i(glGetUniformLocation(current_program, "has_color_texture"), has_color_texture);
 			glUniform1i(glGetUniformLocation(current_program, "has_diffuse_texture"),
 			            has_color_texture ? 1 : 0); // FIXME
@@ -520,7 +1006,166 @@ void render(const Model* model, const bool submitMaterials)
 			             &material.m_shininess);
 			glUniform1fv(glGetUniformLocation(current_program, "material_emission"), 1, &material.m_emission);
 		}
-		glDrawArrays(GL_TRIANGLES, mesh.m_start_index, (GLsizei)mesh.m_number_of_vertices);
+		drawMesh(model, mesh, uniforms);
+	}
+}
+
+void renderDepthOnly(const Model* model)
+{
+	glBindVertexArray(model->m_positions_vaob);
+	GLint current_program = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+	VertexUniforms uniforms(model, current_program);
+	for(auto& mesh : model->m_meshes)
+	{
+		drawMesh(model, mesh, uniforms);
 	}
 }
+
+///////////////////////////////////////////////////////////////////////////
+// Vertex layout benchmark
+///////////////////////////////////////////////////////////////////////////
+static GLuint compileBenchmarkShader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if(!ok)
+		std::cout << "ERROR: benchmarkVertexLayouts(): Could not compile shader\n";
+	return shader;
+}
+
+int benchmarkVertexLayouts(const std::vector<std::string>& filenames)
+{
+	// Reads every attribute. Everything is drawn to a single pixel, so that
+	// the time is spent in the vertex stage.
+	const char* vertex_shader =
+	    "#version 420\n"
+	    "layout(location = 0) in vec3 position;\n"
+	    "layout(location = 1) in vec3 normalIn;\n"
+	    "layout(location = 2) in vec2 texCoordIn;\n"
+	    "uniform mat4 modelViewProjectionMatrix;\n"
+	    "uniform bool compressed_vertices;\n"
+	    "uniform vec3 vertex_position_offset;\n"
+	    "uniform vec3 vertex_position_scale;\n"
+	    "void main()\n"
+	    "{\n"
+	    "	vec3 p = position, n = normalIn;\n"
+	    "	if(compressed_vertices)\n"
+	    "	{\n"
+	    "		p = vertex_position_offset + vertex_position_scale * p;\n"
+	    "		n = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));\n"
+	    "		if(n.z < 0.0)\n"
+	    "			n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+	    "	}\n"
+	    "	p += 1e-3 * (n + vec3(texCoordIn, 0.0));\n"
+	    "	gl_Position = modelViewProjectionMatrix * vec4(p, 1.0);\n"
+	    "}\n";
+	const char* fragment_shader = "#version 420\n"
+	                              "layout(location = 0) out vec4 color;\n"
+	                              "void main() { color = vec4(1.0); }\n";
+	GLuint program = glCreateProgram();
+	GLuint shaders[2] = { compileBenchmarkShader(GL_VERTEX_SHADER, vertex_shader),
+		                  compileBenchmarkShader(GL_FRAGMENT_SHADER, fragment_shader) };
+	glAttachShader(program, shaders[0]);
+	glAttachShader(program, shaders[1]);
+	glLinkProgram(program);
+	glDeleteShader(shaders[0]);
+	glDeleteShader(shaders[1]);
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if(!linked)
+	{
+		std::cout << "ERROR: benchmarkVertexLayouts(): Could not link shader program\n";
+		glDeleteProgram(program);
+		return 1;
+	}
+	glUseProgram(program);
+	GLuint framebuffer, renderbuffer;
+	glGenRenderbuffers(1, &renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 1, 1);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer);
+	glViewport(0, 0, 1, 1);
+	glDisable(GL_DEPTH_TEST);
+	GLuint query;
+	glGenQueries(1, &query);
+
+	// The median of several timings, of several draws each
+	const int repetitions = 15, draws_per_repetition = 10;
+	const LoaderSettings saved_settings = loader_settings;
+	std::vector<std::string> results;
+	for(const auto& filename : filenames)
+	{
+		for(int format = 0; format < 2; format++)
+		{
+			for(int layout = 0; layout < 2; layout++)
+			{
+				loader_settings.compress_vertices = format == 1;
+				loader_settings.interleave_vertices = layout == 1;
+				loader_settings.upload_to_gpu = true;
+				loader_settings.keep_cpu_data = true;
+				Model* model = loadModelFromOBJ(filename);
+				// Fit the model into the view volume
+				glm::vec3 min_position(INFINITY), max_position(-INFINITY);
+				for(const auto& position : model->m_positions)
+				{
+					min_position = glm::min(min_position, position);
+					max_position = glm::max(max_position, position);
+				}
+				const glm::vec3 center = 0.5f * (min_position + max_position);
+				const float size = std::max(glm::length(max_position - min_position), 1e-6f);
+				glm::mat4 model_view_projection(2.0f / size);
+				model_view_projection[3] = glm::vec4(-center * (2.0f / size), 1.0f);
+				glUniformMatrix4fv(glGetUniformLocation(program, "modelViewProjectionMatrix"), 1, false,
+				                   &model_view_projection[0].x);
+				for(int pass = 0; pass < 2; pass++)
+				{
+					std::vector<double> times;
+					for(int r = 0; r <= repetitions; r++)
+					{
+						glBeginQuery(GL_TIME_ELAPSED, query);
+						for(int d = 0; d < draws_per_repetition; d++)
+						{
+							if(pass == 0)
+								render(model, false);
+							else
+								renderDepthOnly(model);
+						}
+						glEndQuery(GL_TIME_ELAPSED);
+						GLuint64 nanoseconds = 0;
+						glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+						// The first one warms up
+						if(r > 0)
+							times.push_back(double(nanoseconds) * 1e-6 / draws_per_repetition);
+					}
+					std::sort(times.begin(), times.end());
+					std::ostringstream line;
+					line << filename << ", " << (format == 1 ? "compressed" : "float") << ", "
+					     << (layout == 1 ? "interleaved" : "separate") << ", "
+					     << (pass == 0 ? "all attributes" : "positions") << ", " << model->m_positions.size()
+					     << ", " << std::fixed << std::setprecision(3) << times[times.size() / 2];
+					results.push_back(line.str());
+				}
+				freeModel(model);
+			}
+		}
+	}
+	loader_settings = saved_settings;
+	glDeleteQueries(1, &query);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &renderbuffer);
+	glUseProgram(0);
+	glDeleteProgram(program);
+
+	std::cout << "file, format, layout, pass, vertices, ms per draw\n";
+	for(const auto& line : results)
+		std::cout << line << "\n";
+	return 0;
+}
 } // namespace labhelper
@@ -12,6 +12,7 @@ struct Texture
 	std::string filename;
 	std::string directory;
 	int width, height;
+	// The decoded image, once it has been decoded (TextureLoader.h)
 	uint8_t* data = nullptr;
 	bool load(const std::string& directory, const std::string& filename, int nof_components);
 };
@@ -22,6 +23,9 @@ struct Texture
 // NOTE: A material can have _either_ a (textured) roughness, or a good old
 //       shininess value. We still use shininess for the Blinn mfd in the
 //       GL labs, but roughness for pathtracing.
+// NOTE: "casts_shadows 0" in the MTL file (not part of the extension)
+//       marks geometry that should not block light, such as the proxy
+//       mesh of a light fixture.
 //////////////////////////////////////////////////////////////////////////////
 struct Material
 {
@@ -33,6 +37,7 @@ struct Material
 	float m_fresnel;
 	float m_emission;
 	float m_transparency;
+	bool m_casts_shadows = true;
 	Texture m_color_texture;
 	Texture m_reflectivity_texture;
 	Texture m_shininess_texture;
@@ -45,9 +50,20 @@ struct Mesh
 {
 	std::string m_name;
 	uint32_t m_material_idx;
-	// Where this Mesh's vertices start
+	// Where this Mesh's indices start in Model::m_indices, and how many
+	// there are (three per triangle)
 	uint32_t m_start_index;
+	uint32_t m_number_of_indices;
+	// The vertices of this Mesh. Its indices are relative to the first.
+	uint32_t m_base_vertex;
 	uint32_t m_number_of_vertices;
+	// Where the indices start in the index buffer on the GPU, in bytes.
+	// They are 16 bit there if the Mesh has at most 65536 vertices.
+	uint32_t m_index_buffer_offset;
+	// Dequantization of compressed positions (see CompressedVertices in
+	// MeshOptimizer.h)
+	glm::vec3 m_position_offset;
+	glm::vec3 m_position_scale;
 };
 
 class Model
@@ -62,20 +78,83 @@ public:
 	std::vector<Material> m_materials;
 	// A model will contain one or more "Meshes"
 	std::vector<Mesh> m_meshes;
-	// Buffers on CPU
+	// Buffers on CPU. Empty after uploadModel() without
+	// LoaderSettings::keep_cpu_data.
 	std::vector<glm::vec3> m_positions;
 	std::vector<glm::vec3> m_normals;
 	std::vector<glm::vec2> m_texture_coordinates;
-	// Buffers on GPU
-	uint32_t m_positions_bo;
-	uint32_t m_normals_bo;
-	uint32_t m_texture_coordinates_bo;
-	// Vertex Array Object
-	uint32_t m_vaob;
+	std::vector<uint32_t> m_indices;
+	// Buffers on GPU. Either one buffer per attribute, or all in
+	// m_vertices_bo (see LoaderSettings::interleave_vertices).
+	uint32_t m_positions_bo = 0;
+	uint32_t m_normals_bo = 0;
+	uint32_t m_texture_coordinates_bo = 0;
+	uint32_t m_vertices_bo = 0;
+	uint32_t m_indices_bo = 0;
+	// Vertex Array Objects, with all attributes and with only positions
+	uint32_t m_vaob = 0;
+	uint32_t m_positions_vaob = 0;
+	// The format and layout of the buffers on GPU
+	bool m_compressed_vertices = false;
+	bool m_interleaved_vertices = false;
 };
 
+///////////////////////////////////////////////////////////////////////////
+// Settings for loadModelFromOBJ()
+///////////////////////////////////////////////////////////////////////////
+extern struct LoaderSettings
+{
+	// Keep what is parsed from an OBJ file in a binary cache next to it
+	// (<name>.meshcache), and load that instead of parsing the OBJ file
+	// again while the OBJ and MTL files are unchanged
+	bool use_mesh_cache = true;
+	// Parse OBJ files with parseOBJParallel() (ObjParser.h) instead of
+	// tinyobj::LoadObj(), on this many threads (0: one per hardware thread)
+	bool use_parallel_parser = true;
+	int parser_threads = 0;
+	// Upload the vertices in the compressed format of compressVertices()
+	// (MeshOptimizer.h), which the shaders then have to decode
+	bool compress_vertices = false;
+	// Upload the vertices in one buffer, with the positions first and then
+	// the normals and texture coordinates interleaved, instead of one
+	// buffer per attribute
+	bool interleave_vertices = false;
+	// Upload textures block compressed, with mip chains made on the CPU,
+	// from a cache next to each image (<image>.texcache, TextureCache.h).
+	// Texture::data is not kept for these.
+	bool compress_textures = false;
+	// Create the GL buffers and textures of the models as they are loaded.
+	// Without it no GL context is needed, and uploadModel() can do it later.
+	bool upload_to_gpu = true;
+	// Keep the vertices, indices and decoded textures on the CPU once they
+	// have been uploaded
+	bool keep_cpu_data = true;
+} loader_settings;
+
 Model* loadModelFromOBJ(std::string filename);
+// The files loadModelFromOBJ() reads for an OBJ file, whether they exist
+// or not. Reads the OBJ file and its material libraries to find them.
+struct ModelFiles
+{
+	// The OBJ file and the material libraries it names
+	std::vector<std::string> sources;
+	// The images the materials name
+	std::vector<std::string> textures;
+};
+ModelFiles findModelFiles(const std::string& path);
+// Create the GL buffers of a model, and the GL textures of its materials,
+// if loadModelFromOBJ() did not (LoaderSettings::upload_to_gpu)
+void uploadModel(Model* model);
 void saveModelToOBJ(Model* model, std::string filename);
 void freeModel(Model* model);
 void render(const Model* model, const bool submitMaterials = true);
+// Render with only the position attribute, for depth and shadow map passes
+void renderDepthOnly(const Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+// Time the vertex stage of drawing each model with each combination of
+// vertex layout and format, with GL timer queries. Needs a GL context.
+// Returns the exit code for main().
+///////////////////////////////////////////////////////////////////////////
+int benchmarkVertexLayouts(const std::vector<std::string>& filenames);
 } // namespace labhelper
\ No newline at end of file
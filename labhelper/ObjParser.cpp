@@ -0,0 +1,523 @@
+#include "ObjParser.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <thread>
+#include <algorithm>
+
+namespace labhelper
+{
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static inline bool isDigit(char c)
+{
+	return unsigned(c - '0') < 10u;
+}
+
+static inline const char* skipSpace(const char* p, const char* end)
+{
+	while(p < end && isSpace(*p))
+		p++;
+	return p;
+}
+
+// The end of the token at p, where tinyobj would stop with
+// strcspn(p, " \t\r")
+static inline const char* tokenEnd(const char* p, const char* end)
+{
+	while(p < end && !isSpace(*p))
+		p++;
+	return p;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Number parsing. These do exactly the arithmetic of tinyobj's
+// tryParseDouble() and atoi(), so that the results are the same to the
+// bit, but work on the file buffer without copying out lines.
+///////////////////////////////////////////////////////////////////////////
+static bool parseDouble(const char* s, const char* s_end, double* result)
+{
+	if(s >= s_end)
+		return false;
+	double mantissa = 0.0;
+	int exponent = 0;
+	char sign = '+';
+	char exp_sign = '+';
+	const char* curr = s;
+	int read = 0;
+
+	if(*curr == '+' || *curr == '-')
+	{
+		sign = *curr;
+		curr++;
+	}
+	else if(!isDigit(*curr))
+	{
+		return false;
+	}
+	while(curr != s_end && isDigit(*curr))
+	{
+		mantissa *= 10;
+		mantissa += static_cast<int>(*curr - '0');
+		curr++;
+		read++;
+	}
+	if(read == 0)
+		return false;
+	if(curr != s_end)
+	{
+		if(*curr == '.')
+		{
+			static const double pow_lut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+			const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+			curr++;
+			read = 1;
+			while(curr != s_end && isDigit(*curr))
+			{
+				mantissa += static_cast<int>(*curr - '0')
+				            * (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+				read++;
+				curr++;
+			}
+		}
+		else if(*curr != 'e' && *curr != 'E')
+		{
+			curr = s_end;
+		}
+	}
+	if(curr != s_end && (*curr == 'e' || *curr == 'E'))
+	{
+		curr++;
+		if(curr != s_end && (*curr == '+' || *curr == '-'))
+		{
+			exp_sign = *curr;
+			curr++;
+		}
+		else if(curr == s_end || !isDigit(*curr))
+		{
+			return false;
+		}
+		read = 0;
+		while(curr != s_end && isDigit(*curr))
+		{
+			exponent *= 10;
+			exponent += static_cast<int>(*curr - '0');
+			curr++;
+			read++;
+		}
+		exponent *= (exp_sign == '+' ? 1 : -1);
+		if(read == 0)
+			return false;
+	}
+	*result = (sign == '+' ? 1 : -1)
+	          * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+	return true;
+}
+
+static inline tinyobj::real_t parseReal(const char*& p, const char* end, double default_value = 0.0)
+{
+	p = skipSpace(p, end);
+	const char* token_end = tokenEnd(p, end);
+	double value = default_value;
+	parseDouble(p, token_end, &value);
+	p = token_end;
+	return static_cast<tinyobj::real_t>(value);
+}
+
+static inline int parseInt(const char* p, const char* end)
+{
+	while(p < end && (isSpace(*p) || *p == '\v' || *p == '\f'))
+		p++;
+	bool negative = false;
+	if(p < end && (*p == '+' || *p == '-'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	int value = 0;
+	while(p < end && isDigit(*p))
+	{
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	return negative ? -value : value;
+}
+
+// The first whitespace separated word from p, as sscanf("%s") reads it
+static std::string parseWord(const char* p, const char* end)
+{
+	p = skipSpace(p, end);
+	return std::string(p, tokenEnd(p, end));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// One chunk of the file, parsed on its own
+///////////////////////////////////////////////////////////////////////////
+struct ObjEvent
+{
+	enum Type
+	{
+		USEMTL,
+		MTLLIB,
+		GROUP,
+		OBJECT
+	} type;
+	// The number of faces of the chunk that came before this line
+	uint32_t face;
+	std::string argument;
+};
+
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	std::vector<tinyobj::real_t> v, vn, vt;
+	std::vector<tinyobj::index_t> corners;
+	// Where the corners of each face start, and one past the last face
+	std::vector<uint32_t> face_starts;
+	// Corners with relative (negative) indices, which are resolved against
+	// the number of vertices in the chunks before this one. The mask tells
+	// which of vertex (1), normal (2) and texcoord (4) index is relative.
+	std::vector<std::pair<uint32_t, uint8_t>> relative_corners;
+	std::vector<ObjEvent> events;
+	size_t v_base = 0, vn_base = 0, vt_base = 0;
+};
+
+// Parse a vertex index as tinyobj's fixIndex() would, with 'count' the
+// number of elements so far in this chunk. Relative indices stay
+// relative to the start of the chunk.
+static inline int fixIndex(int index, int count, bool& relative)
+{
+	if(index > 0)
+		return index - 1;
+	if(index == 0)
+		return 0;
+	relative = true;
+	return count + index;
+}
+
+// Find the end of the field at p, where tinyobj would stop with
+// strcspn(p, "/ \t\r")
+static inline const char* fieldEnd(const char* p, const char* end)
+{
+	while(p < end && *p != '/' && !isSpace(*p))
+		p++;
+	return p;
+}
+
+static void parseFace(const char* p, const char* end, ObjChunk& chunk)
+{
+	const int v_count = int(chunk.v.size() / 3), vn_count = int(chunk.vn.size() / 3),
+	          vt_count = int(chunk.vt.size() / 2);
+	p = skipSpace(p, end);
+	while(p < end)
+	{
+		tinyobj::index_t corner;
+		corner.vertex_index = corner.normal_index = corner.texcoord_index = -1;
+		bool v_relative = false, vn_relative = false, vt_relative = false;
+		corner.vertex_index = fixIndex(parseInt(p, end), v_count, v_relative);
+		p = fieldEnd(p, end);
+		if(p < end && *p == '/')
+		{
+			p++;
+			if(p < end && *p == '/')
+			{
+				// i//k
+				p++;
+				corner.normal_index = fixIndex(parseInt(p, end), vn_count, vn_relative);
+				p = fieldEnd(p, end);
+			}
+			else
+			{
+				// i/j or i/j/k
+				corner.texcoord_index = fixIndex(parseInt(p, end), vt_count, vt_relative);
+				p = fieldEnd(p, end);
+				if(p < end && *p == '/')
+				{
+					p++;
+					corner.normal_index = fixIndex(parseInt(p, end), vn_count, vn_relative);
+					p = fieldEnd(p, end);
+				}
+			}
+		}
+		if(v_relative || vn_relative || vt_relative)
+		{
+			chunk.relative_corners.push_back(std::make_pair(
+			    uint32_t(chunk.corners.size()),
+			    uint8_t((v_relative ? 1 : 0) | (vn_relative ? 2 : 0) | (vt_relative ? 4 : 0))));
+		}
+		chunk.corners.push_back(corner);
+		p = skipSpace(p, end);
+	}
+	chunk.face_starts.push_back(uint32_t(chunk.corners.size()));
+}
+
+static void parseChunk(ObjChunk& chunk)
+{
+	chunk.face_starts.assign(1, 0);
+	const char* p = chunk.begin;
+	while(p < chunk.end)
+	{
+		// Lines end with "\n", "\r\n" or "\r", as in tinyobj's safeGetline()
+		const char* line_end = p;
+		while(line_end < chunk.end && *line_end != '\n' && *line_end != '\r')
+			line_end++;
+		const char* token = skipSpace(p, line_end);
+		p = line_end + 1;
+		if(token == line_end || token[0] == '#')
+			continue;
+		const size_t length = line_end - token;
+		const uint32_t face = uint32_t(chunk.face_starts.size() - 1);
+
+		if(length > 1 && token[0] == 'v' && isSpace(token[1]))
+		{
+			token += 2;
+			chunk.v.push_back(parseReal(token, line_end));
+			chunk.v.push_back(parseReal(token, line_end));
+			chunk.v.push_back(parseReal(token, line_end));
+		}
+		else if(length > 2 && token[0] == 'v' && token[1] == 'n' && isSpace(token[2]))
+		{
+			token += 3;
+			chunk.vn.push_back(parseReal(token, line_end));
+			chunk.vn.push_back(parseReal(token, line_end));
+			chunk.vn.push_back(parseReal(token, line_end));
+		}
+		else if(length > 2 && token[0] == 'v' && token[1] == 't' && isSpace(token[2]))
+		{
+			token += 3;
+			chunk.vt.push_back(parseReal(token, line_end));
+			chunk.vt.push_back(parseReal(token, line_end));
+		}
+		else if(length > 1 && token[0] == 'f' && isSpace(token[1]))
+		{
+			parseFace(token + 2, line_end, chunk);
+		}
+		else if(length > 6 && strncmp(token, "usemtl", 6) == 0 && isSpace(token[6]))
+		{
+			ObjEvent event = { ObjEvent::USEMTL, face, parseWord(token + 7, line_end) };
+			chunk.events.push_back(event);
+		}
+		else if(length > 6 && strncmp(token, "mtllib", 6) == 0 && isSpace(token[6]))
+		{
+			ObjEvent event = { ObjEvent::MTLLIB, face, std::string(token + 7, line_end) };
+			chunk.events.push_back(event);
+		}
+		else if(length > 1 && token[0] == 'g' && isSpace(token[1]))
+		{
+			ObjEvent event = { ObjEvent::GROUP, face, parseWord(token + 1, line_end) };
+			chunk.events.push_back(event);
+		}
+		else if(length > 1 && token[0] == 'o' && isSpace(token[1]))
+		{
+			ObjEvent event = { ObjEvent::OBJECT, face, parseWord(token + 2, line_end) };
+			chunk.events.push_back(event);
+		}
+	}
+}
+
+// Run f(0) ... f(count - 1) on their own threads
+template<typename F>
+static void parallelFor(int count, F f)
+{
+	std::vector<std::thread> threads;
+	for(int i = 1; i < count; i++)
+		threads.push_back(std::thread(f, i));
+	f(0);
+	for(auto& thread : threads)
+		thread.join();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Building the shapes, as tinyobj does while it reads the file
+///////////////////////////////////////////////////////////////////////////
+struct FaceSpan
+{
+	const ObjChunk* chunk;
+	uint32_t first, end;
+};
+
+static bool exportFaceGroupToShape(tinyobj::shape_t& shape, const std::vector<FaceSpan>& face_group,
+                                   int material, const std::string& name)
+{
+	if(face_group.empty())
+		return false;
+	for(const FaceSpan& span : face_group)
+	{
+		for(uint32_t face = span.first; face < span.end; face++)
+		{
+			const tinyobj::index_t* corners = &span.chunk->corners[span.chunk->face_starts[face]];
+			const uint32_t number_of_corners = span.chunk->face_starts[face + 1] - span.chunk->face_starts[face];
+			// Polygon -> triangle fan
+			for(uint32_t k = 2; k < number_of_corners; k++)
+			{
+				shape.mesh.indices.push_back(corners[0]);
+				shape.mesh.indices.push_back(corners[k - 1]);
+				shape.mesh.indices.push_back(corners[k]);
+				shape.mesh.num_face_vertices.push_back(3);
+				shape.mesh.material_ids.push_back(material);
+			}
+		}
+	}
+	shape.name = name;
+	return true;
+}
+
+bool parseOBJParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                      std::vector<tinyobj::material_t>* materials, std::string* err, const char* filename,
+                      const char* mtl_basedir, int threads)
+{
+	attrib->vertices.clear();
+	attrib->normals.clear();
+	attrib->texcoords.clear();
+	shapes->clear();
+
+	std::ifstream file(filename, std::ios::binary);
+	if(!file)
+	{
+		if(err)
+			*err = std::string("Cannot open file [") + filename + "]\n";
+		return false;
+	}
+	file.seekg(0, std::ios::end);
+	std::vector<char> text(size_t(file.tellg()));
+	file.seekg(0, std::ios::beg);
+	file.read(text.data(), text.size());
+
+	///////////////////////////////////////////////////////////////////////
+	// Split the file into chunks of whole lines, a few hundred kB at least
+	///////////////////////////////////////////////////////////////////////
+	if(threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+	const size_t min_chunk_size = 256 * 1024;
+	const int number_of_chunks = int(std::max(size_t(1), std::min(size_t(threads), text.size() / min_chunk_size)));
+	std::vector<ObjChunk> chunks(number_of_chunks);
+	const char* begin = text.data();
+	const char* end = text.data() + text.size();
+	for(int i = 0; i < number_of_chunks; i++)
+	{
+		chunks[i].begin = i == 0 ? begin : chunks[i - 1].end;
+		const char* split = begin + text.size() * (i + 1) / number_of_chunks;
+		split = std::max(split, chunks[i].begin);
+		while(split < end && split[-1] != '\n')
+			split++;
+		chunks[i].end = i + 1 == number_of_chunks ? end : split;
+	}
+	parallelFor(number_of_chunks, [&](int i) { parseChunk(chunks[i]); });
+
+	///////////////////////////////////////////////////////////////////////
+	// Copy the vertex arrays together and resolve relative indices
+	///////////////////////////////////////////////////////////////////////
+	size_t v_size = 0, vn_size = 0, vt_size = 0;
+	for(ObjChunk& chunk : chunks)
+	{
+		chunk.v_base = v_size / 3;
+		chunk.vn_base = vn_size / 3;
+		chunk.vt_base = vt_size / 2;
+		v_size += chunk.v.size();
+		vn_size += chunk.vn.size();
+		vt_size += chunk.vt.size();
+	}
+	attrib->vertices.resize(v_size);
+	attrib->normals.resize(vn_size);
+	attrib->texcoords.resize(vt_size);
+	parallelFor(number_of_chunks, [&](int i) {
+		ObjChunk& chunk = chunks[i];
+		std::copy(chunk.v.begin(), chunk.v.end(), attrib->vertices.begin() + chunk.v_base * 3);
+		std::copy(chunk.vn.begin(), chunk.vn.end(), attrib->normals.begin() + chunk.vn_base * 3);
+		std::copy(chunk.vt.begin(), chunk.vt.end(), attrib->texcoords.begin() + chunk.vt_base * 2);
+		for(const auto& relative : chunk.relative_corners)
+		{
+			tinyobj::index_t& corner = chunk.corners[relative.first];
+			if(relative.second & 1)
+				corner.vertex_index += int(chunk.v_base);
+			if(relative.second & 2)
+				corner.normal_index += int(chunk.vn_base);
+			if(relative.second & 4)
+				corner.texcoord_index += int(chunk.vt_base);
+		}
+	});
+
+	///////////////////////////////////////////////////////////////////////
+	// Replay materials, groups and objects in file order. Like tinyobj, a
+	// change of material adds the faces so far to the current shape, and a
+	// group or object starts a new shape.
+	///////////////////////////////////////////////////////////////////////
+	tinyobj::MaterialFileReader material_reader(mtl_basedir ? mtl_basedir : "");
+	std::map<std::string, int> material_map;
+	int material = -1;
+	std::string name;
+	tinyobj::shape_t shape;
+	std::vector<FaceSpan> face_group;
+	for(const ObjChunk& chunk : chunks)
+	{
+		uint32_t face = 0;
+		const uint32_t number_of_faces = uint32_t(chunk.face_starts.size() - 1);
+		for(size_t e = 0; e <= chunk.events.size(); e++)
+		{
+			const uint32_t event_face = e < chunk.events.size() ? chunk.events[e].face : number_of_faces;
+			if(event_face > face)
+			{
+				FaceSpan span = { &chunk, face, event_face };
+				face_group.push_back(span);
+				face = event_face;
+			}
+			if(e == chunk.events.size())
+				break;
+			const ObjEvent& event = chunk.events[e];
+			if(event.type == ObjEvent::USEMTL)
+			{
+				auto found = material_map.find(event.argument);
+				const int new_material = found != material_map.end() ? found->second : -1;
+				if(new_material != material)
+				{
+					exportFaceGroupToShape(shape, face_group, material, name);
+					face_group.clear();
+					material = new_material;
+				}
+			}
+			else if(event.type == ObjEvent::MTLLIB)
+			{
+				// Split on single spaces, as tinyobj does
+				std::vector<std::string> mtl_filenames;
+				std::stringstream fields(event.argument);
+				std::string mtl_filename;
+				while(std::getline(fields, mtl_filename, ' '))
+					mtl_filenames.push_back(mtl_filename);
+				bool found = false;
+				for(const auto& f : mtl_filenames)
+				{
+					std::string err_mtl;
+					found = material_reader(f, materials, &material_map, &err_mtl);
+					if(err)
+						*err += err_mtl;
+					if(found)
+						break;
+				}
+				if(err && mtl_filenames.empty())
+					*err += "WARN: Looks like empty filename for mtllib. Use default material. \n";
+				else if(err && !found)
+					*err += "WARN: Failed to load material file(s). Use default material.\n";
+			}
+			else
+			{
+				if(exportFaceGroupToShape(shape, face_group, material, name))
+					shapes->push_back(shape);
+				shape = tinyobj::shape_t();
+				face_group.clear();
+				name = event.argument;
+			}
+		}
+	}
+	if(exportFaceGroupToShape(shape, face_group, material, name) || shape.mesh.indices.size())
+		shapes->push_back(shape);
+	return true;
+}
+} // namespace labhelper
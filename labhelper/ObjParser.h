@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <tiny_obj_loader.h>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// A multithreaded replacement for tinyobj::LoadObj() (with triangulation).
+// The file is split into chunks at line boundaries, and the chunks are
+// parsed in parallel into vertex arrays and face lists. The arrays are
+// then copied together, and a last pass over the faces, materials, groups
+// and objects builds the shapes in file order. The result is the same as
+// tinyobj's, down to the bits of the parsed numbers; only tags ("t"
+// lines) are not read. 'threads' = 0 uses one per hardware thread.
+///////////////////////////////////////////////////////////////////////////
+bool parseOBJParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                      std::vector<tinyobj::material_t>* materials, std::string* err, const char* filename,
+                      const char* mtl_basedir, int threads = 0);
+} // namespace labhelper
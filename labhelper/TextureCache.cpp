@@ -0,0 +1,198 @@
+#include "TextureCache.h"
+#include <GL/glew.h>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+// The default of stb_dxt v1.07 takes one argument instead of three
+#define STBD_MEMSET memset
+#define STB_DXT_STATIC
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+
+namespace labhelper
+{
+// Change when the layout of the cache or the encoding changes
+static const uint32_t TEXTURE_CACHE_MAGIC = 0x4354484c; // "LHTC"
+static const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+// The same image may be asked for with another number of components, and
+// gets a cache of its own
+static std::string cachePath(const std::string& image_path, int components)
+{
+	return image_path + "." + std::to_string(components) + ".texcache";
+}
+
+bool loadTextureCache(const std::string& image_path, int components, CompressedImage& image)
+{
+	std::unique_ptr<MappedFile> file(new MappedFile);
+	if(!file->open(cachePath(image_path, components)))
+		return false;
+	CacheReader in;
+	in.data = file->data;
+	in.size = file->size;
+	if(in.read<uint32_t>() != TEXTURE_CACHE_MAGIC || in.read<uint32_t>() != TEXTURE_CACHE_VERSION)
+		return false;
+	SourceFile source;
+	source.filename = image_path;
+	const int64_t size = in.read<int64_t>(), time = in.read<int64_t>();
+	if(!source.stat("") || source.size != size || source.time != time)
+		return false;
+	if(in.read<uint32_t>() != uint32_t(components))
+		return false;
+
+	image.format = in.read<uint32_t>();
+	image.levels.resize(in.read<uint32_t>());
+	for(auto& level : image.levels)
+	{
+		level.width = in.read<int32_t>();
+		level.height = in.read<int32_t>();
+		level.offset = size_t(in.read<uint64_t>());
+		level.size = size_t(in.read<uint64_t>());
+		if(!in.ok)
+			return false;
+	}
+	image.size = size_t(in.read<uint64_t>());
+	in.align();
+	image.data = (const uint8_t*)in.read(image.size);
+	if(!in.ok || image.levels.empty())
+		return false;
+	for(const auto& level : image.levels)
+	{
+		if(level.offset > image.size || level.size > image.size - level.offset)
+			return false;
+	}
+	image.file = std::move(file);
+	return true;
+}
+
+// Average each 2x2 texels. The last row or column of an odd sized level is
+// used twice.
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& pixels, int width, int height, int components,
+                                       int& next_width, int& next_height)
+{
+	next_width = std::max(1, width / 2);
+	next_height = std::max(1, height / 2);
+	std::vector<uint8_t> next(size_t(next_width) * next_height * components);
+	for(int y = 0; y < next_height; y++)
+	{
+		const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+		for(int x = 0; x < next_width; x++)
+		{
+			const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+			for(int c = 0; c < components; c++)
+			{
+				const int sum = pixels[(size_t(y0) * width + x0) * components + c]
+				                + pixels[(size_t(y0) * width + x1) * components + c]
+				                + pixels[(size_t(y1) * width + x0) * components + c]
+				                + pixels[(size_t(y1) * width + x1) * components + c];
+				next[(size_t(y) * next_width + x) * components + c] = uint8_t((sum + 2) / 4);
+			}
+		}
+	}
+	return next;
+}
+
+static size_t blockSize(uint32_t format)
+{
+	return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+static void encodeLevel(const uint8_t* pixels, int width, int height, int components, uint32_t format, uint8_t* out)
+{
+	// Texels outside of levels smaller than a block repeat the edge
+	uint8_t block[16 * 4];
+	for(int by = 0; by < height; by += 4)
+	{
+		for(int bx = 0; bx < width; bx += 4)
+		{
+			for(int y = 0; y < 4; y++)
+			{
+				for(int x = 0; x < 4; x++)
+				{
+					const uint8_t* texel =
+					    pixels + (size_t(std::min(by + y, height - 1)) * width + std::min(bx + x, width - 1)) * components;
+					uint8_t* dst = block + (y * 4 + x) * (components <= 2 ? components : 4);
+					for(int c = 0; c < components; c++)
+						dst[c] = texel[c];
+					if(components == 3)
+						dst[3] = 255;
+				}
+			}
+			if(format == GL_COMPRESSED_RED_RGTC1)
+				stb_compress_bc4_block(out, block);
+			else if(format == GL_COMPRESSED_RG_RGTC2)
+				stb_compress_bc5_block(out, block);
+			else
+				stb_compress_dxt_block(out, block, format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, STB_DXT_HIGHQUAL);
+			out += blockSize(format);
+		}
+	}
+}
+
+void buildTextureCache(const std::string& image_path, const uint8_t* pixels, int width, int height, int components,
+                       CompressedImage& image)
+{
+	if(components == 1)
+		image.format = GL_COMPRESSED_RED_RGTC1;
+	else if(components == 2)
+		image.format = GL_COMPRESSED_RG_RGTC2;
+	else
+	{
+		image.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		for(size_t i = 3; components == 4 && i < size_t(width) * height * 4; i += 4)
+		{
+			if(pixels[i] != 255)
+			{
+				image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+				break;
+			}
+		}
+	}
+
+	std::vector<uint8_t> level_pixels(pixels, pixels + size_t(width) * height * components);
+	image.levels.clear();
+	image.encoded.clear();
+	for(;;)
+	{
+		CompressedImage::Level level;
+		level.width = width;
+		level.height = height;
+		level.offset = image.encoded.size();
+		level.size = size_t((width + 3) / 4) * ((height + 3) / 4) * blockSize(image.format);
+		image.encoded.resize(level.offset + level.size);
+		encodeLevel(level_pixels.data(), width, height, components, image.format, image.encoded.data() + level.offset);
+		image.levels.push_back(level);
+		if(width == 1 && height == 1)
+			break;
+		level_pixels = downsample(level_pixels, width, height, components, width, height);
+	}
+	image.data = image.encoded.data();
+	image.size = image.encoded.size();
+
+	SourceFile source;
+	source.filename = image_path;
+	if(!source.stat(""))
+		return;
+	CacheWriter out;
+	out.write(TEXTURE_CACHE_MAGIC);
+	out.write(TEXTURE_CACHE_VERSION);
+	out.write(source.size);
+	out.write(source.time);
+	out.write(uint32_t(components));
+	out.write(image.format);
+	out.write(uint32_t(image.levels.size()));
+	for(const auto& level : image.levels)
+	{
+		out.write(int32_t(level.width));
+		out.write(int32_t(level.height));
+		out.write(uint64_t(level.offset));
+		out.write(uint64_t(level.size));
+	}
+	out.write(uint64_t(image.size));
+	out.align();
+	out.write(image.data, image.size);
+	if(!out.save(cachePath(image_path, components)))
+		std::cout << "Could not write " << cachePath(image_path, components) << "\n";
+}
+} // namespace labhelper
@@ -0,0 +1,43 @@
+#pragma once
+#include "CacheFile.h"
+#include <memory>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// Block compressed textures, with the whole mip chain filtered on the CPU
+// instead of by glGenerateMipmap():
+//  - 1 component (roughness, metalness, ...): BC4, 4 bits per texel
+//  - 2 components: BC5, 8 bits per texel
+//  - 3 and 4 components (color, emission): BC1, 4 bits per texel, when
+//    every texel is opaque, and BC3, 8 bits per texel, otherwise
+// The result is kept in a cache next to the image
+// (<image>.<components>.texcache), which is mapped and uploaded as it is
+// while the image is unchanged.
+///////////////////////////////////////////////////////////////////////////
+struct CompressedImage
+{
+	// The GL internal format
+	uint32_t format = 0;
+	struct Level
+	{
+		int width, height;
+		size_t offset, size;
+	};
+	std::vector<Level> levels;
+	// All the levels, in the mapped cache file or in 'encoded'
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	std::vector<uint8_t> encoded;
+	std::unique_ptr<MappedFile> file;
+};
+
+// Map the cache of an image. Returns false if there is none, or if the
+// image has changed since it was made.
+bool loadTextureCache(const std::string& image_path, int components, CompressedImage& image);
+
+// Compress an image and its mip chain, and write the cache. The rows are
+// kept in the order they come in.
+void buildTextureCache(const std::string& image_path, const uint8_t* pixels, int width, int height, int components,
+                       CompressedImage& image);
+} // namespace labhelper
@@ -0,0 +1,469 @@
+#include "TextureLoader.h"
+#include "Model.h"
+#include "TextureCache.h"
+#include <GL/glew.h>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+// A private copy of stb_image. The flip flag of the one in labhelper.cpp is
+// switched back and forth by the HDR loaders on the main thread, which
+// would race with the decoding here.
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+namespace labhelper
+{
+struct DecodeJob
+{
+	std::string path;
+	int components;
+	bool compress;
+	// Set by the worker thread. 'data' is the decoded image, or nullptr if
+	// it was compressed.
+	uint8_t* data = nullptr;
+	CompressedImage compressed;
+	int width = 0, height = 0;
+	bool done = false;
+	~DecodeJob()
+	{
+		// Only if no texture took the image
+		if(data != nullptr)
+			stbi_image_free(data);
+	}
+};
+
+// The file, the number of components, whether it is compressed and
+// whether the decoded image is kept after the upload
+typedef std::tuple<std::string, int, bool, bool> TextureKey;
+
+// One GL texture and decoded image per key, which all the Textures that
+// load it share. The GL texture is made by the first of them that is
+// uploaded (LoaderSettings::upload_to_gpu, uploadTexture()).
+struct SharedTexture
+{
+	GLuint gl_id = 0;
+	int components;
+	bool keep_data;
+	uint8_t* data = nullptr;
+	int width = 0, height = 0;
+	int references = 0;
+	// Until the image has been uploaded
+	std::shared_ptr<DecodeJob> job;
+	std::vector<Texture*> waiting;
+};
+
+static struct TextureLoader
+{
+	std::mutex mutex;
+	std::condition_variable job_queued, job_done;
+	std::deque<std::shared_ptr<DecodeJob>> queue;
+	// Decoded or being decoded, but not asked for by a texture yet
+	std::map<TextureKey, std::shared_ptr<DecodeJob>> prefetched;
+	std::map<TextureKey, SharedTexture> textures;
+	std::map<const Texture*, TextureKey> owners;
+	// Textures that show their placeholder until their job is done
+	std::vector<SharedTexture*> pending;
+	std::vector<std::thread> workers;
+	bool stop = false;
+
+	// Call with the mutex locked
+	std::shared_ptr<DecodeJob> queueJob(const std::string& path, int components, bool compress)
+	{
+		if(workers.empty())
+		{
+			stbi_set_flip_vertically_on_load(true);
+			const int number_of_workers = std::max(1, int(std::thread::hardware_concurrency()));
+			for(int i = 0; i < number_of_workers; i++)
+				workers.push_back(std::thread(&TextureLoader::work, this));
+		}
+		std::shared_ptr<DecodeJob> job = std::make_shared<DecodeJob>();
+		job->path = path;
+		job->components = components;
+		job->compress = compress;
+		queue.push_back(job);
+		job_queued.notify_one();
+		return job;
+	}
+
+	void work()
+	{
+		for(;;)
+		{
+			std::shared_ptr<DecodeJob> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				job_queued.wait(lock, [this] { return stop || !queue.empty(); });
+				if(stop)
+					return;
+				job = queue.front();
+				queue.pop_front();
+			}
+			int width = 0, height = 0, components;
+			uint8_t* data = nullptr;
+			CompressedImage compressed;
+			if(!job->compress || !loadTextureCache(job->path, job->components, compressed))
+			{
+				data = stbi_load(job->path.c_str(), &width, &height, &components, job->components);
+				if(data != nullptr && job->compress)
+				{
+					buildTextureCache(job->path, data, width, height, job->components, compressed);
+					stbi_image_free(data);
+					data = nullptr;
+				}
+			}
+			if(compressed.data != nullptr)
+			{
+				width = compressed.levels[0].width;
+				height = compressed.levels[0].height;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job->data = data;
+				job->compressed = std::move(compressed);
+				job->width = width;
+				job->height = height;
+				job->done = true;
+			}
+			job_done.notify_all();
+		}
+	}
+
+	~TextureLoader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		job_queued.notify_all();
+		for(auto& worker : workers)
+			worker.join();
+	}
+} texture_loader;
+
+static void textureFormat(int components, GLenum& format, GLenum& internal_format)
+{
+	if(components == 1)
+	{
+		format = GL_RED;
+		internal_format = GL_R8;
+	}
+	else if(components == 2)
+	{
+		format = GL_RG;
+		internal_format = GL_RG8;
+	}
+	else if(components == 3)
+	{
+		format = GL_RGB;
+		internal_format = GL_RGB;
+	}
+	else if(components == 4)
+	{
+		format = GL_RGBA;
+		internal_format = GL_RGBA;
+	}
+	else
+	{
+		std::cout << "Texture loading not implemented for this number of compenents.\n";
+		exit(1);
+	}
+}
+
+// Different paths to the same file give the same texture
+static std::string canonicalPath(const std::string& path)
+{
+#ifdef _WIN32
+	char full_path[_MAX_PATH];
+	if(_fullpath(full_path, path.c_str(), _MAX_PATH) != nullptr)
+		return full_path;
+#else
+	char* full_path = realpath(path.c_str(), nullptr);
+	if(full_path != nullptr)
+	{
+		std::string result(full_path);
+		free(full_path);
+		return result;
+	}
+#endif
+	return path;
+}
+
+static GLuint createPlaceholder(int components)
+{
+	GLenum format, internal_format;
+	textureFormat(components, format, internal_format);
+	const uint8_t placeholder[4] = { 0, 0, 0, 255 };
+	GLuint gl_id;
+	glGenTextures(1, &gl_id);
+	glBindTexture(GL_TEXTURE_2D, gl_id);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, 1, 1, 0, format, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
+	return gl_id;
+}
+
+static void uploadImage(const SharedTexture& texture, int components);
+
+// Compressed textures are only for the GPU, and without the GPU the image
+// is all there is
+static TextureKey textureKey(const std::string& path, int components)
+{
+	const bool upload = loader_settings.upload_to_gpu;
+	return TextureKey(canonicalPath(path), components, upload && loader_settings.compress_textures,
+	                  !upload || loader_settings.keep_cpu_data);
+}
+
+// Call with the mutex locked
+static void createTexture(SharedTexture& shared)
+{
+	shared.gl_id = createPlaceholder(shared.components);
+	if(!shared.job && shared.data != nullptr)
+	{
+		GLint bound_texture = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound_texture);
+		uploadImage(shared, shared.components);
+		glBindTexture(GL_TEXTURE_2D, bound_texture);
+	}
+}
+
+bool Texture::load(const std::string& _directory, const std::string& _filename, int _components)
+{
+	filename = _filename;
+	directory = _directory;
+	valid = true;
+	const TextureKey key = textureKey(directory + filename, _components);
+
+	std::lock_guard<std::mutex> lock(texture_loader.mutex);
+	texture_loader.owners[this] = key;
+	SharedTexture& shared = texture_loader.textures[key];
+	if(shared.references++ == 0)
+	{
+		shared.components = _components;
+		shared.keep_data = std::get<3>(key);
+		auto prefetched = texture_loader.prefetched.find(key);
+		if(prefetched != texture_loader.prefetched.end())
+		{
+			shared.job = prefetched->second;
+			texture_loader.prefetched.erase(prefetched);
+		}
+		else
+		{
+			shared.job = texture_loader.queueJob(std::get<0>(key), _components, std::get<2>(key));
+		}
+		texture_loader.pending.push_back(&shared);
+	}
+	if(loader_settings.upload_to_gpu && shared.gl_id == 0)
+		createTexture(shared);
+	gl_id = shared.gl_id;
+	if(shared.job)
+	{
+		shared.waiting.push_back(this);
+	}
+	else
+	{
+		data = shared.data;
+		width = shared.width;
+		height = shared.height;
+	}
+	return true;
+}
+
+void prefetchTexture(const std::string& path, int components)
+{
+	const TextureKey key = textureKey(path, components);
+	std::lock_guard<std::mutex> lock(texture_loader.mutex);
+	if(texture_loader.prefetched.count(key) == 0 && texture_loader.textures.count(key) == 0)
+		texture_loader.prefetched[key] = texture_loader.queueJob(std::get<0>(key), components, std::get<2>(key));
+}
+
+void releaseTexture(Texture* texture)
+{
+	std::lock_guard<std::mutex> lock(texture_loader.mutex);
+	auto key = texture_loader.owners.find(texture);
+	if(!texture->valid || key == texture_loader.owners.end())
+		return;
+	auto it = texture_loader.textures.find(key->second);
+	SharedTexture& shared = it->second;
+	shared.waiting.erase(std::remove(shared.waiting.begin(), shared.waiting.end(), texture), shared.waiting.end());
+	texture->valid = false;
+	texture->data = nullptr;
+	texture->gl_id = 0;
+	texture_loader.owners.erase(key);
+	if(--shared.references > 0)
+		return;
+	auto& pending = texture_loader.pending;
+	pending.erase(std::remove(pending.begin(), pending.end(), &shared), pending.end());
+	if(shared.gl_id != 0)
+		glDeleteTextures(1, &shared.gl_id);
+	if(shared.data != nullptr)
+		stbi_image_free(shared.data);
+	texture_loader.textures.erase(it);
+}
+
+void uploadTexture(Texture* texture)
+{
+	std::lock_guard<std::mutex> lock(texture_loader.mutex);
+	auto key = texture_loader.owners.find(texture);
+	if(!texture->valid || key == texture_loader.owners.end())
+		return;
+	SharedTexture& shared = texture_loader.textures[key->second];
+	if(shared.gl_id == 0)
+		createTexture(shared);
+	texture->gl_id = shared.gl_id;
+}
+
+// Copy the image into a pixel buffer object and let the driver take it from
+// there, instead of having glTexImage2D() wait for it to copy the pixels
+static void uploadImage(const SharedTexture& texture, int components)
+{
+	GLenum format, internal_format;
+	textureFormat(components, format, internal_format);
+	const size_t size = size_t(texture.width) * size_t(texture.height) * size_t(components);
+	GLuint pixel_buffer;
+	glGenBuffers(1, &pixel_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(mapped != nullptr)
+	{
+		memcpy(mapped, texture.data, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else
+	{
+		// Without the buffer the image is read from client memory, which
+		// only works with no pixel unpack buffer bound
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture.gl_id);
+	// The rows of one and three component images are not 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE,
+	             mapped != nullptr ? nullptr : texture.data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &pixel_buffer);
+	glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+// The same for a compressed image with its mip chain
+static void uploadCompressedImage(const SharedTexture& texture, const CompressedImage& image)
+{
+	GLuint pixel_buffer;
+	glGenBuffers(1, &pixel_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, image.size, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(mapped != nullptr)
+	{
+		memcpy(mapped, image.data, image.size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture.gl_id);
+	for(size_t i = 0; i < image.levels.size(); i++)
+	{
+		const CompressedImage::Level& level = image.levels[i];
+		const size_t source = (mapped != nullptr ? 0 : size_t(image.data)) + level.offset;
+		glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), image.format, level.width, level.height, 0, GLsizei(level.size),
+		                       (GLvoid*)source);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(image.levels.size()) - 1);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &pixel_buffer);
+}
+
+int uploadLoadedTextures()
+{
+	std::vector<SharedTexture*> done;
+	int number_pending;
+	{
+		std::lock_guard<std::mutex> lock(texture_loader.mutex);
+		auto& pending = texture_loader.pending;
+		if(pending.empty())
+			return 0;
+		auto first_done = std::stable_partition(pending.begin(), pending.end(),
+		                                        [](const SharedTexture* shared) { return !shared->job->done; });
+		done.assign(first_done, pending.end());
+		pending.erase(first_done, pending.end());
+		number_pending = int(pending.size());
+	}
+	if(done.empty())
+		return number_pending;
+
+	// Leave the texture binding of the active unit as it was
+	GLint bound_texture = 0;
+	bool uploaded = false;
+	for(SharedTexture* shared : done)
+	{
+		DecodeJob& job = *shared->job;
+		if(job.data == nullptr && job.compressed.data == nullptr)
+		{
+			std::cout << "ERROR: loadModelFromOBJ(): Failed to load texture: " << job.path << "\n";
+			exit(1);
+		}
+		shared->data = job.data;
+		job.data = nullptr;
+		shared->width = job.width;
+		shared->height = job.height;
+		if(shared->gl_id != 0)
+		{
+			if(!uploaded)
+				glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound_texture);
+			uploaded = true;
+			if(job.compressed.data != nullptr)
+				uploadCompressedImage(*shared, job.compressed);
+			else
+				uploadImage(*shared, job.components);
+			if(!shared->keep_data && shared->data != nullptr)
+			{
+				stbi_image_free(shared->data);
+				shared->data = nullptr;
+			}
+		}
+		for(Texture* texture : shared->waiting)
+		{
+			texture->data = shared->data;
+			texture->width = shared->width;
+			texture->height = shared->height;
+		}
+		shared->waiting.clear();
+		shared->job.reset();
+	}
+	if(uploaded)
+		glBindTexture(GL_TEXTURE_2D, bound_texture);
+	return number_pending;
+}
+
+void finishTextureLoads()
+{
+	{
+		std::unique_lock<std::mutex> lock(texture_loader.mutex);
+		texture_loader.job_done.wait(lock, [] {
+			for(const SharedTexture* shared : texture_loader.pending)
+			{
+				if(!shared->job->done)
+					return false;
+			}
+			return true;
+		});
+	}
+	uploadLoadedTextures();
+}
+} // namespace labhelper
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+
+namespace labhelper
+{
+struct Texture;
+
+///////////////////////////////////////////////////////////////////////////
+// Textures are decoded on a pool of worker threads. Texture::load() queues
+// the file and, with LoaderSettings::upload_to_gpu, gives the texture its
+// GL name with a black 1x1 placeholder image right away.
+// uploadLoadedTextures() later uploads each decoded image into the same GL
+// texture, so whoever binds it does not need to know whether it has
+// arrived. render() calls it every time. Without upload_to_gpu no GL
+// calls are made, and the decoded image is all the texture gets.
+//
+// The images are always decoded bottom row first, as OpenGL wants them,
+// whatever stbi_set_flip_vertically_on_load() was last set to.
+//
+// Textures that load the same file, with the same number of components,
+// share one GL texture and decoded image, which are deleted when the last
+// of them is released.
+///////////////////////////////////////////////////////////////////////////
+
+// Start decoding an image that a Texture::load() will ask for later
+void prefetchTexture(const std::string& path, int components);
+
+// Give up a texture's reference to its GL texture and image
+void releaseTexture(Texture* texture);
+
+// Give a texture that was loaded without upload_to_gpu its GL texture
+void uploadTexture(Texture* texture);
+
+// Upload the textures that have been decoded, through pixel buffer
+// objects. Returns the number of textures that are still being decoded.
+int uploadLoadedTextures();
+
+// Wait for all queued textures to be decoded, and upload them. Code that
+// reads Texture::data has to call this first.
+void finishTextureLoads();
+} // namespace labhelper
@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////
+// objbenchmark [obj files] compares parseOBJParallel() (ObjParser.h) with
+// tinyobj, on the shipped scenes if no files are given. Needs no window.
+///////////////////////////////////////////////////////////////////////////
+#include "ObjParser.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+using namespace labhelper;
+
+static bool sameShapes(const std::vector<tinyobj::shape_t>& a, const std::vector<tinyobj::shape_t>& b)
+{
+	if(a.size() != b.size())
+		return false;
+	for(size_t i = 0; i < a.size(); i++)
+	{
+		const tinyobj::mesh_t& ma = a[i].mesh;
+		const tinyobj::mesh_t& mb = b[i].mesh;
+		if(a[i].name != b[i].name || ma.indices.size() != mb.indices.size() || ma.material_ids != mb.material_ids
+		   || ma.num_face_vertices != mb.num_face_vertices)
+			return false;
+		for(size_t j = 0; j < ma.indices.size(); j++)
+		{
+			if(ma.indices[j].vertex_index != mb.indices[j].vertex_index
+			   || ma.indices[j].normal_index != mb.indices[j].normal_index
+			   || ma.indices[j].texcoord_index != mb.indices[j].texcoord_index)
+				return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Parse each OBJ file with tinyobj and with parseOBJParallel(), and print
+// the times and whether the results are the same. Returns the exit code
+// for main().
+///////////////////////////////////////////////////////////////////////////
+static int benchmarkOBJParsers(const std::vector<std::string>& filenames)
+{
+	int result = 0;
+	std::cout << "file, tinyobj ms, parallel ms, speedup, threads, same\n";
+	for(const std::string& filename : filenames)
+	{
+		const size_t separator = filename.find_last_of("\\/");
+		const std::string directory = separator != std::string::npos ? filename.substr(0, separator + 1) : "./";
+
+		tinyobj::attrib_t attrib[2];
+		std::vector<tinyobj::shape_t> shapes[2];
+		std::vector<tinyobj::material_t> materials[2];
+		std::string err[2];
+		auto start = std::chrono::high_resolution_clock::now();
+		const bool ok_tinyobj = tinyobj::LoadObj(&attrib[0], &shapes[0], &materials[0], &err[0], filename.c_str(),
+		                                         directory.c_str(), true);
+		auto middle = std::chrono::high_resolution_clock::now();
+		const bool ok_parallel = parseOBJParallel(&attrib[1], &shapes[1], &materials[1], &err[1], filename.c_str(),
+		                                          directory.c_str());
+		auto end = std::chrono::high_resolution_clock::now();
+		if(!ok_tinyobj || !ok_parallel)
+		{
+			std::cout << "ERROR: benchmarkOBJParsers(): Could not load " << filename << "\n";
+			result = 1;
+			continue;
+		}
+
+		const bool same = attrib[0].vertices == attrib[1].vertices && attrib[0].normals == attrib[1].normals
+		                  && attrib[0].texcoords == attrib[1].texcoords && sameShapes(shapes[0], shapes[1])
+		                  && materials[0].size() == materials[1].size() && err[0] == err[1];
+		const float tinyobj_ms = std::chrono::duration<float, std::milli>(middle - start).count();
+		const float parallel_ms = std::chrono::duration<float, std::milli>(end - middle).count();
+		std::cout << filename << ", " << tinyobj_ms << ", " << parallel_ms << ", " << tinyobj_ms / parallel_ms
+		          << ", " << std::thread::hardware_concurrency() << ", " << (same ? "yes" : "NO") << "\n";
+		if(!same)
+			result = 1;
+	}
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> files(argv + 1, argv + argc);
+	if(files.empty())
+	{
+		files = { "../scenes/NewShip.obj", "../scenes/BigSphere.obj", "../scenes/wheatley.obj",
+		          "../scenes/city.obj",    "../scenes/landingpad2.obj" };
+	}
+	return benchmarkOBJParsers(files);
+}
@@ -6,16 +6,21 @@ using namespace glm;
 
 void HDRImage::load(const string& filename)
 {
-	stbi_set_flip_vertically_on_load(false);
-	data = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
-	stbi_set_flip_vertically_on_load(true);
-	if(data == NULL)
+	if(!tryLoad(filename))
 	{
 		std::cout << "Failed to load image: " << filename << ".\n";
 		exit(1);
 	}
 };
 
+bool HDRImage::tryLoad(const string& filename)
+{
+	stbi_set_flip_vertically_on_load(false);
+	data = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
+	stbi_set_flip_vertically_on_load(true);
+	return data != NULL;
+}
+
 vec3 HDRImage::sample(float u, float v)
 {
 	int x = int(u * width) % width;
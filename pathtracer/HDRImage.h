@@ -17,5 +17,7 @@ struct HDRImage
 			stbi_image_free(data);
 	};
 	void load(const std::string& filename);
+	// Returns false instead of exiting if the image can not be loaded
+	bool tryLoad(const std::string& filename);
 	glm::vec3 sample(float u, float v);
 };
\ No newline at end of file
@@ -6,6 +6,15 @@
 #include "material.h"
 #include "embree.h"
 #include "sampling.h"
+#include "lights.h"
+#include "guiding.h"
+#include "photonmap.h"
+#include "radiancecache.h"
+#include "texture.h"
+#include "stats.h"
+#include "kernels.h"
+#include "raster.h"
+#include <chrono>
 
 using namespace std;
 using namespace glm;
@@ -18,15 +27,24 @@ namespace pathtracer
 Settings settings;
 Environment environment;
 Image rendered_image;
-PointLight point_light;
 
 ///////////////////////////////////////////////////////////////////////////
 // Restart rendering of image
 ///////////////////////////////////////////////////////////////////////////
 void restart()
 {
-	// No need to clear image,
+	// No need to clear image, the first pass overwrites the sums.
 	rendered_image.number_of_samples = 0;
+	resetCaustics();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Divide the accumulated sums by the per pixel sample count, with the
+// widest SIMD kernel the CPU supports.
+///////////////////////////////////////////////////////////////////////////
+void Image::resolve(vec4* dst, size_t offset, size_t count) const
+{
+	simd::resolveAccumulated(&data[offset].x, &dst->x, int(count));
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -35,26 +53,67 @@ void restart()
 ///////////////////////////////////////////////////////////////////////////
 void resize(int w, int h)
 {
-	rendered_image.width = w / settings.subsampling;
-	rendered_image.height = h / settings.subsampling;
-	rendered_image.data.resize(rendered_image.width * rendered_image.height);
+	rendered_image.resize(w / settings.subsampling, h / settings.subsampling);
 	restart();
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Allocate the pixels and tiles of an image, which then starts over from
+// zero samples
+///////////////////////////////////////////////////////////////////////////
+void Image::resize(int w, int h)
+{
+	width = w;
+	height = h;
+	data.resize(width * height);
+	tiles_x = (width + Image::tile_size - 1) / Image::tile_size;
+	tiles_y = (height + Image::tile_size - 1) / Image::tile_size;
+	dirty_tiles.assign(tiles_x * tiles_y, 1);
+	number_of_samples = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Return the radiance from a certain direction wi from the environment
 // map.
 ///////////////////////////////////////////////////////////////////////////
 vec3 Lenvironment(const vec3& wi)
 {
-	const float theta = acos(std::max(-1.0f, std::min(1.0f, wi.y)));
-	float phi = atan(wi.z, wi.x);
+	const float theta = fastAcos(std::max(-1.0f, std::min(1.0f, wi.y)));
+	float phi = fastAtan2(wi.z, wi.x);
 	if(phi < 0.0f)
 		phi = phi + 2.0f * M_PI;
 	vec2 lookup = vec2(phi / (2.0 * M_PI), theta / M_PI);
 	return environment.multiplier * environment.map.sample(lookup.x, lookup.y);
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Estimate the direct illumination at a hit point. Rather than evaluating
+// every light, settings.light_samples lights are picked from the light BVH
+// in proportion to their estimated contribution, and each is weighted by
+// the probability of picking it.
+///////////////////////////////////////////////////////////////////////////
+vec3 directIllumination(const Intersection& hit, BRDF& mat)
+{
+	vec3 L = vec3(0.0f);
+	for(int i = 0; i < settings.light_samples; i++)
+	{
+		float pmf;
+		int light_index = sampleLight(hit.position, hit.shading_normal, randf(), pmf);
+		if(light_index < 0)
+			continue;
+		const PointLight& light = lights[light_index];
+		const float distance_to_light = length(light.position - hit.position);
+		vec3 wi = (light.position - hit.position) / distance_to_light;
+		Ray occlusionRay(hit.position + EPSILON * hit.geometry_normal, wi, 0.0f, distance_to_light);
+		if(!occluded(occlusionRay))
+		{
+			vec3 Li = lightRadiance(light, hit.position);
+			L += mat.f(wi, hit.wo, hit.shading_normal) * Li * std::max(0.0f, dot(wi, hit.shading_normal)) / pmf;
+		}
+	}
+	return L / float(std::max(1, settings.light_samples));
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Calculate the radiance going from one point (r.hitPosition()) in one
 // direction (-r.d), through path tracing.
@@ -95,65 +154,154 @@ vec3 Li(Ray& primary_ray)
 	// that point to the light source and check if it is occluded,
 	// if it isn't occluded we calculate the direct illumination.
 	// Otherwise, not. 
-	Ray occlusionRay(hit.position + EPSILON * hit.geometry_normal, normalize(point_light.position - hit.position));
-
-	if (!occluded(occlusionRay))
-	{
-		const float distance_to_light = length(point_light.position - hit.position);
-		const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
-		vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
-		vec3 wi = normalize(point_light.position - hit.position);
-		L = mat.f(wi, hit.wo, hit.shading_normal) * Li * std::max(0.0f, dot(wi, hit.shading_normal));
-	}
+	L = directIllumination(hit, mat);
 
 	// Return the final outgoing radiance for the primary ray
 	return L;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// A path vertex kept for training the path guiding distributions
+///////////////////////////////////////////////////////////////////////////
+struct GuidingVertex
+{
+	vec3 position;
+	vec3 wi;
+	vec3 throughput;
+	vec3 L;
+	float pdf;
+};
+static const int MAX_GUIDING_VERTICES = 16;
+
+///////////////////////////////////////////////////////////////////////////
+// A path vertex on a diffuse surface, kept for filling the radiance cache
+///////////////////////////////////////////////////////////////////////////
+struct CacheVertex
+{
+	vec3 position;
+	vec3 normal;
+	vec3 throughput;
+	vec3 L;
+};
+static const int MAX_CACHE_VERTICES = 16;
+
+static bool isPureDiffuse(const SurfaceProperties& s)
+{
+	return s.reflectivity == 0.0f && s.transparency == 0.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Texture mip levels are chosen by following a ray cone along each path.
+// It starts out with the angle subtended by a pixel, and after a non
+// specular bounce it widens to a fixed, rough spread.
+///////////////////////////////////////////////////////////////////////////
+static const float DIFFUSE_SPREAD_ANGLE = 0.2f;
+
 // Task 5
-vec3 Li_pathtracer(Ray& primary_ray)
+vec3 Li_pathtracer(Ray& primary_ray, float pixel_spread_angle)
 {
 	vec3 L = vec3(0.0f);
 	vec3 pathThroughput = vec3(1.0f);
 	Ray currentRay = primary_ray;
+	GuidingVertex guiding_vertices[MAX_GUIDING_VERTICES];
+	int num_guiding_vertices = 0;
+	CacheVertex cache_vertices[MAX_CACHE_VERTICES];
+	int num_cache_vertices = 0;
+	// Number of specular bounces since the last non specular one (-1 if
+	// there has been none)
+	int specular_bounces_after_diffuse = -1;
+	float cone_width = 0.0f;
+	float cone_spread = pixel_spread_angle;
+	ThreadStats& stats = threadStats();
+	stats.paths++;
 
 	for (int bounces = 0; bounces < settings.max_bounces; bounces++)
 	{
+		stats.path_vertices++;
 		// Get the intersection information from the ray
 		Intersection hit = getIntersection(currentRay);
+		cone_width += cone_spread * currentRay.tfar;
 
-		// Create a Material tree
-		Diffuse diffuse(hit.material->m_color);
-		Refraction refractive(hit.material->m_color);
-		LinearBlend refractive_blend(hit.material->m_transparency, &refractive, &diffuse);
-		BlinnPhong dielectric(hit.material->m_shininess, hit.material->m_fresnel, &refractive_blend);
-		BlinnPhongMetal metal(hit.material->m_color, hit.material->m_shininess, hit.material->m_fresnel);
-		LinearBlend metal_blend(hit.material->m_metalness, &metal, &dielectric);
-		LinearBlend reflectivity_blend(hit.material->m_reflectivity, &metal_blend, &refractive_blend);
-		
-		BRDF& mat = reflectivity_blend;
+		// Create a Material tree from the (textured) surface
+		SurfaceProperties surface = evaluateSurface(hit, cone_width);
+		MaterialTree material(surface);
+		BRDF& mat = material.root();
 
-		// Direct Illumination
-		Ray occlusionRay(hit.position + EPSILON * hit.geometry_normal, normalize(point_light.position - hit.position));
-		if (!occluded(occlusionRay))
+		// Radiance leaving a diffuse surface does not depend on the view
+		// direction, so after a diffuse bounce the rest of the path can be
+		// taken from the cache.
+		const bool cacheable = radiance_cache_settings.enabled && isPureDiffuse(surface);
+		if(cacheable)
 		{
-			const float distance_to_light = length(point_light.position - hit.position);
-			const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
-			vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
-			vec3 wi = normalize(point_light.position - hit.position);
-			L += pathThroughput * mat.f(wi, hit.wo, hit.shading_normal) * Li * std::max(0.0f, dot(wi, hit.shading_normal));
+			vec3 cached;
+			if(bounces > 0 && specular_bounces_after_diffuse == 0
+			   && lookupRadianceCache(hit.position, hit.shading_normal, cached))
+			{
+				L += pathThroughput * cached;
+				break;
+			}
+			if(num_cache_vertices < MAX_CACHE_VERTICES)
+			{
+				CacheVertex& vertex = cache_vertices[num_cache_vertices++];
+				vertex.position = hit.position;
+				vertex.normal = hit.shading_normal;
+				vertex.throughput = pathThroughput;
+				vertex.L = L;
+			}
 		}
 
-		// Add emitted radiance from intersection
-		L += pathThroughput * hit.material->m_emission * hit.material->m_color;
+		// Direct Illumination
+		L += pathThroughput * directIllumination(hit, mat);
+
+		// Caustics, from the photon map
+		L += pathThroughput * causticRadiance(hit, material);
 
-		// Sample an incoming direction (and the brdf and pdf for that direction)
+		// Add emitted radiance from intersection, unless the photon map
+		// already accounted for this path
+		if(!(causticsCoverEmitters() && specular_bounces_after_diffuse > 0))
+		{
+			L += pathThroughput * surface.emission;
+		}
+
+		// Sample an incoming direction (and the brdf and pdf for that direction).
+		// Materials without a perfectly specular lobe can also be sampled from
+		// the learned guiding distribution, combined with the BSDF through
+		// one-sample MIS.
 		float pdf;
 		vec3 wi, brdf;
-		brdf = mat.sample_wi(wi, hit.wo, hit.shading_normal, pdf);
+		const bool guided = guiding_settings.enabled && surface.transparency == 0.0f;
+		if(guided && guidingActive())
+		{
+			const float alpha = guiding_settings.bsdf_sampling_fraction;
+			float guiding_pdf;
+			if(randf() < alpha)
+			{
+				mat.sample_wi(wi, hit.wo, hit.shading_normal, pdf);
+				guiding_pdf = pdfGuiding(hit.position, wi);
+			}
+			else
+			{
+				wi = sampleGuiding(hit.position, guiding_pdf);
+			}
+			brdf = mat.f(wi, hit.wo, hit.shading_normal);
+			pdf = alpha * mat.pdf(wi, hit.wo, hit.shading_normal) + (1.0f - alpha) * guiding_pdf;
+			specular_bounces_after_diffuse = 0;
+		}
+		else
+		{
+			brdf = mat.sample_wi(wi, hit.wo, hit.shading_normal, pdf);
+			if(!mat.sampled_specular)
+				specular_bounces_after_diffuse = 0;
+			else if(specular_bounces_after_diffuse >= 0)
+				specular_bounces_after_diffuse += 1;
+		}
 		if (pdf < 0.00001f)
 		{
-			return L;
+			break;
+		}
+		if(specular_bounces_after_diffuse == 0)
+		{
+			cone_spread = std::max(cone_spread, DIFFUSE_SPREAD_ANGLE);
 		}
 		float cosineterm = abs(dot(wi, hit.shading_normal));
 
@@ -162,7 +310,19 @@ vec3 Li_pathtracer(Ray& primary_ray)
 		// If pathThroughput is zero there is no need to continue
 		if (pathThroughput == vec3(0.0f))
 		{
-			return L;
+			break;
+		}
+
+		// Remember the vertex so that the light eventually found along wi
+		// can be recorded once the path is complete
+		if(guided && guidingTraining() && num_guiding_vertices < MAX_GUIDING_VERTICES)
+		{
+			GuidingVertex& vertex = guiding_vertices[num_guiding_vertices++];
+			vertex.position = hit.position;
+			vertex.wi = wi;
+			vertex.throughput = pathThroughput;
+			vertex.L = L;
+			vertex.pdf = pdf;
 		}
 		
 		// Create next ray on path (existing instance can't be reused)
@@ -186,11 +346,33 @@ vec3 Li_pathtracer(Ray& primary_ray)
 		if (!intersect(currentRay))
 		{
 			L += pathThroughput * Lenvironment(currentRay.d);
-			return L;
+			break;
 		}
 		// Otherwise, reiterate for the new intersection
 	}
 
+	// The radiance that arrived along wi at a vertex is everything gathered
+	// after it, divided by the throughput up to and including the vertex.
+	for(int i = 0; i < num_guiding_vertices; i++)
+	{
+		const GuidingVertex& vertex = guiding_vertices[i];
+		vec3 incident = L - vertex.L;
+		for(int c = 0; c < 3; c++)
+			incident[c] = vertex.throughput[c] > 0.0f ? incident[c] / vertex.throughput[c] : 0.0f;
+		recordGuiding(vertex.position, vertex.wi, luminance(incident) / vertex.pdf);
+	}
+
+	// Likewise, the radiance leaving a cached vertex is everything gathered
+	// from it on, divided by the throughput arriving at it.
+	for(int i = 0; i < num_cache_vertices; i++)
+	{
+		const CacheVertex& vertex = cache_vertices[i];
+		vec3 outgoing = L - vertex.L;
+		for(int c = 0; c < 3; c++)
+			outgoing[c] = vertex.throughput[c] > 0.0f ? outgoing[c] / vertex.throughput[c] : 0.0f;
+		insertRadianceCache(vertex.position, vertex.normal, outgoing);
+	}
+
 	return L;
 }
 
@@ -202,62 +384,190 @@ inline static glm::vec3 homogenize(const glm::vec4& p)
 	return glm::vec3(p * (1.f / p.w));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// What tracePaths() needs to know about each view during a pass. The
+// tiles of all views are numbered one after the other, starting with
+// first_tile for this view.
+///////////////////////////////////////////////////////////////////////////
+struct ViewPass
+{
+	Image* image;
+	mat4 V, P;
+	mat4 inverse_view_projection;
+	vec3 camera_pos;
+	float pixel_spread_angle;
+	bool first_pass;
+	int first_tile;
+};
+static std::vector<VisibilityBuffer> visibility_buffers;
+
 ///////////////////////////////////////////////////////////////////////////
 // Trace one path per pixel and accumulate the result in an image
 ///////////////////////////////////////////////////////////////////////////
 void tracePaths(const glm::mat4& V, const glm::mat4& P)
 {
-	// Stop here if we have as many samples as we want
-	if((int(rendered_image.number_of_samples) > settings.max_paths_per_pixel)
-	   && (settings.max_paths_per_pixel != 0))
+	RenderView view = { V, P, &rendered_image };
+	tracePaths(std::vector<RenderView>(1, view));
+}
+
+void tracePaths(const std::vector<RenderView>& views)
+{
+	// Skip the views that have as many samples as we want
+	std::vector<ViewPass> passes;
+	int number_of_tiles = 0;
+	size_t number_of_pixels = 0;
+	for(const RenderView& view : views)
+	{
+		Image& image = *view.image;
+		if((int(image.number_of_samples) > settings.max_paths_per_pixel) && (settings.max_paths_per_pixel != 0))
+		{
+			continue;
+		}
+		ViewPass pass;
+		pass.image = &image;
+		pass.V = view.V;
+		pass.P = view.P;
+		pass.camera_pos = vec3(glm::inverse(view.V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		pass.inverse_view_projection = inverse(view.P * view.V);
+		// P[1][1] is 1 / tan(fov_y / 2)
+		pass.pixel_spread_angle = atan(2.0f / (view.P[1][1] * float(image.height)));
+		pass.first_pass = image.number_of_samples == 0;
+		pass.first_tile = number_of_tiles;
+		number_of_tiles += image.tiles_x * image.tiles_y;
+		number_of_pixels += size_t(image.width) * image.height;
+		passes.push_back(pass);
+	}
+	if(passes.empty())
 	{
 		return;
 	}
-	vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	auto pass_start = std::chrono::high_resolution_clock::now();
+	beginStatsPass();
+	// The photons do not depend on the camera, so all views share them
+	tracePhotons();
+	endPhotonStats();
+	// The rasterizer samples all pixels at the same position within the
+	// pixel, so the jitter is drawn once per pass instead of per pixel.
+	const bool rasterize = settings.rasterize_primary_visibility;
+	if(rasterize)
+	{
+		visibility_buffers.resize(passes.size());
+		for(size_t v = 0; v < passes.size(); v++)
+		{
+			const ViewPass& pass = passes[v];
+			seedRandom(uint32_t(v), pass.image->number_of_samples + settings.seed_offset, RANDOM_STREAM_RASTER_JITTER);
+			vec2 jitter;
+			jitter.x = randf();
+			jitter.y = randf();
+			rasterizeVisibility(pass.V, pass.P, pass.image->width, pass.image->height, jitter, visibility_buffers[v]);
+		}
+		endRasterStats();
+	}
 	// Trace one path per pixel (the omp parallel stuf magically distributes the
-	// pathtracing on all cores of your CPU).
-	int num_rays = 0;
-	vector<vec4> local_image(rendered_image.width * rendered_image.height, vec4(0.0f));
+	// pathtracing on all cores of your CPU). Work is handed out per tile so
+	// that each thread touches a compact block of the image, and the tiles
+	// of all views go through the same loop so that no thread idles at the
+	// end of a small image.
+	double squared_deviation = 0.0;
 
-	#pragma omp parallel for
-	for(int y = 0; y < rendered_image.height; y++)
+	#pragma omp parallel for schedule(dynamic) reduction(+ : squared_deviation)
+	for(int tile = 0; tile < number_of_tiles; tile++)
 	{
-		for(int x = 0; x < rendered_image.width; x++)
+		ThreadStats& stats = threadStats();
+		const uint64_t tile_start = timerTicks();
+		size_t v = 0;
+		while(v + 1 < passes.size() && tile >= passes[v + 1].first_tile)
+			v++;
+		const ViewPass& pass = passes[v];
+		Image& image = *pass.image;
+		const int image_tile = tile - pass.first_tile;
+		const int tile_x0 = (image_tile % image.tiles_x) * Image::tile_size;
+		const int tile_y0 = (image_tile / image.tiles_x) * Image::tile_size;
+		const int tile_x1 = std::min(tile_x0 + Image::tile_size, image.width);
+		const int tile_y1 = std::min(tile_y0 + Image::tile_size, image.height);
+		for(int y = tile_y0; y < tile_y1; y++)
 		{
-			vec3 color;
-			// Create a ray that starts in the camera position and points toward
-			// the current pixel on a virtual screen.
-			vec2 screenCoord = vec2(float(x) / float(rendered_image.width),
-			                        float(y) / float(rendered_image.height));
-
-			// Task 1: Jittered Sampling
-			screenCoord.x += randf() / float(rendered_image.width);
-			screenCoord.y += randf() / float(rendered_image.height);
-
-			// Calculate direction
-			vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f, screenCoord.y * 2.0f - 1.0f, 1.0f, 1.0f);
-			vec3 p = homogenize(inverse(P * V) * viewCoord);
-			Ray primaryRay(camera_pos, normalize(p - camera_pos));
-			// Intersect ray with scene
-			if(intersect(primaryRay))
+			// Task 1: Jittered Sampling. The screen coordinates of the row are
+			// generated first, and the rays through them in one batch.
+			float sx[Image::tile_size], sy[Image::tile_size];
+			float dx[Image::tile_size], dy[Image::tile_size], dz[Image::tile_size];
+			for(int x = tile_x0; x < tile_x1; x++)
 			{
-				// If it hit something, evaluate the radiance from that point
-				//color = Li(primaryRay);
-				// Task 5
-				color = Li_pathtracer(primaryRay);
+				vec2 jitter;
+				if(rasterize)
+				{
+					jitter = visibility_buffers[v].jitter;
+				}
+				else
+				{
+					seedRandom(uint32_t(y * image.width + x), image.number_of_samples + settings.seed_offset,
+					           RANDOM_STREAM_PIXEL_JITTER);
+					jitter.x = randf();
+					jitter.y = randf();
+				}
+				sx[x - tile_x0] = (float(x) + jitter.x) / float(image.width);
+				sy[x - tile_x0] = (float(y) + jitter.y) / float(image.height);
 			}
-			else
+			simd::generateCameraRays(&pass.inverse_view_projection[0][0], &pass.camera_pos.x, sx, sy, dx, dy, dz,
+			                         tile_x1 - tile_x0);
+
+			for(int x = tile_x0; x < tile_x1; x++)
 			{
-				// Otherwise evaluate environment
-				color = Lenvironment(primaryRay.d);
+				vec3 color;
+				// The random sequence of a sample depends only on the pixel
+				// and the sample number
+				seedRandom(uint32_t(y * image.width + x), image.number_of_samples + settings.seed_offset,
+				           RANDOM_STREAM_CAMERA);
+				// Create a ray that starts in the camera position and points toward
+				// the current pixel on a virtual screen.
+				const int i = x - tile_x0;
+				Ray primaryRay(pass.camera_pos, vec3(dx[i], dy[i], dz[i]));
+				stats.primary_rays++;
+				// Take the first hit from the visibility buffer if there is
+				// one, and otherwise intersect ray with scene
+				bool hit = false;
+				if(rasterize && getVisibilityHit(visibility_buffers[v], x, y, primaryRay))
+				{
+					stats.rasterized_primaries++;
+					hit = true;
+				}
+				else
+				{
+					hit = intersect(primaryRay);
+				}
+				if(hit)
+				{
+					// If it hit something, evaluate the radiance from that point
+					//color = Li(primaryRay);
+					// Task 5
+					color = Li_pathtracer(primaryRay, pass.pixel_spread_angle);
+				}
+				else
+				{
+					// Otherwise evaluate environment
+					color = Lenvironment(primaryRay.d);
+				}
+				// Accumulate the obtained radiance and the sample count
+				vec4& pixel = image.data[y * image.width + x];
+				if(!pass.first_pass)
+				{
+					float deviation = luminance(color) - luminance(vec3(pixel) / pixel.w);
+					squared_deviation += deviation * deviation;
+				}
+				pixel = pass.first_pass ? vec4(color, 1.0f) : pixel + vec4(color, 1.0f);
 			}
-			// Accumulate the obtained radiance to the pixels color
-			float n = float(rendered_image.number_of_samples);
-			rendered_image.data[y * rendered_image.width + x] =
-			    rendered_image.data[y * rendered_image.width + x] * (n / (n + 1.0f))
-			    + (1.0f / (n + 1.0f)) * color;
 		}
+		image.dirty_tiles[image_tile] = 1;
+		stats.busy_ticks += timerTicks() - tile_start;
 	}
-	rendered_image.number_of_samples += 1;
+	for(const ViewPass& pass : passes)
+	{
+		pass.image->number_of_samples += 1;
+	}
+
+	std::chrono::duration<float, std::milli> pass_time = std::chrono::high_resolution_clock::now() - pass_start;
+	endGuidingPass(pass_time.count(), float(squared_deviation / double(number_of_pixels)));
+	updateRadianceCacheStats();
+	endStatsPass();
 }
 }; // namespace pathtracer
@@ -3,6 +3,7 @@
 #include <vector>
 #include <Model.h>
 #include <omp.h>
+#include <xmmintrin.h>
 #include "HDRImage.h"
 
 #ifdef M_PI
@@ -16,6 +17,11 @@ using namespace glm;
 
 namespace pathtracer
 {
+inline float luminance(const vec3& c)
+{
+	return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Path Tracer settings
 ///////////////////////////////////////////////////////////////////////////////
@@ -24,6 +30,13 @@ extern struct Settings
 	int subsampling;
 	int max_bounces;
 	int max_paths_per_pixel;
+	int light_samples;
+	// Find the first hit of camera rays with the CPU rasterizer (raster.h)
+	// instead of tracing them
+	bool rasterize_primary_visibility;
+	// Added to the sample number in the seeds of the random numbers, so
+	// that two renders of the same view can use different samples
+	uint32_t seed_offset;
 } settings;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -36,27 +49,79 @@ extern struct Environment
 } environment;
 
 ///////////////////////////////////////////////////////////////////////////
-// The rendered image
+// Minimal allocator that places vector storage on cache line boundaries
 ///////////////////////////////////////////////////////////////////////////
-extern struct Image
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator
 {
-	int width, height, number_of_samples = 0;
-	std::vector<glm::vec3> data;
-	float* getPtr()
+	typedef T value_type;
+	template<typename U>
+	struct rebind
+	{
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+	AlignedAllocator()
+	{
+	}
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+	{
+	}
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(_mm_malloc(n * sizeof(T), Alignment));
+	}
+	void deallocate(T* p, size_t)
+	{
+		_mm_free(p);
+	}
+	bool operator==(const AlignedAllocator&) const
 	{
-		return &data[0].x;
+		return true;
 	}
+	bool operator!=(const AlignedAllocator&) const
+	{
+		return false;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// An image being path traced. Each pixel holds the running sum of all radiance
+// samples in rgb and the number of samples in w. The image is normalized
+// only when it is read out through resolve().
+///////////////////////////////////////////////////////////////////////////
+extern struct Image
+{
+	int width, height, number_of_samples = 0;
+	std::vector<glm::vec4, AlignedAllocator<glm::vec4>> data;
+	// The image is traced in square tiles. A tile is flagged as dirty when
+	// it has received new samples, so that the display only needs to upload
+	// the parts of the image that actually changed.
+	static const int tile_size = 64;
+	int tiles_x = 0, tiles_y = 0;
+	std::vector<uint8_t> dirty_tiles;
+	// Write count normalized RGBA pixels, starting at pixel offset, to dst
+	void resolve(glm::vec4* dst, size_t offset, size_t count) const;
+	// Set the size and restart from zero samples
+	void resize(int w, int h);
 } rendered_image;
 
 ///////////////////////////////////////////////////////////////////////////////
-// The light source
+// The light sources. A light with a cone angle (measured from its
+// direction, in radians) below pi is a spot light, the falloff is the
+// angular width of the soft edge of the cone. Call buildLightTree() after
+// changing the list.
 ///////////////////////////////////////////////////////////////////////////////
-extern struct PointLight
+struct PointLight
 {
 	float intensity_multiplier;
 	vec3 color;
 	vec3 position;
-} point_light;
+	vec3 direction = vec3(0.0f, -1.0f, 0.0f);
+	float cone_angle = M_PI;
+	float cone_falloff = 0.0f;
+};
+extern std::vector<PointLight> lights;
 
 ///////////////////////////////////////////////////////////////////////////
 // Restart rendering of image
@@ -73,4 +138,16 @@ void resize(int w, int h);
 // Trace one path per pixel
 ///////////////////////////////////////////////////////////////////////////
 void tracePaths(const mat4& V, const mat4& P);
+
+///////////////////////////////////////////////////////////////////////////
+// Trace one path per pixel for several cameras at once. Each view renders
+// into its own image (set up with Image::resize()), and the views share
+// the photon pass and the thread pool.
+///////////////////////////////////////////////////////////////////////////
+struct RenderView
+{
+	mat4 V, P;
+	Image* image;
+};
+void tracePaths(const std::vector<RenderView>& views);
 }; // namespace pathtracer
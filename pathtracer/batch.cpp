@@ -0,0 +1,281 @@
+#include "batch.h"
+#include "Pathtracer.h"
+#include "stats.h"
+#include <stb_image_write.h>
+#include <glm/gtx/transform.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+bool loadCameraPath(const string& filename, vector<BatchCamera>& cameras)
+{
+	ifstream file(filename);
+	if(!file)
+	{
+		cout << "ERROR: loadCameraPath(): Could not open " << filename << "\n";
+		return false;
+	}
+	vector<BatchCamera> keys;
+	string line;
+	int line_number = 0;
+	while(getline(file, line))
+	{
+		line_number++;
+		line = line.substr(0, line.find('#'));
+		istringstream fields(line);
+		BatchCamera camera;
+		if(!(fields >> camera.frame))
+			continue;
+		fields >> camera.position.x >> camera.position.y >> camera.position.z;
+		fields >> camera.target.x >> camera.target.y >> camera.target.z;
+		if(!fields)
+		{
+			cout << "ERROR: loadCameraPath(): " << filename << ":" << line_number << ": expected "
+			     << "\"frame px py pz tx ty tz [fov_y]\"\n";
+			return false;
+		}
+		if(!(fields >> camera.fov_y))
+			camera.fov_y = 45.0f;
+		keys.push_back(camera);
+	}
+	sort(keys.begin(), keys.end(), [](const BatchCamera& a, const BatchCamera& b) { return a.frame < b.frame; });
+
+	cameras.clear();
+	for(size_t i = 0; i < keys.size(); i++)
+	{
+		cameras.push_back(keys[i]);
+		if(i + 1 == keys.size())
+			break;
+		const BatchCamera& a = keys[i];
+		const BatchCamera& b = keys[i + 1];
+		for(int frame = a.frame + 1; frame < b.frame; frame++)
+		{
+			const float t = float(frame - a.frame) / float(b.frame - a.frame);
+			BatchCamera camera;
+			camera.frame = frame;
+			camera.position = mix(a.position, b.position, t);
+			camera.target = mix(a.target, b.target, t);
+			camera.fov_y = mix(a.fov_y, b.fov_y, t);
+			cameras.push_back(camera);
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Writes finished images on its own thread, so that rendering does not
+// wait for compression and disk
+///////////////////////////////////////////////////////////////////////////
+struct WriteJob
+{
+	string filename;
+	int width, height;
+	// Normalized radiance, rows bottom to top as in Image
+	vector<vec3> pixels;
+};
+
+bool writeImage(const string& filename, int width, int height, const vector<vec3>& pixels, float exposure,
+                int tonemapper)
+{
+	const bool hdr = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".hdr") == 0;
+	// stb writes rows top to bottom
+	vector<float> flipped(pixels.size() * 3);
+	vector<uint8_t> ldr(pixels.size() * 3);
+	for(int y = 0; y < height; y++)
+	{
+		for(int x = 0; x < width; x++)
+		{
+			vec3 color = pixels[(height - 1 - y) * width + x];
+			const size_t i = (size_t(y) * width + x) * 3;
+			if(hdr)
+			{
+				flipped[i + 0] = color.r;
+				flipped[i + 1] = color.g;
+				flipped[i + 2] = color.b;
+				continue;
+			}
+			color *= exposure;
+			if(tonemapper == 1)
+			{
+				color = color / (vec3(1.0f) + color);
+			}
+			else if(tonemapper == 2)
+			{
+				color = (color * (2.51f * color + 0.03f)) / (color * (2.43f * color + 0.59f) + 0.14f);
+			}
+			color = clamp(color, vec3(0.0f), vec3(1.0f));
+			ldr[i + 0] = uint8_t(color.r * 255.0f + 0.5f);
+			ldr[i + 1] = uint8_t(color.g * 255.0f + 0.5f);
+			ldr[i + 2] = uint8_t(color.b * 255.0f + 0.5f);
+		}
+	}
+	if(hdr)
+		return stbi_write_hdr(filename.c_str(), width, height, 3, flipped.data()) != 0;
+	return stbi_write_png(filename.c_str(), width, height, 3, ldr.data(), width * 3) != 0;
+}
+
+// Put the frame number in place of the "%d" or "%04d" of the output
+// pattern. The pattern is not handed to printf, so any other '%' is kept
+// as it is, and "%%" gives one '%'.
+static string frameFilename(const string& pattern, int frame)
+{
+	string filename;
+	bool substituted = false;
+	for(size_t i = 0; i < pattern.size(); i++)
+	{
+		if(pattern[i] != '%')
+		{
+			filename += pattern[i];
+			continue;
+		}
+		if(i + 1 < pattern.size() && pattern[i + 1] == '%')
+		{
+			filename += '%';
+			i++;
+			continue;
+		}
+		size_t end = i + 1;
+		const bool zero_padded = end < pattern.size() && pattern[end] == '0';
+		if(zero_padded)
+			end++;
+		int width = 0;
+		while(end < pattern.size() && isdigit((unsigned char)pattern[end]) && width < 100)
+			width = width * 10 + (pattern[end++] - '0');
+		if(substituted || end >= pattern.size() || pattern[end] != 'd')
+		{
+			filename += pattern[i];
+			continue;
+		}
+		char number[128];
+		snprintf(number, sizeof(number), zero_padded ? "%0*d" : "%*d", width, frame);
+		filename += number;
+		substituted = true;
+		i = end;
+	}
+	return filename;
+}
+
+struct ImageWriter
+{
+	deque<WriteJob> queue;
+	mutex queue_mutex;
+	condition_variable queue_changed;
+	bool done = false;
+	int failed = 0;
+	thread worker;
+
+	void start(const BatchSettings& batch_settings)
+	{
+		worker = thread([this, batch_settings]() {
+			unique_lock<mutex> lock(queue_mutex);
+			while(true)
+			{
+				queue_changed.wait(lock, [this]() { return done || !queue.empty(); });
+				if(queue.empty())
+					return;
+				WriteJob job = std::move(queue.front());
+				queue.pop_front();
+				lock.unlock();
+				const bool ok = writeImage(job.filename, job.width, job.height, job.pixels, batch_settings.exposure,
+				                           batch_settings.tonemapper);
+				if(ok)
+					cout << "Wrote " << job.filename << "\n";
+				else
+					cout << "ERROR: renderBatch(): Could not write " << job.filename << "\n";
+				lock.lock();
+				failed += ok ? 0 : 1;
+			}
+		});
+	}
+	void push(WriteJob&& job)
+	{
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			queue.push_back(std::move(job));
+		}
+		queue_changed.notify_one();
+	}
+	// Write what is left in the queue and stop the thread
+	void finish()
+	{
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			done = true;
+		}
+		queue_changed.notify_one();
+		worker.join();
+	}
+};
+
+int renderBatch(const vector<BatchCamera>& cameras, const BatchSettings& batch_settings)
+{
+	if(cameras.empty())
+	{
+		cout << "ERROR: renderBatch(): No cameras to render\n";
+		return 1;
+	}
+	// The batch decides the number of passes itself
+	const int max_paths_per_pixel = settings.max_paths_per_pixel;
+	settings.max_paths_per_pixel = 0;
+	const int views_in_flight = std::max(1, batch_settings.views_in_flight);
+	const float aspect = float(batch_settings.width) / float(batch_settings.height);
+
+	ImageWriter writer;
+	writer.start(batch_settings);
+	vector<Image> images(std::min(views_in_flight, int(cameras.size())));
+	auto batch_start = chrono::high_resolution_clock::now();
+	for(size_t first = 0; first < cameras.size(); first += views_in_flight)
+	{
+		const size_t count = std::min(size_t(views_in_flight), cameras.size() - first);
+		vector<RenderView> views(count);
+		for(size_t i = 0; i < count; i++)
+		{
+			const BatchCamera& camera = cameras[first + i];
+			images[i].resize(batch_settings.width, batch_settings.height);
+			views[i].V = lookAt(camera.position, camera.target, vec3(0.0f, 1.0f, 0.0f));
+			views[i].P = perspective(radians(camera.fov_y), aspect, 0.1f, 100.0f);
+			views[i].image = &images[i];
+		}
+		// Each group starts over with the progressive caustics
+		restart();
+		for(int pass = 0; pass < batch_settings.samples; pass++)
+		{
+			tracePaths(views);
+		}
+
+		for(size_t i = 0; i < count; i++)
+		{
+			const Image& image = images[i];
+			WriteJob job;
+			job.filename = frameFilename(batch_settings.output_pattern, cameras[first + i].frame);
+			job.width = image.width;
+			job.height = image.height;
+			job.pixels.resize(image.data.size());
+			for(size_t p = 0; p < image.data.size(); p++)
+				job.pixels[p] = vec3(image.data[p]) / std::max(image.data[p].w, 1.0f);
+			writer.push(std::move(job));
+		}
+		cout << "Rendered " << first + count << " of " << cameras.size() << " cameras, last pass "
+		     << pass_stats.pass_ms << " ms\n";
+	}
+	writer.finish();
+	settings.max_paths_per_pixel = max_paths_per_pixel;
+
+	chrono::duration<float> batch_time = chrono::high_resolution_clock::now() - batch_start;
+	cout << "Batch of " << cameras.size() << " cameras done in " << batch_time.count() << " s\n";
+	return writer.failed > 0 ? 1 : 0;
+}
+} // namespace pathtracer
@@ -0,0 +1,62 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Batch rendering of many views of one scene. The scene, BVH, lights and
+// environment are set up once by the caller and shared by all cameras.
+// Cameras are rendered in groups: each pass of tracePaths() adds one
+// sample per pixel to every view of the group, so the views share the
+// photon pass and keep all threads busy. Finished images are written on a
+// background thread while the next group renders.
+///////////////////////////////////////////////////////////////////////////
+struct BatchCamera
+{
+	int frame;
+	glm::vec3 position;
+	glm::vec3 target;
+	// Vertical field of view, in degrees
+	float fov_y;
+};
+
+struct BatchSettings
+{
+	int width = 640, height = 360;
+	int samples = 256;
+	// Number of cameras rendered at the same time. 1 renders them back to
+	// back, each with the whole thread pool.
+	int views_in_flight = 4;
+	// The first "%d" or "%0<digits>d" is replaced by the frame number, e.g.
+	// "frame_%04d.png". The extension picks the format: .png is tonemapped
+	// like the window, .hdr keeps the linear radiance.
+	std::string output_pattern = "frame_%04d.png";
+	float exposure = 1.0f;
+	// 0: clamp, 1: Reinhard, 2: filmic, as in simple.frag
+	int tonemapper = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Read a camera path. Each line holds "frame px py pz tx ty tz [fov_y]",
+// and '#' starts a comment. Frames missing between two listed frames are
+// interpolated, so a path can be given as keyframes. Returns false if the
+// file can not be read.
+///////////////////////////////////////////////////////////////////////////
+bool loadCameraPath(const std::string& filename, std::vector<BatchCamera>& cameras);
+
+///////////////////////////////////////////////////////////////////////////
+// Write normalized radiance (rows bottom to top, as in Image) to a .png,
+// tonemapped as in simple.frag, or to a .hdr as is. Returns false if the
+// file could not be written.
+///////////////////////////////////////////////////////////////////////////
+bool writeImage(const std::string& filename, int width, int height, const std::vector<glm::vec3>& pixels,
+                float exposure, int tonemapper);
+
+///////////////////////////////////////////////////////////////////////////
+// Render all cameras with the current scene and settings. Returns the
+// exit code for main().
+///////////////////////////////////////////////////////////////////////////
+int renderBatch(const std::vector<BatchCamera>& cameras, const BatchSettings& batch_settings);
+} // namespace pathtracer
@@ -0,0 +1,516 @@
+#include "benchmark.h"
+#include "Pathtracer.h"
+#include "embree.h"
+#include "lights.h"
+#include "guiding.h"
+#include "radiancecache.h"
+#include "photonmap.h"
+#include "stats.h"
+#include "kernels.h"
+#include "sampling.h"
+#include "raster.h"
+#include <Model.h>
+#include <glm/gtx/transform.hpp>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// The fixed benchmark setup
+///////////////////////////////////////////////////////////////////////////
+struct BenchmarkScene
+{
+	string name;
+	vector<pair<string, mat4>> models;
+	vec3 camera_position;
+	vec3 camera_target;
+	// Set for every scene, whatever the window was left at. The images of
+	// guiding and the radiance cache depend on the order the threads run
+	// in, so the image hash only repeats with both off.
+	bool guiding;
+	bool radiance_cache;
+	bool caustics;
+};
+
+static const int BENCHMARK_WIDTH = 640;
+static const int BENCHMARK_HEIGHT = 360;
+static const int BENCHMARK_MAX_BOUNCES = 8;
+static const int REFERENCE_PASSES = 1024;
+// The reference takes its samples from further down the sequence, so that
+// the timed run is not compared against its own first samples
+static const uint32_t REFERENCE_SEED_OFFSET = 1u << 24;
+static const int MAX_PASSES = 256;
+static const float TARGET_RMSE = 0.02f;
+static const int VISIBILITY_REPEATS = 10;
+
+static vector<BenchmarkScene> benchmarkScenes()
+{
+	const vec3 default_position(-30.0f, 10.0f, 30.0f), default_target(0.0f, 10.0f, 0.0f);
+	vector<BenchmarkScene> scenes;
+	scenes.push_back({ "tetra_balls",
+	                   { { "../scenes/tetra_balls.obj", translate(vec3(10.0f, 0.0f, 0.0f)) } },
+	                   vec3(-30.0f, 5.0f, 0.0f),
+	                   vec3(1.0f, 5.0f, 1.0f),
+	                   false,
+	                   false,
+	                   false });
+	scenes.push_back({ "ship",
+	                   { { "../scenes/NewShip.obj", translate(vec3(0.0f, 10.0f, 0.0f)) },
+	                     { "../scenes/landingpad2.obj", mat4(1.0f) } },
+	                   default_position,
+	                   default_target,
+	                   false,
+	                   false,
+	                   false });
+	scenes.push_back({ "bigsphere",
+	                   { { "../scenes/BigSphere.obj", mat4(1.0f) } },
+	                   default_position,
+	                   default_target,
+	                   false,
+	                   false,
+	                   false });
+	scenes.push_back({ "wheatley",
+	                   { { "../scenes/wheatley.obj", mat4(1.0f) } },
+	                   vec3(-12.0f, 4.0f, 12.0f),
+	                   vec3(0.0f),
+	                   false,
+	                   false,
+	                   false });
+	return scenes;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Peak resident memory of the process, in bytes
+///////////////////////////////////////////////////////////////////////////
+static size_t peakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return size_t(usage.ru_maxrss) * 1024; // ru_maxrss is in kilobytes
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+// References are stored as PFM (rgb float, rows bottom to top, which is
+// also the row order of rendered_image)
+///////////////////////////////////////////////////////////////////////////
+static bool writePFM(const string& filename, int width, int height, const vector<vec3>& pixels)
+{
+	ofstream file(filename, ios::binary);
+	if(!file)
+		return false;
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	file.write((const char*)&pixels[0].x, pixels.size() * sizeof(vec3));
+	return bool(file);
+}
+
+static bool readPFM(const string& filename, int width, int height, vector<vec3>& pixels)
+{
+	ifstream file(filename, ios::binary);
+	if(!file)
+		return false;
+	string magic;
+	int w, h;
+	float scale;
+	file >> magic >> w >> h >> scale;
+	file.get();
+	if(magic != "PF" || w != width || h != height || scale >= 0.0f)
+	{
+		cout << "Benchmark: ignoring reference " << filename << " (wrong format or size)\n";
+		return false;
+	}
+	pixels.resize(size_t(width) * height);
+	file.read((char*)&pixels[0].x, pixels.size() * sizeof(vec3));
+	return bool(file);
+}
+
+static void resolveImage(vector<vec3>& pixels)
+{
+	pixels.resize(rendered_image.data.size());
+	for(size_t i = 0; i < pixels.size(); i++)
+		pixels[i] = vec3(rendered_image.data[i]) / std::max(rendered_image.data[i].w, 1.0f);
+}
+
+static float rmse(const vector<vec3>& a, const vector<vec3>& b)
+{
+	double sum = 0.0;
+	for(size_t i = 0; i < a.size(); i++)
+	{
+		vec3 d = a[i] - b[i];
+		sum += double(dot(d, d)) / 3.0;
+	}
+	return float(sqrt(sum / double(a.size())));
+}
+
+// FNV-1a over the raw accumulated image, to compare runs bit by bit
+static uint64_t imageHash()
+{
+	uint64_t hash = 14695981039346656037ull;
+	const uint8_t* bytes = (const uint8_t*)rendered_image.data.data();
+	for(size_t i = 0; i < rendered_image.data.size() * sizeof(vec4); i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Time primary visibility for a view, traced through the BVH and
+// rasterized, and count the pixels where the two find different triangles
+///////////////////////////////////////////////////////////////////////////
+static void benchmarkPrimaryVisibility(const string& name, const mat4& V, const mat4& P)
+{
+	const int width = BENCHMARK_WIDTH, height = BENCHMARK_HEIGHT;
+	const mat4 inverse_view_projection = inverse(P * V);
+	const vec3 camera_pos = vec3(inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	const vec2 jitter(0.5f);
+	vector<uint64_t> traced(size_t(width) * height);
+	VisibilityBuffer visibility;
+
+	auto trace = [&]() {
+		#pragma omp parallel for schedule(dynamic)
+		for(int y = 0; y < height; y++)
+		{
+			float sx[BENCHMARK_WIDTH], sy[BENCHMARK_WIDTH];
+			float dx[BENCHMARK_WIDTH], dy[BENCHMARK_WIDTH], dz[BENCHMARK_WIDTH];
+			for(int x = 0; x < width; x++)
+			{
+				sx[x] = (float(x) + jitter.x) / float(width);
+				sy[x] = (float(y) + jitter.y) / float(height);
+			}
+			simd::generateCameraRays(&inverse_view_projection[0][0], &camera_pos.x, sx, sy, dx, dy, dz, width);
+			for(int x = 0; x < width; x++)
+			{
+				Ray ray(camera_pos, vec3(dx[x], dy[x], dz[x]));
+				intersect(ray);
+				traced[y * width + x] = (uint64_t(ray.geomID) << 32) | ray.primID;
+			}
+		}
+	};
+	auto rasterize = [&]() { rasterizeVisibility(V, P, width, height, jitter, visibility); };
+
+	// The first call of each also copies the scene, or warms the caches
+	trace();
+	rasterize();
+	auto start = chrono::high_resolution_clock::now();
+	for(int i = 0; i < VISIBILITY_REPEATS; i++)
+		trace();
+	const double traced_ms =
+	    chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() / VISIBILITY_REPEATS;
+	start = chrono::high_resolution_clock::now();
+	for(int i = 0; i < VISIBILITY_REPEATS; i++)
+		rasterize();
+	const double rasterized_ms =
+	    chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() / VISIBILITY_REPEATS;
+
+	size_t different = 0;
+	for(size_t i = 0; i < traced.size(); i++)
+	{
+		const VisibilitySample& s = visibility.samples[i];
+		const uint32_t primID = s.geomID == RTC_INVALID_GEOMETRY_ID ? RTC_INVALID_GEOMETRY_ID : s.primID;
+		if(((uint64_t(s.geomID) << 32) | primID) != traced[i])
+			different++;
+	}
+	printf("%-12s primary visibility: traced %.2f ms, rasterized %.2f ms (%.2fx), %.3f%% of pixels differ\n",
+	       name.c_str(), traced_ms, rasterized_ms, traced_ms / rasterized_ms,
+	       100.0 * double(different) / double(traced.size()));
+}
+
+int runBenchmark(const string& reference_directory)
+{
+	settings.subsampling = 1;
+	settings.max_bounces = BENCHMARK_MAX_BOUNCES;
+	settings.max_paths_per_pixel = 0;
+	settings.light_samples = 1;
+	settings.rasterize_primary_visibility = false;
+	environment.map.load("../scenes/envmaps/001.hdr");
+	environment.multiplier = 1.0f;
+	lights.clear();
+	PointLight point_light;
+	point_light.intensity_multiplier = 2500.0f;
+	point_light.color = vec3(1.0f);
+	point_light.position = vec3(10.0f, 40.0f, 10.0f);
+	lights.push_back(point_light);
+	buildLightTree();
+
+	int result = 0;
+	printf("%-12s %10s %12s %10s %12s %18s\n", "scene", "Mrays/s", "time to RMSE", "passes", "final RMSE",
+	       "image hash");
+	for(const BenchmarkScene& scene : benchmarkScenes())
+	{
+		bool missing = false;
+		for(auto& m : scene.models)
+			missing |= !ifstream(m.first).good();
+		if(missing)
+		{
+			printf("%-12s skipped, model files not found\n", scene.name.c_str());
+			result = 1;
+			continue;
+		}
+
+		vector<labhelper::Model*> models;
+		clearScene();
+		for(auto& m : scene.models)
+		{
+			models.push_back(labhelper::loadModelFromOBJ(m.first));
+			addModel(models.back(), m.second);
+		}
+		buildBVH();
+		guiding_settings.enabled = scene.guiding;
+		radiance_cache_settings.enabled = scene.radiance_cache;
+		caustic_settings.enabled = scene.caustics;
+		resetGuiding();
+		resetRadianceCache();
+
+		mat4 V = lookAt(scene.camera_position, scene.camera_target, vec3(0.0f, 1.0f, 0.0f));
+		mat4 P = perspective(radians(45.0f), float(BENCHMARK_WIDTH) / float(BENCHMARK_HEIGHT), 0.1f, 100.0f);
+		resize(BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+
+		// Get or render the reference
+		vector<vec3> reference, current;
+		const string reference_file = reference_directory + "/benchmark_" + scene.name + ".pfm";
+		if(!readPFM(reference_file, BENCHMARK_WIDTH, BENCHMARK_HEIGHT, reference))
+		{
+			cout << "Benchmark: rendering reference for " << scene.name << " (" << REFERENCE_PASSES
+			     << " passes)..." << flush;
+			restart();
+			settings.seed_offset = REFERENCE_SEED_OFFSET;
+			for(int pass = 0; pass < REFERENCE_PASSES; pass++)
+				tracePaths(V, P);
+			settings.seed_offset = 0;
+			resolveImage(reference);
+			if(!writePFM(reference_file, BENCHMARK_WIDTH, BENCHMARK_HEIGHT, reference))
+			{
+				cout << " could not write " << reference_file;
+				result = 1;
+			}
+			cout << " done.\n";
+		}
+
+		// Timed run, without what was learned from the reference
+		resetGuiding();
+		resetRadianceCache();
+		restart();
+		double total_ms = 0.0, rays = 0.0, time_to_rmse = -1.0;
+		float error = 0.0f;
+		int passes = 0;
+		while(passes < MAX_PASSES)
+		{
+			tracePaths(V, P);
+			passes++;
+			total_ms += pass_stats.pass_ms;
+			rays += double(pass_stats.primary_rays + pass_stats.bounce_rays + pass_stats.shadow_rays
+			               + pass_stats.photon_rays);
+			resolveImage(current);
+			error = rmse(current, reference);
+			if(error <= TARGET_RMSE)
+			{
+				time_to_rmse = total_ms;
+				break;
+			}
+		}
+		char time_text[32];
+		if(time_to_rmse >= 0.0)
+			snprintf(time_text, sizeof(time_text), "%.0f ms", time_to_rmse);
+		else
+		{
+			snprintf(time_text, sizeof(time_text), "not reached");
+			result = 1;
+		}
+		printf("%-12s %10.2f %12s %10d %12.4f %18llx\n", scene.name.c_str(), rays / (total_ms * 1000.0), time_text,
+		       passes, error, (unsigned long long)imageHash());
+		benchmarkPrimaryVisibility(scene.name, V, P);
+
+		for(auto model : models)
+			labhelper::freeModel(model);
+	}
+	clearScene();
+	printf("Peak memory: %.1f MB\n", double(peakMemory()) / (1024.0 * 1024.0));
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////
+// Microbenchmark of the SIMD kernels
+///////////////////////////////////////////////////////////////////////////
+static const int MICRO_COUNT = 1 << 20;
+static const int MICRO_REPEATS = 20;
+
+static double timeNs(const function<void()>& f)
+{
+	f(); // Warm up
+	auto start = chrono::high_resolution_clock::now();
+	for(int i = 0; i < MICRO_REPEATS; i++)
+		f();
+	chrono::duration<double, nano> duration = chrono::high_resolution_clock::now() - start;
+	return duration.count() / (double(MICRO_REPEATS) * MICRO_COUNT);
+}
+
+static float maxDifference(const vector<float>& a, const vector<float>& b)
+{
+	float d = 0.0f;
+	for(size_t i = 0; i < a.size(); i++)
+		d = std::max(d, std::abs(a[i] - b[i]));
+	return d;
+}
+
+static void report(const char* name, double scalar_ns, double simd_ns, float error)
+{
+	printf("%-24s %10.2f %10.2f %8.2fx %12.3g\n", name, scalar_ns, simd_ns, scalar_ns / simd_ns, error);
+}
+
+int runMicrobenchmark()
+{
+	const int n = MICRO_COUNT;
+	vector<float> u1(n), u2(n), x(n), y(n), z(n);
+	vector<float> s0(n), s1(n), s2(n), v0(n), v1(n), v2(n), v3(n), v4(n), v5(n);
+	seedRandom(0, 0, RANDOM_STREAM_CAMERA);
+	for(int i = 0; i < n; i++)
+	{
+		u1[i] = randf();
+		u2[i] = randf();
+		vec3 d = normalize(vec3(randf(), randf(), randf()) * 2.0f - 1.0f + vec3(1e-6f));
+		x[i] = d.x;
+		y[i] = d.y;
+		z[i] = d.z;
+	}
+
+	printf("Using the %s kernels (%d wide)\n", simd::isa(), simd::width());
+	printf("%-24s %10s %10s %9s %12s\n", "kernel", "scalar ns", "simd ns", "speedup", "max diff");
+
+	// The disk kernel uses the two region form of the concentric mapping,
+	// which gives the same points as the four region form in sampling.cpp
+	double scalar = timeNs([&]() {
+		for(int i = 0; i < n; i++)
+		{
+			float a = 2.0f * u1[i] - 1.0f, b = 2.0f * u2[i] - 1.0f;
+			float r, phi;
+			if(std::abs(a) > std::abs(b))
+			{
+				r = a;
+				phi = float(M_PI) / 4.0f * (b / a);
+			}
+			else
+			{
+				r = b;
+				phi = float(M_PI) / 2.0f - float(M_PI) / 4.0f * (a / (b != 0.0f ? b : 1.0f));
+			}
+			s0[i] = r * cos(phi);
+			s1[i] = r * sin(phi);
+		}
+	});
+	double simd = timeNs([&]() { simd::concentricSampleDisk(&u1[0], &u2[0], &v0[0], &v1[0], n); });
+	report("concentricSampleDisk", scalar, simd, std::max(maxDifference(s0, v0), maxDifference(s1, v1)));
+
+	scalar = timeNs([&]() {
+		for(int i = 0; i < n; i++)
+		{
+			float r = sqrt(u1[i]), phi = 2.0f * float(M_PI) * u2[i];
+			s0[i] = r * cos(phi);
+			s1[i] = r * sin(phi);
+			s2[i] = sqrt(std::max(0.0f, 1.0f - u1[i]));
+		}
+	});
+	simd = timeNs([&]() { simd::cosineSampleHemisphere(&u1[0], &u2[0], &v0[0], &v1[0], &v2[0], n); });
+	// The scalar code uses the polar mapping, report how far from unit
+	// length the SIMD directions are
+	float error = 0.0f;
+	for(int i = 0; i < n; i++)
+		error = std::max(error, std::abs(v0[i] * v0[i] + v1[i] * v1[i] + v2[i] * v2[i] - 1.0f));
+	report("cosineSampleHemisphere", scalar, simd, error);
+
+	scalar = timeNs([&]() {
+		for(int i = 0; i < n; i++)
+		{
+			vec3 normal(x[i], y[i], z[i]);
+			vec3 tangent = normalize(perpendicular(normal));
+			vec3 bitangent = normalize(cross(tangent, normal));
+			s0[i] = tangent.x + bitangent.x;
+			s1[i] = tangent.y + bitangent.y;
+			s2[i] = tangent.z + bitangent.z;
+		}
+	});
+	simd = timeNs([&]() {
+		simd::orthonormalBasis(&x[0], &y[0], &z[0], &v0[0], &v1[0], &v2[0], &v3[0], &v4[0], &v5[0], n);
+	});
+	// Different (but equally valid) bases, report the orthonormality error
+	error = 0.0f;
+	for(int i = 0; i < n; i++)
+	{
+		vec3 normal(x[i], y[i], z[i]), t(v0[i], v1[i], v2[i]), b(v3[i], v4[i], v5[i]);
+		error = std::max(error, std::max(std::abs(dot(t, normal)), std::abs(dot(b, normal))));
+		error = std::max(error, std::max(std::abs(dot(t, b)), std::abs(dot(t, t) - 1.0f)));
+	}
+	report("orthonormalBasis", scalar, simd, error);
+
+	scalar = timeNs([&]() {
+		for(int i = 0; i < n; i++)
+			s0[i] = u1[i] + (1.0f - u1[i]) * pow(1.0f - u2[i], 5.0f);
+	});
+	simd = timeNs([&]() { simd::schlickFresnel(&u1[0], &u2[0], &v0[0], n); });
+	report("schlickFresnel", scalar, simd, maxDifference(s0, v0));
+
+	// Shininess up to 25000 as in the material editor, cosines near 1
+	for(int i = 0; i < n; i++)
+	{
+		x[i] = 1.0f + 25000.0f * u1[i] * u1[i];
+		y[i] = 1.0f - 0.01f * u2[i];
+	}
+	scalar = timeNs([&]() {
+		for(int i = 0; i < n; i++)
+		{
+			float n_wh = y[i], n_wo = u1[i], n_wi = u2[i], wo_wh = u2[i];
+			s0[i] = ((x[i] + 2.0f) / (2.0f * float(M_PI))) * pow(std::max(0.0f, n_wh), x[i]);
+			s1[i] = std::min(1.0f, std::min(2.0f * std::max(0.00001f, n_wh * n_wo) / std::max(0.00001f, wo_wh),
+			                                2.0f * std::max(0.00001f, n_wh * n_wi) / std::max(0.00001f, wo_wh)));
+		}
+	});
+	simd = timeNs([&]() { simd::blinnPhongDG(&x[0], &y[0], &u1[0], &u2[0], &u2[0], &v0[0], &v1[0], n); });
+	error = 0.0f;
+	for(int i = 0; i < n; i++)
+		if(s0[i] > 1e-20f)
+			error = std::max(error, std::abs(s0[i] - v0[i]) / s0[i]);
+	report("blinnPhongDG (D rel.)", scalar, simd, error);
+
+	for(int i = 0; i < n; i++)
+	{
+		vec3 d = normalize(vec3(u1[i], u2[i], u1[(i + 1) % n]) * 2.0f - 1.0f + vec3(1e-6f));
+		x[i] = d.x;
+		y[i] = d.y;
+		z[i] = d.z;
+	}
+	scalar = timeNs([&]() {
+		for(int i = 0; i < n; i++)
+		{
+			float theta = acos(std::max(-1.0f, std::min(1.0f, y[i])));
+			float phi = atan2(z[i], x[i]);
+			if(phi < 0.0f)
+				phi += 2.0f * float(M_PI);
+			s0[i] = phi / (2.0f * float(M_PI));
+			s1[i] = theta / float(M_PI);
+		}
+	});
+	simd = timeNs([&]() { simd::equirectangular(&x[0], &y[0], &z[0], &v0[0], &v1[0], n); });
+	report("equirectangular", scalar, simd, std::max(maxDifference(s0, v0), maxDifference(s1, v1)));
+	return 0;
+}
+} // namespace pathtracer
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Render the benchmark scenes at fixed settings and report Mrays/s, the
+// time needed to reach a target RMSE against a stored reference image,
+// and the peak memory use of the process. References are read from
+// 'reference_directory'/benchmark_<scene>.pfm, and are rendered (and
+// written) if they are missing. For each scene, primary visibility is
+// also timed traced and rasterized (raster.h).
+// Needs no GL context, as long as labhelper::loader_settings.upload_to_gpu
+// is off. Returns the exit code for main(), which is 1 if the models of a
+// scene are missing, a reference can not be written, or a scene does not
+// get within the target RMSE of its reference.
+///////////////////////////////////////////////////////////////////////////
+int runBenchmark(const std::string& reference_directory);
+
+///////////////////////////////////////////////////////////////////////////
+// Time the batched SIMD kernels against the scalar code they replace and
+// print the speedup and the largest difference for each. Needs no GL.
+///////////////////////////////////////////////////////////////////////////
+int runMicrobenchmark();
+} // namespace pathtracer
@@ -1,6 +1,10 @@
 #include "embree.h"
+#include "texture.h"
+#include "stats.h"
+#include "TextureLoader.h"
 #include <iostream>
 #include <map>
+#include <cstring>
 
 
 using namespace std;
@@ -12,7 +16,8 @@ namespace pathtracer
 // Global variables
 ///////////////////////////////////////////////////////////////////////////
 RTCDevice embree_device;
-RTCScene embree_scene;
+RTCScene embree_scene = nullptr;
+static uint32_t scene_version = 0;
 
 ///////////////////////////////////////////////////////////////////////////
 // Build an acceleration structure for the scene
@@ -21,9 +26,26 @@ void buildBVH()
 {
 	cout << "Embree building BVH..." << flush;
 	rtcCommit(embree_scene);
+	scene_version++;
 	cout << "done.\n";
 }
 
+uint32_t getSceneVersion()
+{
+	return scene_version;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Get the bounding box of the whole scene
+///////////////////////////////////////////////////////////////////////////
+void getSceneBounds(vec3& bbox_min, vec3& bbox_max)
+{
+	RTCBounds bounds;
+	rtcGetBounds(embree_scene, bounds);
+	bbox_min = vec3(bounds.lower_x, bounds.lower_y, bounds.lower_z);
+	bbox_max = vec3(bounds.upper_x, bounds.upper_y, bounds.upper_z);
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Called when there is an embree error
 ///////////////////////////////////////////////////////////////////////////
@@ -38,6 +60,76 @@ void embreeErrorHandler(const RTCError code, const char* str)
 ///////////////////////////////////////////////////////////////////////////
 map<uint32_t, const labhelper::Model*> map_geom_ID_to_model;
 map<uint32_t, const labhelper::Mesh*> map_geom_ID_to_mesh;
+map<uint32_t, mat4> map_geom_ID_to_transform;
+
+// The model vertices of a triangle, as indices into Model::m_positions etc.
+static inline void triangleVertices(const labhelper::Model* model, const labhelper::Mesh* mesh, uint32_t primID,
+                                    uint32_t v[3])
+{
+	const uint32_t* indices = &model->m_indices[mesh->m_start_index + primID * 3];
+	v[0] = mesh->m_base_vertex + indices[0];
+	v[1] = mesh->m_base_vertex + indices[1];
+	v[2] = mesh->m_base_vertex + indices[2];
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Alpha testing. The filter gets the mesh of the hit as user data, finds
+// the texture coordinates of the hit and rejects it if the texel is
+// transparent.
+///////////////////////////////////////////////////////////////////////////
+struct AlphaTestMesh
+{
+	const labhelper::Model* model;
+	const labhelper::Mesh* mesh;
+};
+map<uint32_t, AlphaTestMesh> map_geom_ID_to_alpha_test;
+static const float ALPHA_CUTOFF = 0.5f;
+
+static void alphaTestFilter(void* user_data, RTCRay& ray)
+{
+	const AlphaTestMesh& a = *(const AlphaTestMesh*)user_data;
+	uint32_t v[3];
+	triangleVertices(a.model, a.mesh, ray.primID, v);
+	const vec2* uvs = a.model->m_texture_coordinates.data();
+	const vec2 uv = (1.0f - ray.u - ray.v) * uvs[v[0]] + ray.u * uvs[v[1]] + ray.v * uvs[v[2]];
+	if(sampleAlpha(&a.model->m_materials[a.mesh->m_material_idx], uv) < ALPHA_CUTOFF)
+		ray.geomID = RTC_INVALID_GEOMETRY_ID;
+}
+
+static uint32_t geometryMask(const labhelper::Material& material)
+{
+	return material.m_casts_shadows ? RAY_MASK_CAMERA | RAY_MASK_LIGHT : RAY_MASK_CAMERA;
+}
+
+// Masks and filters only work if embree was built with them, warn once
+// if a scene needs a feature the library does not have
+static void checkEmbreeFeature(RTCParameter feature, const char* cmake_option)
+{
+	static map<int, bool> warned;
+	if(rtcDeviceGetParameter1i(embree_device, feature) == 0 && !warned[feature])
+	{
+		warned[feature] = true;
+		cout << "WARNING: embree was built without " << cmake_option << ", the scene will not render as intended\n";
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Remove all models from the scene. The device is kept, and a new empty
+// scene is created for the following addModel() calls.
+///////////////////////////////////////////////////////////////////////////
+void clearScene()
+{
+	if(embree_scene != nullptr)
+	{
+		rtcDeleteScene(embree_scene);
+		embree_scene = rtcDeviceNewScene(embree_device, RTC_SCENE_STATIC, RTC_INTERSECT1);
+	}
+	map_geom_ID_to_model.clear();
+	map_geom_ID_to_mesh.clear();
+	map_geom_ID_to_transform.clear();
+	map_geom_ID_to_alpha_test.clear();
+	clearMaterialTextures();
+}
 
 ///////////////////////////////////////////////////////////////////////////
 // Add a model to the embree scene
@@ -64,30 +156,126 @@ void addModel(const labhelper::Model* model, const mat4& model_matrix)
 	// Material.
 	///////////////////////////////////////////////////////////////////////
 	cout << "Adding " << model->m_name << " to embree scene..." << flush;
+	// The alpha test needs the CPU textures
+	labhelper::finishTextureLoads();
+	addMaterialTextures(model);
 	for(auto& mesh : model->m_meshes)
 	{
 		uint32_t geom_ID = rtcNewTriangleMesh(embree_scene, RTC_GEOMETRY_STATIC,
-		                                      mesh.m_number_of_vertices / 3, mesh.m_number_of_vertices);
+		                                      mesh.m_number_of_indices / 3, mesh.m_number_of_vertices);
 		map_geom_ID_to_mesh[geom_ID] = &mesh;
 		map_geom_ID_to_model[geom_ID] = model;
+		map_geom_ID_to_transform[geom_ID] = model_matrix;
 		// Transform and commit vertices
 		vec4* embree_vertices = (vec4*)rtcMapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
 		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
 		{
-			embree_vertices[i] = model_matrix * vec4(model->m_positions[mesh.m_start_index + i], 1.0f);
+			embree_vertices[i] = model_matrix * vec4(model->m_positions[mesh.m_base_vertex + i], 1.0f);
 		}
 		rtcUnmapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
 		// Commit triangle indices
-		int* embree_tri_idxs = (int*)rtcMapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
-		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		uint32_t* embree_tri_idxs = (uint32_t*)rtcMapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
+		memcpy(embree_tri_idxs, &model->m_indices[mesh.m_start_index], mesh.m_number_of_indices * sizeof(uint32_t));
+		rtcUnmapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
+		// Ray mask and alpha test from the material
+		const labhelper::Material& material = model->m_materials[mesh.m_material_idx];
+		if(!material.m_casts_shadows)
+			checkEmbreeFeature(RTC_CONFIG_RAY_MASK, "EMBREE_RAY_MASK");
+		rtcSetMask(embree_scene, geom_ID, geometryMask(material));
+		if(hasAlphaTest(&material))
 		{
-			embree_tri_idxs[i] = i;
+			checkEmbreeFeature(RTC_CONFIG_INTERSECTION_FILTER, "EMBREE_FILTER_FUNCTION");
+			AlphaTestMesh& alpha_test = map_geom_ID_to_alpha_test[geom_ID];
+			alpha_test.model = model;
+			alpha_test.mesh = &mesh;
+			rtcSetUserData(embree_scene, geom_ID, &alpha_test);
+			rtcSetIntersectionFilterFunction(embree_scene, geom_ID, alphaTestFilter);
+			rtcSetOcclusionFilterFunction(embree_scene, geom_ID, alphaTestFilter);
 		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
 	}
 	cout << "done.\n";
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Set the ray masks from the current materials. The geometries of a
+// committed static scene cannot be changed, so the scene is built again,
+// and addModel() takes the masks from the materials.
+///////////////////////////////////////////////////////////////////////////
+void updateGeometryMasks()
+{
+	// The models in the order they were added. Each addModel() call gives
+	// its meshes consecutive geometry IDs.
+	vector<pair<const labhelper::Model*, mat4>> models;
+	for(auto& entry : map_geom_ID_to_model)
+	{
+		const mat4& transform = map_geom_ID_to_transform[entry.first];
+		if(models.empty() || models.back().first != entry.second || models.back().second != transform)
+			models.push_back(make_pair(entry.second, transform));
+	}
+	clearScene();
+	for(auto& m : models)
+		addModel(m.first, m.second);
+	buildBVH();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Collect the triangles of all meshes that currently have an emissive
+// material, transformed to world space.
+///////////////////////////////////////////////////////////////////////////
+void getEmissiveTriangles(vector<EmissiveTriangle>& triangles)
+{
+	triangles.clear();
+	for(auto& entry : map_geom_ID_to_mesh)
+	{
+		const labhelper::Mesh* mesh = entry.second;
+		const labhelper::Model* model = map_geom_ID_to_model[entry.first];
+		const labhelper::Material* material = &model->m_materials[mesh->m_material_idx];
+		if(material->m_emission <= 0.0f)
+			continue;
+		const mat4& model_matrix = map_geom_ID_to_transform[entry.first];
+		for(uint32_t t = 0; t < mesh->m_number_of_indices / 3; t++)
+		{
+			uint32_t v[3];
+			triangleVertices(model, mesh, t, v);
+			EmissiveTriangle triangle;
+			triangle.v0 = vec3(model_matrix * vec4(model->m_positions[v[0]], 1.0f));
+			triangle.v1 = vec3(model_matrix * vec4(model->m_positions[v[1]], 1.0f));
+			triangle.v2 = vec3(model_matrix * vec4(model->m_positions[v[2]], 1.0f));
+			triangle.material = material;
+			triangles.push_back(triangle);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Collect all triangles of the scene, transformed to world space the same
+// way as the vertices handed to embree.
+///////////////////////////////////////////////////////////////////////////
+void getSceneTriangles(vector<SceneTriangle>& triangles)
+{
+	triangles.clear();
+	for(auto& entry : map_geom_ID_to_mesh)
+	{
+		const labhelper::Mesh* mesh = entry.second;
+		const labhelper::Model* model = map_geom_ID_to_model[entry.first];
+		const mat4& model_matrix = map_geom_ID_to_transform[entry.first];
+		const bool alpha_tested = map_geom_ID_to_alpha_test.count(entry.first) != 0;
+		for(uint32_t t = 0; t < mesh->m_number_of_indices / 3; t++)
+		{
+			uint32_t v[3];
+			triangleVertices(model, mesh, t, v);
+			SceneTriangle triangle;
+			triangle.v0 = vec3(model_matrix * vec4(model->m_positions[v[0]], 1.0f));
+			triangle.v1 = vec3(model_matrix * vec4(model->m_positions[v[1]], 1.0f));
+			triangle.v2 = vec3(model_matrix * vec4(model->m_positions[v[2]], 1.0f));
+			triangle.geomID = entry.first;
+			triangle.primID = t;
+			triangle.alpha_tested = alpha_tested;
+			triangles.push_back(triangle);
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Extract an intersection from an embree ray.
 ///////////////////////////////////////////////////////////////////////////
@@ -97,11 +285,23 @@ Intersection getIntersection(const Ray& r)
 	const labhelper::Mesh* mesh = map_geom_ID_to_mesh[r.geomID];
 	Intersection i;
 	i.material = &(model->m_materials[mesh->m_material_idx]);
-	vec3 n0 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
-	vec3 n1 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
-	vec3 n2 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
+	uint32_t v[3];
+	triangleVertices(model, mesh, r.primID, v);
+	vec3 n0 = model->m_normals[v[0]];
+	vec3 n1 = model->m_normals[v[1]];
+	vec3 n2 = model->m_normals[v[2]];
 	float w = 1.0f - (r.u + r.v);
 	i.shading_normal = normalize(w * n0 + r.u * n1 + r.v * n2);
+	vec2 uv0 = model->m_texture_coordinates[v[0]];
+	vec2 uv1 = model->m_texture_coordinates[v[1]];
+	vec2 uv2 = model->m_texture_coordinates[v[2]];
+	i.uv = w * uv0 + r.u * uv1 + r.v * uv2;
+	// Embree's (unnormalized) geometry normal is the world space cross
+	// product of two edges, so its length is twice the triangle area.
+	vec2 duv1 = uv1 - uv0, duv2 = uv2 - uv0;
+	float uv_area = abs(duv1.x * duv2.y - duv1.y * duv2.x);
+	float world_area = length(r.n);
+	i.uv_density = (uv_area > 0.0f && world_area > 0.0f) ? 0.5f * log2(uv_area / world_area) : 0.0f;
 	i.geometry_normal = -normalize(r.n);
 	i.position = r.o + r.tfar * r.d;
 	i.wo = normalize(-r.d);
@@ -113,7 +313,11 @@ Intersection getIntersection(const Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool intersect(Ray& r)
 {
+	ThreadStats& stats = threadStats();
+	uint64_t start = timerTicks();
 	rtcIntersect(embree_scene, *((RTCRay*)&r));
+	stats.embree_ticks += timerTicks() - start;
+	stats.intersect_rays++;
 	return r.geomID != RTC_INVALID_GEOMETRY_ID;
 }
 
@@ -123,7 +327,12 @@ bool intersect(Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool occluded(Ray& r)
 {
+	ThreadStats& stats = threadStats();
+	uint64_t start = timerTicks();
+	r.mask = RAY_MASK_LIGHT;
 	rtcOccluded(embree_scene, *((RTCRay*)&r));
+	stats.embree_ticks += timerTicks() - start;
+	stats.shadow_rays++;
 	return r.geomID != RTC_INVALID_GEOMETRY_ID;
 }
 } // namespace pathtracer
\ No newline at end of file
@@ -4,19 +4,81 @@
 #include "Model.h"
 #include <glm/glm.hpp>
 #include <map>
+#include <vector>
 
 namespace pathtracer
 {
 ///////////////////////////////////////////////////////////////////////////
-// Add a model to the embree scene
+// Ray masks. A ray only hits geometry whose mask shares a bit with its
+// own. All geometry is seen by camera rays, but geometry with a material
+// that does not cast shadows is left out of the light mask, so shadow
+// rays and photons pass through it without testing it at all.
+///////////////////////////////////////////////////////////////////////////
+enum RayMask : uint32_t
+{
+	// Camera rays and the bounces of camera paths
+	RAY_MASK_CAMERA = 1 << 0,
+	// Shadow rays and photons
+	RAY_MASK_LIGHT = 1 << 1,
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Add a model to the embree scene. Each mesh gets its ray mask from its
+// material, and alpha tested materials (see texture.h) get intersection
+// filters that let rays through transparent texels.
 ///////////////////////////////////////////////////////////////////////////
 void addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
 
+///////////////////////////////////////////////////////////////////////////
+// Set the ray masks again after the shadow flag of a material changed.
+// Builds the scene again, with the same models.
+///////////////////////////////////////////////////////////////////////////
+void updateGeometryMasks();
+
 ///////////////////////////////////////////////////////////////////////////
 // Build an acceleration structure for the scene
 ///////////////////////////////////////////////////////////////////////////
 void buildBVH();
 
+///////////////////////////////////////////////////////////////////////////
+// Remove all models from the scene
+///////////////////////////////////////////////////////////////////////////
+void clearScene();
+
+///////////////////////////////////////////////////////////////////////////
+// Get the bounding box of the whole scene (only valid after buildBVH())
+///////////////////////////////////////////////////////////////////////////
+void getSceneBounds(glm::vec3& bbox_min, glm::vec3& bbox_max);
+
+///////////////////////////////////////////////////////////////////////////
+// A world space triangle of a mesh with an emissive material
+///////////////////////////////////////////////////////////////////////////
+struct EmissiveTriangle
+{
+	glm::vec3 v0, v1, v2;
+	const labhelper::Material* material;
+};
+void getEmissiveTriangles(std::vector<EmissiveTriangle>& triangles);
+
+///////////////////////////////////////////////////////////////////////////
+// A world space triangle of the scene, with the ids embree reports when a
+// ray hits it. Triangles come ordered by geomID and then primID.
+///////////////////////////////////////////////////////////////////////////
+struct SceneTriangle
+{
+	glm::vec3 v0, v1, v2;
+	uint32_t geomID, primID;
+	// Rays may pass through the triangle, depending on its texture
+	bool alpha_tested;
+};
+void getSceneTriangles(std::vector<SceneTriangle>& triangles);
+
+///////////////////////////////////////////////////////////////////////////
+// Incremented by every buildBVH(), so that copies of the scene can tell
+// when they are out of date
+///////////////////////////////////////////////////////////////////////////
+uint32_t getSceneVersion();
+
 ///////////////////////////////////////////////////////////////////////////
 // This struct is what an embree Ray must look like. It contains the
 // information about the ray to be shot and (after intersect() has been
@@ -60,6 +122,11 @@ struct Intersection
 	glm::vec3 geometry_normal;
 	glm::vec3 shading_normal;
 	glm::vec3 wo;
+	// Interpolated texture coordinates
+	glm::vec2 uv;
+	// 0.5 * log2(uv area / world area) of the hit triangle, used to pick
+	// texture mip levels
+	float uv_density;
 	const labhelper::Material* material;
 };
 Intersection getIntersection(const Ray& r);
@@ -71,7 +138,8 @@ bool intersect(Ray& r);
 
 ///////////////////////////////////////////////////////////////////////////
 // Test whether a ray is intersected by the scene (do not return an
-// intersection).
+// intersection). Used for shadow rays, so the ray mask is set to
+// RAY_MASK_LIGHT.
 ///////////////////////////////////////////////////////////////////////////
 bool occluded(Ray& r);
 } // namespace pathtracer
\ No newline at end of file
@@ -0,0 +1,373 @@
+#include "guiding.h"
+#include "Pathtracer.h"
+#include "embree.h"
+#include "sampling.h"
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+///////////////////////////////////////////////////////////////////////////////
+GuidingSettings guiding_settings = { false, 6, 0.5f, 4000 };
+GuidingStats guiding_stats = {};
+
+static void atomicAdd(atomic<float>& a, float value)
+{
+	float old = a.load(memory_order_relaxed);
+	while(!a.compare_exchange_weak(old, old + value, memory_order_relaxed))
+		;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A node in the directional quadtree. The sums hold the recorded energy
+// per quadrant, a child index of 0 means that the quadrant is a leaf.
+///////////////////////////////////////////////////////////////////////////
+struct QuadNode
+{
+	atomic<float> sum[4];
+	int children[4];
+	QuadNode()
+	{
+		for(int i = 0; i < 4; i++)
+		{
+			sum[i].store(0.0f, memory_order_relaxed);
+			children[i] = 0;
+		}
+	}
+	QuadNode(const QuadNode& other)
+	{
+		*this = other;
+	}
+	QuadNode& operator=(const QuadNode& other)
+	{
+		for(int i = 0; i < 4; i++)
+		{
+			sum[i].store(other.sum[i].load(memory_order_relaxed), memory_order_relaxed);
+			children[i] = other.children[i];
+		}
+		return *this;
+	}
+	float total() const
+	{
+		return sum[0] + sum[1] + sum[2] + sum[3];
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Find the quadrant of p and remap p to the unit square of that quadrant
+///////////////////////////////////////////////////////////////////////////
+static int quadrant(vec2& p)
+{
+	int qx = p.x >= 0.5f ? 1 : 0;
+	int qy = p.y >= 0.5f ? 1 : 0;
+	p = min(2.0f * p - vec2(qx, qy), vec2(0.99999994f));
+	return qx + 2 * qy;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A distribution over the unit square, adaptively subdivided as a quadtree
+///////////////////////////////////////////////////////////////////////////
+struct DTree
+{
+	vector<QuadNode> nodes;
+	atomic<int> sample_count;
+	DTree() : nodes(1), sample_count(0)
+	{
+	}
+	DTree(const DTree& other) : nodes(other.nodes), sample_count(other.sample_count.load())
+	{
+	}
+	DTree& operator=(const DTree& other)
+	{
+		nodes = other.nodes;
+		sample_count = other.sample_count.load();
+		return *this;
+	}
+	float total() const
+	{
+		return nodes[0].total();
+	}
+
+	void record(vec2 p, float weight)
+	{
+		sample_count++;
+		int n = 0;
+		while(true)
+		{
+			int q = quadrant(p);
+			atomicAdd(nodes[n].sum[q], weight);
+			if(nodes[n].children[q] == 0)
+				return;
+			n = nodes[n].children[q];
+		}
+	}
+
+	float pdf(vec2 p) const
+	{
+		if(total() <= 0.0f)
+			return 1.0f;
+		float result = 1.0f;
+		int n = 0;
+		while(true)
+		{
+			const QuadNode& node = nodes[n];
+			float node_total = node.total();
+			if(node_total <= 0.0f)
+				return 0.0f;
+			int q = quadrant(p);
+			result *= 4.0f * node.sum[q] / node_total;
+			if(node.children[q] == 0)
+				return result;
+			n = node.children[q];
+		}
+	}
+
+	vec2 sample(vec2 u) const
+	{
+		vec2 origin(0.0f);
+		float size = 1.0f;
+		int n = 0;
+		if(total() <= 0.0f)
+			return u;
+		while(true)
+		{
+			const QuadNode& node = nodes[n];
+			float s[4] = { node.sum[0], node.sum[1], node.sum[2], node.sum[3] };
+			if(s[0] + s[1] + s[2] + s[3] <= 0.0f)
+				return origin + size * u;
+			// First choose the column, then the row within that column
+			float p_left = (s[0] + s[2]) / (s[0] + s[1] + s[2] + s[3]);
+			int qx = u.x < p_left ? 0 : 1;
+			u.x = qx == 0 ? u.x / p_left : (u.x - p_left) / (1.0f - p_left);
+			float p_bottom = s[qx] / (s[qx] + s[qx + 2]);
+			int qy = u.y < p_bottom ? 0 : 1;
+			u.y = qy == 0 ? u.y / p_bottom : (u.y - p_bottom) / (1.0f - p_bottom);
+			u = clamp(u, vec2(0.0f), vec2(0.99999994f));
+			size *= 0.5f;
+			origin += size * vec2(qx, qy);
+			int child = node.children[qx + 2 * qy];
+			if(child == 0)
+				return origin + size * u;
+			n = child;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Create an empty tree for the next iteration, where every quadrant
+	// holding more than 'threshold' of the energy of this tree is split.
+	///////////////////////////////////////////////////////////////////////
+	DTree refined(float threshold) const
+	{
+		DTree result;
+		float energy_total = total();
+		if(energy_total <= 0.0f)
+			return result;
+		float energy[4];
+		for(int q = 0; q < 4; q++)
+			energy[q] = nodes[0].sum[q] / energy_total;
+		subdivide(0, energy, result, 0, 1, threshold);
+		return result;
+	}
+
+	void subdivide(int src_node, const float energy[4], DTree& dst, int dst_node, int depth, float threshold) const
+	{
+		const int max_depth = 20;
+		for(int q = 0; q < 4; q++)
+		{
+			if(energy[q] <= threshold || depth >= max_depth)
+				continue;
+			int child = int(dst.nodes.size());
+			dst.nodes.push_back(QuadNode());
+			dst.nodes[dst_node].children[q] = child;
+			int src_child = src_node >= 0 ? nodes[src_node].children[q] : 0;
+			float child_energy[4];
+			float child_total = src_child != 0 ? nodes[src_child].total() : 0.0f;
+			for(int k = 0; k < 4; k++)
+			{
+				child_energy[k] = child_total > 0.0f ? energy[q] * nodes[src_child].sum[k] / child_total :
+				                                       energy[q] / 4.0f;
+			}
+			subdivide(src_child != 0 ? src_child : -1, child_energy, dst, child, depth + 1, threshold);
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The spatial binary tree. Leaves (dtree >= 0) hold one distribution that
+// is being learned and one, from the previous iteration, to sample from.
+///////////////////////////////////////////////////////////////////////////
+struct SpatialNode
+{
+	int axis;
+	int children[2];
+	int dtree;
+};
+struct DTreePair
+{
+	DTree building;
+	DTree sampling;
+};
+static vector<SpatialNode> spatial_nodes;
+static vector<unique_ptr<DTreePair>> dtrees;
+static vec3 bounds_min, bounds_size;
+static int passes_in_iteration = 0;
+
+///////////////////////////////////////////////////////////////////////////
+// Direction <-> unit square, an area preserving cylindrical mapping
+///////////////////////////////////////////////////////////////////////////
+static vec2 directionToSquare(const vec3& d)
+{
+	float cos_theta = clamp(d.y, -1.0f, 1.0f);
+	float phi = atan2(d.z, d.x);
+	if(phi < 0.0f)
+		phi += 2.0f * M_PI;
+	return clamp(vec2(0.5f * (cos_theta + 1.0f), phi / (2.0f * M_PI)), vec2(0.0f), vec2(0.99999994f));
+}
+
+static vec3 squareToDirection(const vec2& p)
+{
+	float cos_theta = 2.0f * p.x - 1.0f;
+	float phi = 2.0f * M_PI * p.y;
+	float sin_theta = sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	return vec3(sin_theta * cos(phi), cos_theta, sin_theta * sin(phi));
+}
+
+static DTreePair& lookup(const vec3& position)
+{
+	vec3 p = clamp((position - bounds_min) / bounds_size, vec3(0.0f), vec3(0.99999994f));
+	int n = 0;
+	while(spatial_nodes[n].dtree < 0)
+	{
+		const SpatialNode& node = spatial_nodes[n];
+		if(p[node.axis] < 0.5f)
+		{
+			p[node.axis] = 2.0f * p[node.axis];
+			n = node.children[0];
+		}
+		else
+		{
+			p[node.axis] = 2.0f * p[node.axis] - 1.0f;
+			n = node.children[1];
+		}
+	}
+	return *dtrees[spatial_nodes[n].dtree];
+}
+
+void resetGuiding()
+{
+	vec3 bbox_min, bbox_max;
+	getSceneBounds(bbox_min, bbox_max);
+	vec3 margin = 0.01f * (bbox_max - bbox_min) + vec3(EPSILON);
+	bounds_min = bbox_min - margin;
+	bounds_size = bbox_max - bbox_min + 2.0f * margin;
+
+	spatial_nodes.clear();
+	dtrees.clear();
+	SpatialNode root = { 0, { 0, 0 }, 0 };
+	spatial_nodes.push_back(root);
+	dtrees.emplace_back(new DTreePair);
+	passes_in_iteration = 0;
+	guiding_stats = {};
+	guiding_stats.training = true;
+	guiding_stats.spatial_leaves = 1;
+	guiding_stats.directional_nodes = 1;
+}
+
+bool guidingActive()
+{
+	return guiding_settings.enabled && guiding_stats.iteration > 0 && !spatial_nodes.empty();
+}
+
+bool guidingTraining()
+{
+	return guiding_settings.enabled && guiding_stats.iteration < guiding_settings.training_iterations
+	       && !spatial_nodes.empty();
+}
+
+vec3 sampleGuiding(const vec3& position, float& pdf)
+{
+	const DTree& dtree = lookup(position).sampling;
+	vec2 p = dtree.sample(vec2(randf(), randf()));
+	pdf = dtree.pdf(p) / (4.0f * M_PI);
+	return squareToDirection(p);
+}
+
+float pdfGuiding(const vec3& position, const vec3& wi)
+{
+	return lookup(position).sampling.pdf(directionToSquare(wi)) / (4.0f * M_PI);
+}
+
+void recordGuiding(const vec3& position, const vec3& wi, float radiance_over_pdf)
+{
+	if(!(radiance_over_pdf >= 0.0f) || std::isinf(radiance_over_pdf))
+		return;
+	lookup(position).building.record(directionToSquare(wi), radiance_over_pdf);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// At the end of an iteration, split spatial leaves that saw many samples,
+// then make the learned distributions the ones to sample from and start
+// learning into refined, empty trees.
+///////////////////////////////////////////////////////////////////////////
+static void endIteration()
+{
+	const int iteration = guiding_stats.iteration;
+	const float threshold = guiding_settings.spatial_threshold * sqrt(float(1 << iteration));
+	for(size_t i = 0; i < spatial_nodes.size(); i++)
+	{
+		if(spatial_nodes[i].dtree < 0)
+			continue;
+		DTreePair& pair = *dtrees[spatial_nodes[i].dtree];
+		if(pair.building.sample_count < threshold)
+			continue;
+		pair.building.sample_count = pair.building.sample_count / 2;
+		int axis = spatial_nodes[i].axis;
+		SpatialNode child = { (axis + 1) % 3, { 0, 0 }, spatial_nodes[i].dtree };
+		spatial_nodes[i].children[0] = int(spatial_nodes.size());
+		spatial_nodes.push_back(child);
+		child.dtree = int(dtrees.size());
+		dtrees.emplace_back(new DTreePair(pair));
+		spatial_nodes[i].children[1] = int(spatial_nodes.size());
+		spatial_nodes.push_back(child);
+		spatial_nodes[i].dtree = -1;
+	}
+
+	guiding_stats.spatial_leaves = int(dtrees.size());
+	guiding_stats.directional_nodes = 0;
+	for(auto& pair : dtrees)
+	{
+		pair->sampling = pair->building;
+		pair->building = pair->sampling.refined(0.01f);
+		guiding_stats.directional_nodes += int(pair->sampling.nodes.size());
+	}
+	guiding_stats.iteration += 1;
+}
+
+void endGuidingPass(float pass_ms, float pass_variance)
+{
+	guiding_stats.last_pass_ms = pass_ms;
+	guiding_stats.last_pass_variance = pass_variance;
+	guiding_stats.training = guidingTraining();
+	if(!guiding_stats.training)
+		return;
+	guiding_stats.training_pass_ms += pass_ms;
+	passes_in_iteration += 1;
+	if(passes_in_iteration < (1 << guiding_stats.iteration))
+		return;
+	passes_in_iteration = 0;
+
+	auto start = chrono::high_resolution_clock::now();
+	endIteration();
+	chrono::duration<double, milli> elapsed = chrono::high_resolution_clock::now() - start;
+	guiding_stats.refine_ms += elapsed.count();
+	guiding_stats.training = guidingTraining();
+}
+} // namespace pathtracer
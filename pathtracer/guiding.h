@@ -0,0 +1,76 @@
+#pragma once
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Path guiding, in the spirit of "Practical Path Guiding for Efficient
+// Light-Transport Simulation" (Müller et al. 2017). Space is split by a
+// binary tree, and every spatial leaf holds a quadtree over the sphere of
+// directions that learns where indirect light comes from. Learning happens
+// in iterations of 1, 2, 4, ... passes; after each iteration the trees are
+// refined and the learned distribution is used for sampling in the next.
+///////////////////////////////////////////////////////////////////////////
+extern struct GuidingSettings
+{
+	bool enabled;
+	// Number of learning iterations. Iteration k is 2^k passes long.
+	int training_iterations;
+	// Probability of sampling the BSDF rather than the guiding distribution
+	float bsdf_sampling_fraction;
+	// A spatial leaf is split once it has seen this many samples (scaled
+	// by sqrt(2^k) in iteration k).
+	int spatial_threshold;
+} guiding_settings;
+
+///////////////////////////////////////////////////////////////////////////
+// Numbers for deciding, per scene, whether guiding pays off: the time
+// spent learning (the passes that record paths, and refining the trees
+// between iterations) against the per pixel variance of the latest pass.
+// Compare last_pass_variance with guiding turned on and off.
+///////////////////////////////////////////////////////////////////////////
+extern struct GuidingStats
+{
+	int iteration;
+	bool training;
+	double training_pass_ms;
+	double refine_ms;
+	int spatial_leaves;
+	int directional_nodes;
+	float last_pass_ms;
+	float last_pass_variance;
+} guiding_stats;
+
+///////////////////////////////////////////////////////////////////////////
+// Throw away everything learned and start over
+///////////////////////////////////////////////////////////////////////////
+void resetGuiding();
+
+///////////////////////////////////////////////////////////////////////////
+// Is there a learned distribution to sample from / should completed paths
+// be recorded?
+///////////////////////////////////////////////////////////////////////////
+bool guidingActive();
+bool guidingTraining();
+
+///////////////////////////////////////////////////////////////////////////
+// Sample a direction from, and evaluate the solid angle pdf of, the
+// learned distribution at a position.
+///////////////////////////////////////////////////////////////////////////
+vec3 sampleGuiding(const vec3& position, float& pdf);
+float pdfGuiding(const vec3& position, const vec3& wi);
+
+///////////////////////////////////////////////////////////////////////////
+// Record the luminance of radiance that arrived at position from
+// direction wi, divided by the pdf with which wi was sampled. Safe to call
+// from several threads.
+///////////////////////////////////////////////////////////////////////////
+void recordGuiding(const vec3& position, const vec3& wi, float radiance_over_pdf);
+
+///////////////////////////////////////////////////////////////////////////
+// Called after each pass; ends the learning iteration when it is due.
+///////////////////////////////////////////////////////////////////////////
+void endGuidingPass(float pass_ms, float pass_variance);
+} // namespace pathtracer
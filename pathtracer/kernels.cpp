@@ -0,0 +1,139 @@
+#include "kernels.h"
+#include "kernels_table.h"
+#include <cstdlib>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace pathtracer
+{
+namespace simd
+{
+///////////////////////////////////////////////////////////////////////////
+// CPU feature detection. Besides the cpuid bits, the OS must have enabled
+// saving of the wider registers (checked through xgetbv).
+///////////////////////////////////////////////////////////////////////////
+static void cpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (unsigned long long)edx << 32 | eax;
+#endif
+}
+
+static void detectFeatures(bool& avx2, bool& avx512)
+{
+	avx2 = avx512 = false;
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	const unsigned int max_leaf = regs[0];
+	cpuid(1, 0, regs);
+	const bool osxsave = (regs[2] >> 27) & 1;
+	const bool avx = (regs[2] >> 28) & 1;
+	const bool fma = (regs[2] >> 12) & 1;
+	if(!osxsave || !avx || max_leaf < 7)
+		return;
+	const unsigned long long xcr0 = xgetbv0();
+	cpuid(7, 0, regs);
+	// xmm and ymm state
+	avx2 = (xcr0 & 0x6) == 0x6 && fma && ((regs[1] >> 5) & 1);
+	// plus opmask and zmm state
+	avx512 = avx2 && (xcr0 & 0xe6) == 0xe6 && ((regs[1] >> 16) & 1);
+}
+
+static KernelTable selectKernels()
+{
+	bool avx2, avx512;
+	detectFeatures(avx2, avx512);
+	const char* requested = getenv("PATHTRACER_ISA");
+	if(requested != nullptr)
+	{
+		if(strcmp(requested, "sse2") == 0)
+			avx2 = avx512 = false;
+		else if(strcmp(requested, "avx2") == 0)
+			avx512 = false;
+	}
+	KernelTable table;
+	if(avx512 && getKernelsAVX512(table))
+		return table;
+	if(avx2 && getKernelsAVX2(table))
+		return table;
+	getKernelsSSE2(table);
+	return table;
+}
+
+static const KernelTable& kernels()
+{
+	static const KernelTable table = selectKernels();
+	return table;
+}
+
+const char* isa()
+{
+	return kernels().isa;
+}
+
+int width()
+{
+	return kernels().width;
+}
+
+void concentricSampleDisk(const float* u1, const float* u2, float* dx, float* dy, int count)
+{
+	kernels().concentricSampleDisk(u1, u2, dx, dy, count);
+}
+
+void cosineSampleHemisphere(const float* u1, const float* u2, float* x, float* y, float* z, int count)
+{
+	kernels().cosineSampleHemisphere(u1, u2, x, y, z, count);
+}
+
+void orthonormalBasis(const float* nx, const float* ny, const float* nz, float* tx, float* ty, float* tz,
+                      float* bx, float* by, float* bz, int count)
+{
+	kernels().orthonormalBasis(nx, ny, nz, tx, ty, tz, bx, by, bz, count);
+}
+
+void schlickFresnel(const float* R0, const float* cos_theta, float* F, int count)
+{
+	kernels().schlickFresnel(R0, cos_theta, F, count);
+}
+
+void blinnPhongDG(const float* shininess, const float* n_wh, const float* n_wo, const float* n_wi,
+                  const float* wo_wh, float* D, float* G, int count)
+{
+	kernels().blinnPhongDG(shininess, n_wh, n_wo, n_wi, wo_wh, D, G, count);
+}
+
+void equirectangular(const float* x, const float* y, const float* z, float* u, float* v, int count)
+{
+	kernels().equirectangular(x, y, z, u, v, count);
+}
+
+void generateCameraRays(const float* inverse_view_projection, const float* camera, const float* sx, const float* sy,
+                        float* dx, float* dy, float* dz, int count)
+{
+	kernels().generateCameraRays(inverse_view_projection, camera, sx, sy, dx, dy, dz, count);
+}
+
+void resolveAccumulated(const float* sums, float* rgba, int count)
+{
+	kernels().resolveAccumulated(sums, rgba, count);
+}
+} // namespace simd
+} // namespace pathtracer
@@ -0,0 +1,99 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cmath>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Fast approximations of the transcendental functions used by the
+// sampling and BRDF code. The same polynomials are used by the scalar
+// functions below and by the batched kernels, so both give the same
+// result. Measured maximum errors (see 'pathtracer --microbenchmark'):
+//   fastAcos    4e-7 radians (Abramowitz & Stegun 4.4.46)
+//   fastAtan2   3e-7 radians (Cephes atanf)
+//   sin/cos     4e-6 (degree 9 polynomial after range reduction)
+//   pow(x, s)   1.2e-5 relative for s up to 25000 (as exp2(s * log2(x)))
+///////////////////////////////////////////////////////////////////////////
+inline float fastAcos(float x)
+{
+	float a = std::fabs(x) < 1.0f ? std::fabs(x) : 1.0f;
+	float p = -0.0012624911f;
+	p = p * a + 0.0066700901f;
+	p = p * a - 0.0170881256f;
+	p = p * a + 0.0308918810f;
+	p = p * a - 0.0501743046f;
+	p = p * a + 0.0889789874f;
+	p = p * a - 0.2145988016f;
+	p = p * a + 1.5707963050f;
+	float r = std::sqrt(1.0f - a) * p;
+	return x < 0.0f ? float(M_PI) - r : r;
+}
+
+inline float fastAtan2(float y, float x)
+{
+	float ax = std::fabs(x), ay = std::fabs(y);
+	float mx = ax > ay ? ax : ay, mn = ax > ay ? ay : ax;
+	float t = mx > 0.0f ? mn / mx : 0.0f;
+	// Reduce t from [0, 1] to [-tan(pi/8), tan(pi/8)]
+	float offset = 0.0f;
+	if(t > 0.41421356f)
+	{
+		t = (t - 1.0f) / (t + 1.0f);
+		offset = float(M_PI) / 4.0f;
+	}
+	float z = t * t;
+	float r = (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * t
+	          + t + offset;
+	if(ay > ax)
+		r = float(M_PI) / 2.0f - r;
+	if(x < 0.0f)
+		r = float(M_PI) - r;
+	return y < 0.0f ? -r : r;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Schlick's approximation, without pow()
+///////////////////////////////////////////////////////////////////////////
+inline float schlickFresnel(float R0, float cos_theta)
+{
+	float m = 1.0f - cos_theta;
+	float m2 = m * m;
+	return R0 + (1.0f - R0) * m2 * m2 * m;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Batched kernels. All arrays are structure of arrays with 'count'
+// elements and need no particular alignment. The kernels are compiled
+// for SSE2, AVX2 and AVX-512 (kernels_*.cpp), and the widest variant the
+// CPU supports is picked on first use. The environment variable
+// PATHTRACER_ISA (sse2, avx2 or avx512) can ask for a narrower one.
+///////////////////////////////////////////////////////////////////////////
+namespace simd
+{
+// Name and vector width of the selected variant
+const char* isa();
+int width();
+
+// Uniform (u1, u2) in [0, 1)^2 to the unit disk, Shirley & Chiu mapping
+void concentricSampleDisk(const float* u1, const float* u2, float* dx, float* dy, int count);
+// Cosine distributed directions around +z
+void cosineSampleHemisphere(const float* u1, const float* u2, float* x, float* y, float* z, int count);
+// Tangent and bitangent for unit normals (Duff et al., branchless)
+void orthonormalBasis(const float* nx, const float* ny, const float* nz, float* tx, float* ty, float* tz,
+                      float* bx, float* by, float* bz, int count);
+void schlickFresnel(const float* R0, const float* cos_theta, float* F, int count);
+// The D and G terms of the Blinn Phong microfacet BRDF, from the cosines
+// between n, wh, wo and wi
+void blinnPhongDG(const float* shininess, const float* n_wh, const float* n_wo, const float* n_wi,
+                  const float* wo_wh, float* D, float* G, int count);
+// Direction to (u, v) lookup coordinates of an equirectangular map, as in
+// Lenvironment()
+void equirectangular(const float* x, const float* y, const float* z, float* u, float* v, int count);
+// Normalized camera ray directions through screen coordinates in [0, 1]^2,
+// with a column major inverse(P * V) and the camera position
+void generateCameraRays(const float* inverse_view_projection, const float* camera, const float* sx, const float* sy,
+                        float* dx, float* dy, float* dz, int count);
+// rgba = sums / max(sums.w, 1) for 'count' rgba pixels
+void resolveAccumulated(const float* sums, float* rgba, int count);
+} // namespace simd
+} // namespace pathtracer
@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////
+// The AVX2 (and FMA) kernels. CMakeLists.txt compiles this file with the
+// flags for the instruction set; without them the variant is left out.
+///////////////////////////////////////////////////////////////////////////
+#if defined(__AVX2__)
+#define KERNEL_ISA avx2
+#include "kernels_impl.h"
+#else
+#include "kernels_table.h"
+#endif
+
+namespace pathtracer
+{
+namespace simd
+{
+bool getKernelsAVX2(KernelTable& table)
+{
+#if defined(__AVX2__)
+	table = avx2::table();
+	return true;
+#else
+	return false;
+#endif
+}
+} // namespace simd
+} // namespace pathtracer
@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////
+// The AVX-512 kernels. CMakeLists.txt compiles this file with the
+// flags for the instruction set; without them the variant is left out.
+///////////////////////////////////////////////////////////////////////////
+#if defined(__AVX512F__)
+#define KERNEL_ISA avx512
+#include "kernels_impl.h"
+#else
+#include "kernels_table.h"
+#endif
+
+namespace pathtracer
+{
+namespace simd
+{
+bool getKernelsAVX512(KernelTable& table)
+{
+#if defined(__AVX512F__)
+	table = avx512::table();
+	return true;
+#else
+	return false;
+#endif
+}
+} // namespace simd
+} // namespace pathtracer
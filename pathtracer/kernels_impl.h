@@ -0,0 +1,410 @@
+///////////////////////////////////////////////////////////////////////////
+// The SIMD kernels. This file is included by kernels_sse2.cpp,
+// kernels_avx2.cpp and kernels_avx512.cpp, which are compiled with
+// different instruction set flags and define KERNEL_ISA to a namespace
+// for the variant. Everything here is static or in that namespace, and
+// it must not include headers with inline functions (glm, <algorithm>,
+// kernels.h), since the linker could otherwise pick an AVX compiled copy
+// of such a function for the generic code.
+///////////////////////////////////////////////////////////////////////////
+#include "kernels_table.h"
+#include <immintrin.h>
+#include <cstdint>
+
+namespace pathtracer
+{
+namespace simd
+{
+namespace KERNEL_ISA
+{
+///////////////////////////////////////////////////////////////////////////
+// A minimal vector type, so that each kernel is written only once. It is
+// a thin struct around the native type, since MSVC has no operators for
+// the intrinsic types. Comparisons return all ones / all zeros lanes.
+///////////////////////////////////////////////////////////////////////////
+#if defined(__AVX512F__)
+typedef __m512 native;
+typedef __m512i vint;
+static const int W = 16;
+#define PS(name) _mm512_##name##_ps
+#define EPI32(name) _mm512_##name##_epi32
+#elif defined(__AVX2__)
+typedef __m256 native;
+typedef __m256i vint;
+static const int W = 8;
+#define PS(name) _mm256_##name##_ps
+#define EPI32(name) _mm256_##name##_epi32
+#else
+typedef __m128 native;
+typedef __m128i vint;
+static const int W = 4;
+#define PS(name) _mm_##name##_ps
+#define EPI32(name) _mm_##name##_epi32
+#endif
+struct vfloat
+{
+	native v;
+	vfloat()
+	{
+	}
+	vfloat(native a) : v(a)
+	{
+	}
+};
+static inline vfloat load(const float* p) { return PS(loadu)(p); }
+static inline void store(float* p, vfloat a) { PS(storeu)(p, a.v); }
+static inline vfloat set(float a) { return PS(set1)(a); }
+static inline vfloat operator+(vfloat a, vfloat b) { return PS(add)(a.v, b.v); }
+static inline vfloat operator-(vfloat a, vfloat b) { return PS(sub)(a.v, b.v); }
+static inline vfloat operator*(vfloat a, vfloat b) { return PS(mul)(a.v, b.v); }
+static inline vfloat operator/(vfloat a, vfloat b) { return PS(div)(a.v, b.v); }
+static inline vfloat vmin(vfloat a, vfloat b) { return PS(min)(a.v, b.v); }
+static inline vfloat vmax(vfloat a, vfloat b) { return PS(max)(a.v, b.v); }
+static inline vfloat vsqrt(vfloat a) { return PS(sqrt)(a.v); }
+static inline vint toInt(vfloat a) { return EPI32(cvttps)(a.v); }
+static inline vfloat toFloat(vint a) { return PS(cvtepi32)(a); }
+static inline vint iset(int a) { return EPI32(set1)(a); }
+static inline vint iadd(vint a, vint b) { return EPI32(add)(a, b); }
+static inline vint isub(vint a, vint b) { return EPI32(sub)(a, b); }
+static inline vint ishl23(vint a) { return EPI32(slli)(a, 23); }
+static inline vint ishr23(vint a) { return EPI32(srli)(a, 23); }
+#if defined(__AVX512F__)
+// AVX-512F has no float logic ops (they are in DQ), use the integer ones
+static inline vint asInt(vfloat a) { return _mm512_castps_si512(a.v); }
+static inline vfloat asFloat(vint a) { return _mm512_castsi512_ps(a); }
+static inline vint iand(vint a, vint b) { return _mm512_and_si512(a, b); }
+static inline vint ior(vint a, vint b) { return _mm512_or_si512(a, b); }
+static inline vfloat vand(vfloat a, vfloat b) { return asFloat(iand(asInt(a), asInt(b))); }
+static inline vfloat vandnot(vfloat a, vfloat b) { return asFloat(_mm512_andnot_si512(asInt(a), asInt(b))); }
+static inline vfloat vor(vfloat a, vfloat b) { return asFloat(ior(asInt(a), asInt(b))); }
+static inline vfloat vxor(vfloat a, vfloat b) { return asFloat(_mm512_xor_si512(asInt(a), asInt(b))); }
+static inline vfloat fromMask(__mmask16 m) { return asFloat(_mm512_maskz_set1_epi32(m, -1)); }
+static inline vfloat greater(vfloat a, vfloat b) { return fromMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ)); }
+static inline vfloat less(vfloat a, vfloat b) { return fromMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)); }
+static inline vfloat vfloor(vfloat a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF); }
+static inline vfloat vround(vfloat a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT); }
+// Broadcast the w of every rgba pixel to its four lanes
+static inline vfloat broadcastW(vfloat a) { return _mm512_permute_ps(a.v, _MM_SHUFFLE(3, 3, 3, 3)); }
+static const char* ISA_NAME = "AVX-512";
+#elif defined(__AVX2__)
+static inline vint asInt(vfloat a) { return _mm256_castps_si256(a.v); }
+static inline vfloat asFloat(vint a) { return _mm256_castsi256_ps(a); }
+static inline vint iand(vint a, vint b) { return _mm256_and_si256(a, b); }
+static inline vint ior(vint a, vint b) { return _mm256_or_si256(a, b); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+static inline vfloat vandnot(vfloat a, vfloat b) { return _mm256_andnot_ps(a.v, b.v); }
+static inline vfloat vor(vfloat a, vfloat b) { return _mm256_or_ps(a.v, b.v); }
+static inline vfloat vxor(vfloat a, vfloat b) { return _mm256_xor_ps(a.v, b.v); }
+static inline vfloat greater(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+static inline vfloat less(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+static inline vfloat vfloor(vfloat a) { return _mm256_floor_ps(a.v); }
+static inline vfloat vround(vfloat a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline vfloat broadcastW(vfloat a) { return _mm256_permute_ps(a.v, _MM_SHUFFLE(3, 3, 3, 3)); }
+static const char* ISA_NAME = "AVX2";
+#else
+static inline vint asInt(vfloat a) { return _mm_castps_si128(a.v); }
+static inline vfloat asFloat(vint a) { return _mm_castsi128_ps(a); }
+static inline vint iand(vint a, vint b) { return _mm_and_si128(a, b); }
+static inline vint ior(vint a, vint b) { return _mm_or_si128(a, b); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+static inline vfloat vandnot(vfloat a, vfloat b) { return _mm_andnot_ps(a.v, b.v); }
+static inline vfloat vor(vfloat a, vfloat b) { return _mm_or_ps(a.v, b.v); }
+static inline vfloat vxor(vfloat a, vfloat b) { return _mm_xor_ps(a.v, b.v); }
+static inline vfloat greater(vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+static inline vfloat less(vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+// SSE2 has no floor or round, truncate and correct instead (|a| < 2^31)
+static inline vfloat vfloor(vfloat a)
+{
+	vfloat t = toFloat(toInt(a));
+	return t - vand(greater(t, a), set(1.0f));
+}
+static inline vfloat vround(vfloat a) { return vfloor(a + set(0.5f)); }
+static inline vfloat broadcastW(vfloat a) { return _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 3, 3, 3)); }
+static const char* ISA_NAME = "SSE2";
+#endif
+#undef PS
+#undef EPI32
+
+static const float PI = 3.14159265358979f;
+
+// mask ? a : b
+static inline vfloat select(vfloat mask, vfloat a, vfloat b) { return vor(vand(mask, a), vandnot(mask, b)); }
+static inline vfloat vabs(vfloat a) { return vandnot(set(-0.0f), a); }
+static inline vfloat signOf(vfloat a) { return vand(set(-0.0f), a); }
+
+///////////////////////////////////////////////////////////////////////////
+// Vector versions of the approximations in kernels.h (the polynomials
+// must be kept in sync)
+///////////////////////////////////////////////////////////////////////////
+static inline vfloat vsin(vfloat x)
+{
+	const float pi = PI;
+	// Reduce to [-pi, pi], then fold to [-pi/2, pi/2] with sin(pi - x)
+	x = x - vround(x * set(0.5f / pi)) * set(2.0f * pi);
+	vfloat half_pi = set(0.5f * pi);
+	x = select(greater(x, half_pi), set(pi) - x, x);
+	x = select(less(x, set(0.0f) - half_pi), set(-pi) - x, x);
+	vfloat x2 = x * x;
+	vfloat p = set(1.0f / 362880.0f);
+	p = p * x2 - set(1.0f / 5040.0f);
+	p = p * x2 + set(1.0f / 120.0f);
+	p = p * x2 - set(1.0f / 6.0f);
+	return x + x * x2 * p;
+}
+
+static inline vfloat vcos(vfloat x)
+{
+	return vsin(x + set(0.5f * PI));
+}
+
+static inline vfloat vacos(vfloat x)
+{
+	vfloat a = vmin(vabs(x), set(1.0f));
+	vfloat p = set(-0.0012624911f);
+	p = p * a + set(0.0066700901f);
+	p = p * a - set(0.0170881256f);
+	p = p * a + set(0.0308918810f);
+	p = p * a - set(0.0501743046f);
+	p = p * a + set(0.0889789874f);
+	p = p * a - set(0.2145988016f);
+	p = p * a + set(1.5707963050f);
+	vfloat r = vsqrt(set(1.0f) - a) * p;
+	return select(less(x, set(0.0f)), set(PI) - r, r);
+}
+
+static inline vfloat vatan2(vfloat y, vfloat x)
+{
+	vfloat ax = vabs(x), ay = vabs(y);
+	vfloat mx = vmax(ax, ay), mn = vmin(ax, ay);
+	vfloat t = select(greater(mx, set(0.0f)), mn / mx, set(0.0f));
+	vfloat reduce = greater(t, set(0.41421356f));
+	t = select(reduce, (t - set(1.0f)) / (t + set(1.0f)), t);
+	vfloat z = t * t;
+	vfloat p = set(8.05374449538e-2f);
+	p = p * z - set(1.38776856032e-1f);
+	p = p * z + set(1.99777106478e-1f);
+	p = p * z - set(3.33329491539e-1f);
+	vfloat r = p * z * t + t + vand(reduce, set(PI / 4.0f));
+	r = select(greater(ay, ax), set(PI / 2.0f) - r, r);
+	r = select(less(x, set(0.0f)), set(PI) - r, r);
+	return vxor(r, signOf(y));
+}
+
+// log2 for x > 0: x = m * 2^e, m in [sqrt(1/2), sqrt(2)), and an
+// atanh series in t = (m - 1) / (m + 1)
+static inline vfloat vlog2(vfloat x)
+{
+	vint bits = asInt(x);
+	vint e = isub(ishr23(bits), iset(127));
+	vfloat m = asFloat(ior(iand(bits, iset(0x007fffff)), iset(0x3f800000)));
+	vfloat big = greater(m, set(1.41421356f));
+	m = select(big, m * set(0.5f), m);
+	vfloat exponent = toFloat(e) + vand(big, set(1.0f));
+	vfloat t = (m - set(1.0f)) / (m + set(1.0f));
+	vfloat t2 = t * t;
+	vfloat p = set(1.0f / 9.0f);
+	p = p * t2 + set(1.0f / 7.0f);
+	p = p * t2 + set(1.0f / 5.0f);
+	p = p * t2 + set(1.0f / 3.0f);
+	p = p * t2 + set(1.0f);
+	return exponent + set(2.0f / 0.69314718f) * t * p;
+}
+
+// 2^x = 2^i * sqrt(2) * 2^(f - 0.5), with a Taylor polynomial for the last
+// factor. Flushes to zero below 2^-125, which also keeps denormals (and
+// their slow paths) out of the result.
+static inline vfloat vexp2(vfloat x)
+{
+	vfloat underflow = less(x, set(-125.0f));
+	x = vmin(vmax(x, set(-125.0f)), set(127.0f));
+	vfloat i = vfloor(x);
+	vfloat g = (x - i - set(0.5f)) * set(0.69314718f);
+	vfloat p = set(1.0f / 720.0f);
+	p = p * g + set(1.0f / 120.0f);
+	p = p * g + set(1.0f / 24.0f);
+	p = p * g + set(1.0f / 6.0f);
+	p = p * g + set(0.5f);
+	p = p * g + set(1.0f);
+	p = p * g + set(1.0f);
+	vfloat scale = asFloat(ishl23(iadd(toInt(i), iset(127))));
+	return vandnot(underflow, p * scale * set(1.41421356f));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The kernels, one vector at a time. The scalar remainder goes through
+// the same code with a padded temporary.
+///////////////////////////////////////////////////////////////////////////
+static inline void diskKernel(vfloat u1, vfloat u2, vfloat& dx, vfloat& dy)
+{
+	vfloat a = u1 * set(2.0f) - set(1.0f);
+	vfloat b = u2 * set(2.0f) - set(1.0f);
+	vfloat a_major = greater(vabs(a), vabs(b));
+	vfloat r = select(a_major, a, b);
+	vfloat safe_a = select(greater(vabs(a), set(0.0f)), a, set(1.0f));
+	vfloat safe_b = select(greater(vabs(b), set(0.0f)), b, set(1.0f));
+	vfloat phi = select(a_major, set(PI / 4.0f) * (b / safe_a),
+	                    set(PI / 2.0f) - set(PI / 4.0f) * (a / safe_b));
+	dx = r * vcos(phi);
+	dy = r * vsin(phi);
+}
+
+// Run 'kernel' over arrays, a full vector at a time and then the tail
+// through zero padded temporaries
+template<int IN, int OUT, typename Kernel>
+static void run(const float* const (&in)[IN], float* const (&out)[OUT], int count, Kernel kernel)
+{
+	int i = 0;
+	for(; i + W <= count; i += W)
+	{
+		vfloat a[IN], b[OUT];
+		for(int k = 0; k < IN; k++)
+			a[k] = load(in[k] + i);
+		kernel(a, b);
+		for(int k = 0; k < OUT; k++)
+			store(out[k] + i, b[k]);
+	}
+	if(i < count)
+	{
+		float tmp_in[IN][W] = {}, tmp_out[OUT][W];
+		for(int k = 0; k < IN; k++)
+			for(int j = i; j < count; j++)
+				tmp_in[k][j - i] = in[k][j];
+		vfloat a[IN], b[OUT];
+		for(int k = 0; k < IN; k++)
+			a[k] = load(tmp_in[k]);
+		kernel(a, b);
+		for(int k = 0; k < OUT; k++)
+		{
+			store(tmp_out[k], b[k]);
+			for(int j = i; j < count; j++)
+				out[k][j] = tmp_out[k][j - i];
+		}
+	}
+}
+
+static void concentricSampleDisk(const float* u1, const float* u2, float* dx, float* dy, int count)
+{
+	run<2, 2>({ u1, u2 }, { dx, dy }, count, [](const vfloat* a, vfloat* b) { diskKernel(a[0], a[1], b[0], b[1]); });
+}
+
+static void cosineSampleHemisphere(const float* u1, const float* u2, float* x, float* y, float* z, int count)
+{
+	run<2, 3>({ u1, u2 }, { x, y, z }, count, [](const vfloat* a, vfloat* b) {
+		diskKernel(a[0], a[1], b[0], b[1]);
+		b[2] = vsqrt(vmax(set(0.0f), set(1.0f) - b[0] * b[0] - b[1] * b[1]));
+	});
+}
+
+static void orthonormalBasis(const float* nx, const float* ny, const float* nz, float* tx, float* ty, float* tz,
+                      float* bx, float* by, float* bz, int count)
+{
+	run<3, 6>({ nx, ny, nz }, { tx, ty, tz, bx, by, bz }, count, [](const vfloat* n, vfloat* o) {
+		vfloat sign = vor(set(1.0f), signOf(n[2]));
+		vfloat a = set(-1.0f) / (sign + n[2]);
+		vfloat b = n[0] * n[1] * a;
+		o[0] = set(1.0f) + sign * n[0] * n[0] * a;
+		o[1] = sign * b;
+		o[2] = (set(0.0f) - sign) * n[0];
+		o[3] = b;
+		o[4] = sign + n[1] * n[1] * a;
+		o[5] = set(0.0f) - n[1];
+	});
+}
+
+static void schlickFresnel(const float* R0, const float* cos_theta, float* F, int count)
+{
+	run<2, 1>({ R0, cos_theta }, { F }, count, [](const vfloat* a, vfloat* b) {
+		vfloat m = set(1.0f) - a[1];
+		vfloat m2 = m * m;
+		b[0] = a[0] + (set(1.0f) - a[0]) * m2 * m2 * m;
+	});
+}
+
+static void blinnPhongDG(const float* shininess, const float* n_wh, const float* n_wo, const float* n_wi,
+                  const float* wo_wh, float* D, float* G, int count)
+{
+	run<5, 2>({ shininess, n_wh, n_wo, n_wi, wo_wh }, { D, G }, count, [](const vfloat* a, vfloat* b) {
+		const vfloat s = a[0], eps = set(0.00001f);
+		vfloat cos_h = vmax(set(0.0f), a[1]);
+		vfloat positive = greater(cos_h, set(0.0f));
+		vfloat power = vand(positive, vexp2(s * vlog2(vmax(cos_h, set(1e-30f)))));
+		b[0] = (s + set(2.0f)) * set((0.5f / PI)) * power;
+		vfloat wo_wh = vmax(eps, a[4]);
+		vfloat g_wo = set(2.0f) * vmax(eps, a[1] * a[2]) / wo_wh;
+		vfloat g_wi = set(2.0f) * vmax(eps, a[1] * a[3]) / wo_wh;
+		b[1] = vmin(set(1.0f), vmin(g_wo, g_wi));
+	});
+}
+
+static void equirectangular(const float* x, const float* y, const float* z, float* u, float* v, int count)
+{
+	run<3, 2>({ x, y, z }, { u, v }, count, [](const vfloat* d, vfloat* o) {
+		vfloat theta = vacos(vmax(set(-1.0f), vmin(set(1.0f), d[1])));
+		vfloat phi = vatan2(d[2], d[0]);
+		phi = select(less(phi, set(0.0f)), phi + set((2.0f * PI)), phi);
+		o[0] = phi * set((0.5f / PI));
+		o[1] = theta * set((1.0f / PI));
+	});
+}
+static void generateCameraRays(const float* inverse_view_projection, const float* camera, const float* sx,
+                               const float* sy, float* dx, float* dy, float* dz, int count)
+{
+	// Copy the matrix and camera into locals the lambda can capture
+	float m[16], c[3];
+	for(int i = 0; i < 16; i++)
+		m[i] = inverse_view_projection[i];
+	for(int i = 0; i < 3; i++)
+		c[i] = camera[i];
+	run<2, 3>({ sx, sy }, { dx, dy, dz }, count, [&m, &c](const vfloat* a, vfloat* o) {
+		// The point on the far side of the view volume, column major matrix
+		vfloat x = a[0] * set(2.0f) - set(1.0f);
+		vfloat y = a[1] * set(2.0f) - set(1.0f);
+		vfloat p[4];
+		for(int r = 0; r < 4; r++)
+			p[r] = set(m[r]) * x + set(m[4 + r]) * y + set(m[8 + r] + m[12 + r]);
+		vfloat inv_w = set(1.0f) / p[3];
+		vfloat d[3];
+		for(int k = 0; k < 3; k++)
+			d[k] = p[k] * inv_w - set(c[k]);
+		vfloat inv_length = set(1.0f) / vsqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		for(int k = 0; k < 3; k++)
+			o[k] = d[k] * inv_length;
+	});
+}
+
+static void resolveAccumulated(const float* sums, float* rgba, int count)
+{
+	// W / 4 pixels per vector
+	const int floats = 4 * count;
+	int i = 0;
+	for(; i + W <= floats; i += W)
+	{
+		vfloat sum = load(sums + i);
+		store(rgba + i, sum / vmax(broadcastW(sum), set(1.0f)));
+	}
+	for(; i < floats; i += 4)
+	{
+		float n = sums[i + 3] > 1.0f ? sums[i + 3] : 1.0f;
+		for(int k = 0; k < 4; k++)
+			rgba[i + k] = sums[i + k] / n;
+	}
+}
+
+KernelTable table()
+{
+	KernelTable t;
+	t.isa = ISA_NAME;
+	t.width = W;
+	t.concentricSampleDisk = concentricSampleDisk;
+	t.cosineSampleHemisphere = cosineSampleHemisphere;
+	t.orthonormalBasis = orthonormalBasis;
+	t.schlickFresnel = schlickFresnel;
+	t.blinnPhongDG = blinnPhongDG;
+	t.equirectangular = equirectangular;
+	t.generateCameraRays = generateCameraRays;
+	t.resolveAccumulated = resolveAccumulated;
+	return t;
+}
+} // namespace KERNEL_ISA
+} // namespace simd
+} // namespace pathtracer
@@ -0,0 +1,17 @@
+///////////////////////////////////////////////////////////////////////////
+// The SSE2 kernels, the baseline that every x86-64 CPU supports
+///////////////////////////////////////////////////////////////////////////
+#define KERNEL_ISA sse2
+#include "kernels_impl.h"
+
+namespace pathtracer
+{
+namespace simd
+{
+bool getKernelsSSE2(KernelTable& table)
+{
+	table = sse2::table();
+	return true;
+}
+} // namespace simd
+} // namespace pathtracer
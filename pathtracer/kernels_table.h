@@ -0,0 +1,36 @@
+#pragma once
+
+namespace pathtracer
+{
+namespace simd
+{
+///////////////////////////////////////////////////////////////////////////
+// The kernels of one instruction set variant. See kernels.h for what
+// each of them does.
+///////////////////////////////////////////////////////////////////////////
+struct KernelTable
+{
+	const char* isa;
+	int width;
+	void (*concentricSampleDisk)(const float* u1, const float* u2, float* dx, float* dy, int count);
+	void (*cosineSampleHemisphere)(const float* u1, const float* u2, float* x, float* y, float* z, int count);
+	void (*orthonormalBasis)(const float* nx, const float* ny, const float* nz, float* tx, float* ty, float* tz,
+	                         float* bx, float* by, float* bz, int count);
+	void (*schlickFresnel)(const float* R0, const float* cos_theta, float* F, int count);
+	void (*blinnPhongDG)(const float* shininess, const float* n_wh, const float* n_wo, const float* n_wi,
+	                     const float* wo_wh, float* D, float* G, int count);
+	void (*equirectangular)(const float* x, const float* y, const float* z, float* u, float* v, int count);
+	void (*generateCameraRays)(const float* inverse_view_projection, const float* camera, const float* sx,
+	                           const float* sy, float* dx, float* dy, float* dz, int count);
+	void (*resolveAccumulated)(const float* sums, float* rgba, int count);
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Get the table of a variant. Returns false if the variant was not built
+// with the flags for its instruction set.
+///////////////////////////////////////////////////////////////////////////
+bool getKernelsSSE2(KernelTable& table);
+bool getKernelsAVX2(KernelTable& table);
+bool getKernelsAVX512(KernelTable& table);
+} // namespace simd
+} // namespace pathtracer
@@ -0,0 +1,218 @@
+#include "lights.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A node in the light BVH. Interior nodes have two children, leaves
+// reference exactly one light.
+///////////////////////////////////////////////////////////////////////////
+struct LightNode
+{
+	vec3 bbox_min;
+	vec3 bbox_max;
+	float power;
+	// A cone around 'axis' that holds the directions the lights of the
+	// subtree shine in. M_PI for lights that shine in all directions.
+	vec3 axis;
+	float cone_angle;
+	int left = -1, right = -1;
+	int light_index = -1;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Global variables
+///////////////////////////////////////////////////////////////////////////
+vector<PointLight> lights;
+static vector<LightNode> light_tree;
+
+static float lightPower(const PointLight& light)
+{
+	return light.intensity_multiplier * luminance(light.color);
+}
+
+// How much of a light goes out in a direction, 1 for all but spot lights
+static float spotFactor(const PointLight& light, const vec3& direction)
+{
+	if(light.cone_angle >= M_PI)
+		return 1.0f;
+	float cos_angle = dot(direction, normalize(light.direction));
+	float cos_outer = cos(light.cone_angle);
+	float cos_inner = cos(std::max(0.0f, light.cone_angle - light.cone_falloff));
+	return smoothstep(cos_outer, std::max(cos_inner, cos_outer + EPSILON), cos_angle);
+}
+
+// The smallest cone that holds both cones
+static void mergeCones(vec3& axis, float& angle, const vec3& other_axis, float other_angle)
+{
+	if(angle >= M_PI || other_angle >= M_PI)
+	{
+		angle = M_PI;
+		return;
+	}
+	const float between = acos(clamp(dot(axis, other_axis), -1.0f, 1.0f));
+	if(std::min(between + other_angle, float(M_PI)) <= angle)
+		return;
+	if(std::min(between + angle, float(M_PI)) <= other_angle)
+	{
+		axis = other_axis;
+		angle = other_angle;
+		return;
+	}
+	const float merged = 0.5f * (angle + between + other_angle);
+	const vec3 towards = other_axis - dot(axis, other_axis) * axis;
+	if(merged >= M_PI || dot(towards, towards) < EPSILON * EPSILON)
+	{
+		angle = M_PI;
+		return;
+	}
+	// Turn the axis towards the other one, so that both cones fit
+	const float turn = merged - angle;
+	axis = normalize(cos(turn) * axis + sin(turn) * normalize(towards));
+	angle = merged;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Recursively split the lights in [begin, end) along the longest axis of
+// their bounding box and return the index of the created node.
+///////////////////////////////////////////////////////////////////////////
+static int buildNode(vector<int>& indices, int begin, int end)
+{
+	LightNode node;
+	node.bbox_min = vec3(FLT_MAX);
+	node.bbox_max = vec3(-FLT_MAX);
+	node.power = 0.0f;
+	for(int i = begin; i < end; i++)
+	{
+		const PointLight& light = lights[indices[i]];
+		node.bbox_min = min(node.bbox_min, light.position);
+		node.bbox_max = max(node.bbox_max, light.position);
+		node.power += lightPower(light);
+		const bool spot = light.cone_angle < M_PI;
+		const vec3 axis = spot ? normalize(light.direction) : vec3(0.0f, 0.0f, 1.0f);
+		const float angle = spot ? light.cone_angle : float(M_PI);
+		if(i == begin)
+		{
+			node.axis = axis;
+			node.cone_angle = angle;
+		}
+		else
+		{
+			mergeCones(node.axis, node.cone_angle, axis, angle);
+		}
+	}
+	const int node_index = int(light_tree.size());
+	light_tree.push_back(node);
+	if(end - begin == 1)
+	{
+		light_tree[node_index].light_index = indices[begin];
+		return node_index;
+	}
+
+	vec3 extent = node.bbox_max - node.bbox_min;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	int middle = (begin + end) / 2;
+	nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+	            [axis](int a, int b) { return lights[a].position[axis] < lights[b].position[axis]; });
+	int left = buildNode(indices, begin, middle);
+	int right = buildNode(indices, middle, end);
+	light_tree[node_index].left = left;
+	light_tree[node_index].right = right;
+	return node_index;
+}
+
+void buildLightTree()
+{
+	light_tree.clear();
+	if(lights.empty())
+		return;
+	vector<int> indices(lights.size());
+	for(int i = 0; i < int(lights.size()); i++)
+		indices[i] = i;
+	light_tree.reserve(2 * lights.size());
+	buildNode(indices, 0, int(lights.size()));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Estimate of how much a subtree contributes to a shading point: the
+// total power over the squared distance to the box, where the distance is
+// clamped to the size of the box so that a point inside or next to a large
+// cluster does not get an unbounded estimate. Boxes that lie entirely
+// below the surface can not contribute, and neither can spot lights whose
+// cones, widened by the angle the box covers, miss the point.
+///////////////////////////////////////////////////////////////////////////
+static float importance(const LightNode& node, const vec3& position, const vec3& normal)
+{
+	vec3 center = 0.5f * (node.bbox_min + node.bbox_max);
+	vec3 half_extent = 0.5f * (node.bbox_max - node.bbox_min);
+	vec3 to_center = center - position;
+	if(dot(to_center, normal) + dot(abs(normal), half_extent) <= 0.0f)
+		return 0.0f;
+	const float center_distance2 = dot(to_center, to_center);
+	const float radius2 = dot(half_extent, half_extent);
+	if(node.cone_angle < M_PI && center_distance2 > radius2)
+	{
+		const float center_distance = sqrt(center_distance2);
+		const float angle = acos(clamp(dot(node.axis, -to_center / center_distance), -1.0f, 1.0f));
+		const float box_angle = asin(sqrt(radius2) / center_distance);
+		if(angle - box_angle >= node.cone_angle)
+			return 0.0f;
+	}
+	float distance2 = std::max(std::max(center_distance2, radius2), EPSILON);
+	float cosine = 1.0f;
+	float spot = 1.0f;
+	if(node.light_index >= 0)
+	{
+		cosine = std::max(0.0f, dot(normal, to_center) / sqrt(distance2));
+		spot = spotFactor(lights[node.light_index], -to_center / sqrt(distance2));
+	}
+	return node.power * cosine * spot / distance2;
+}
+
+int sampleLight(const vec3& position, const vec3& normal, float u, float& pmf)
+{
+	pmf = 0.0f;
+	if(light_tree.empty())
+		return -1;
+	int node_index = 0;
+	float p = 1.0f;
+	while(light_tree[node_index].light_index < 0)
+	{
+		const LightNode& node = light_tree[node_index];
+		float importance_left = importance(light_tree[node.left], position, normal);
+		float importance_right = importance(light_tree[node.right], position, normal);
+		float sum = importance_left + importance_right;
+		if(sum <= 0.0f)
+			return -1;
+		float p_left = importance_left / sum;
+		// Reuse the random number for the next level by rescaling it
+		if(u < p_left)
+		{
+			u = std::min(u / p_left, 0.99999994f);
+			p *= p_left;
+			node_index = node.left;
+		}
+		else
+		{
+			u = std::min((u - p_left) / (1.0f - p_left), 0.99999994f);
+			p *= 1.0f - p_left;
+			node_index = node.right;
+		}
+	}
+	pmf = p;
+	return light_tree[node_index].light_index;
+}
+
+vec3 lightRadiance(const PointLight& light, const vec3& position)
+{
+	vec3 to_light = light.position - position;
+	const float distance2 = dot(to_light, to_light);
+	const float falloff_factor = 1.0f / distance2;
+	const float spot_factor = spotFactor(light, -to_light / sqrt(distance2));
+	return light.intensity_multiplier * light.color * falloff_factor * spot_factor;
+}
+} // namespace pathtracer
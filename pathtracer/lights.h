@@ -0,0 +1,26 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "Pathtracer.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Build the light BVH from the current contents of 'lights'. Must be
+// called whenever lights are added, moved or change intensity.
+///////////////////////////////////////////////////////////////////////////
+void buildLightTree();
+
+///////////////////////////////////////////////////////////////////////////
+// Pick one light for a shading point by traversing the light BVH, going
+// left or right with probability proportional to the estimated
+// contribution of each subtree. Returns the light index and the
+// probability (pmf) that it was chosen, or -1 if no light contributes.
+///////////////////////////////////////////////////////////////////////////
+int sampleLight(const vec3& position, const vec3& normal, float u, float& pmf);
+
+///////////////////////////////////////////////////////////////////////////
+// The radiance arriving at 'position' from a light, not accounting for
+// visibility. Handles the cone of spot lights.
+///////////////////////////////////////////////////////////////////////////
+vec3 lightRadiance(const PointLight& light, const vec3& position);
+} // namespace pathtracer
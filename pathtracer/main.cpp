@@ -10,8 +10,17 @@
 #include <glm/gtx/transform.hpp>
 #include <Model.h>
 #include <string>
+#include <algorithm>
 #include "Pathtracer.h"
 #include "embree.h"
+#include "lights.h"
+#include "guiding.h"
+#include "photonmap.h"
+#include "radiancecache.h"
+#include "stats.h"
+#include "benchmark.h"
+#include "batch.h"
+#include "service.h"
 
 using namespace glm;
 using namespace std;
@@ -35,9 +44,20 @@ bool g_isMouseDragging = false;
 GLuint shaderProgram;
 
 ///////////////////////////////////////////////////////////////////////////////
-// GL texture to put pathtracing result into
+// GL texture to put pathtracing result into. The texture is allocated once
+// per resize and then updated through a ring of pixel buffer objects, so
+// that filling one buffer does not stall on the upload of the previous.
 ///////////////////////////////////////////////////////////////////////////////
 uint32_t pathtracer_result_txt_id;
+const int NUM_PIXEL_BUFFERS = 3;
+GLuint pixel_buffers[NUM_PIXEL_BUFFERS];
+int current_pixel_buffer = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Display settings, applied in simple.frag
+///////////////////////////////////////////////////////////////////////////////
+float exposure = 1.0f;
+int tonemapper = 0; // 0 = Clamp, 1 = Reinhard, 2 = Filmic
 
 ///////////////////////////////////////////////////////////////////////////////
 // Camera parameters.
@@ -54,20 +74,18 @@ vec3 worldUp(0.0f, 1.0f, 0.0f);
 vector<pair<labhelper::Model*, mat4>> models;
 
 ///////////////////////////////////////////////////////////////////////////////
-// Load shaders, environment maps, models and so on
+// Set up the settings, lights, environment map and models of the scene. This
+// needs no GL context.
 ///////////////////////////////////////////////////////////////////////////////
-void initialize()
+void initializeScene()
 {
-	///////////////////////////////////////////////////////////////////////////
-	// Load shader program
-	///////////////////////////////////////////////////////////////////////////
-	shaderProgram = labhelper::loadShaderProgram("../pathtracer/simple.vert", "../pathtracer/simple.frag");
-
 	///////////////////////////////////////////////////////////////////////////
 	// Initial path-tracer settings
 	///////////////////////////////////////////////////////////////////////////
 	pathtracer::settings.max_bounces = 8;
 	pathtracer::settings.max_paths_per_pixel = 0; // 0 = Infinite
+	pathtracer::settings.light_samples = 1;
+	pathtracer::settings.rasterize_primary_visibility = false;
 #ifdef _DEBUG
 	pathtracer::settings.subsampling = 8;	// CHANGE SAMPLING
 #else
@@ -77,9 +95,12 @@ void initialize()
 	///////////////////////////////////////////////////////////////////////////
 	// Set up light
 	///////////////////////////////////////////////////////////////////////////
-	pathtracer::point_light.intensity_multiplier = 2500.0f;
-	pathtracer::point_light.color = vec3(1.f, 1.f, 1.f);
-	pathtracer::point_light.position = vec3(10.0f, 40.0f, 10.0f);
+	pathtracer::PointLight point_light;
+	point_light.intensity_multiplier = 2500.0f;
+	point_light.color = vec3(1.f, 1.f, 1.f);
+	point_light.position = vec3(10.0f, 40.0f, 10.0f);
+	pathtracer::lights.push_back(point_light);
+	pathtracer::buildLightTree();
 
 	///////////////////////////////////////////////////////////////////////////
 	// Load environment map
@@ -104,6 +125,21 @@ void initialize()
 		pathtracer::addModel(m.first, m.second);
 	}
 	pathtracer::buildBVH();
+	pathtracer::resetGuiding();
+	pathtracer::resetRadianceCache();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load shaders, environment maps, models and so on
+///////////////////////////////////////////////////////////////////////////////
+void initialize()
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Load shader program
+	///////////////////////////////////////////////////////////////////////////
+	shaderProgram = labhelper::loadShaderProgram("../pathtracer/simple.vert", "../pathtracer/simple.frag");
+
+	initializeScene();
 
 	///////////////////////////////////////////////////////////////////////////
 	// Generate result texture
@@ -115,6 +151,7 @@ void initialize()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glGenBuffers(NUM_PIXEL_BUFFERS, pixel_buffers);
 
 	///////////////////////////////////////////////////////////////////////////
 	// This is INCORRECT! But an easy way to get us a brighter image that
@@ -123,6 +160,94 @@ void initialize()
 	//glEnable(GL_FRAMEBUFFER_SRGB);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// (Re)allocate the result texture and the pixel buffers to match the size of
+// the pathtraced image. Storage is half float; tonemapping is done on the GPU.
+///////////////////////////////////////////////////////////////////////////////
+void resizeResultTexture()
+{
+	const int width = pathtracer::rendered_image.width;
+	const int height = pathtracer::rendered_image.height;
+	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	for(int i = 0; i < NUM_PIXEL_BUFFERS; i++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffers[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, width * height * sizeof(vec4), nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stream the tiles that received new samples into the result texture. The
+// tiles are resolved into the next pixel buffer in the ring and each run of
+// dirty tiles on a tile row is then uploaded with a single glTexSubImage2D.
+///////////////////////////////////////////////////////////////////////////////
+void uploadResultTexture()
+{
+	pathtracer::Image& image = pathtracer::rendered_image;
+	const int tile_size = pathtracer::Image::tile_size;
+	if(std::find(image.dirty_tiles.begin(), image.dirty_tiles.end(), 1) == image.dirty_tiles.end())
+	{
+		return;
+	}
+
+	current_pixel_buffer = (current_pixel_buffer + 1) % NUM_PIXEL_BUFFERS;
+	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffers[current_pixel_buffer]);
+	const size_t buffer_size = image.width * image.height * sizeof(vec4);
+	vec4* mapped = (vec4*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, buffer_size,
+	                                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(mapped == nullptr)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+	for(int ty = 0; ty < image.tiles_y; ty++)
+	{
+		for(int tx = 0; tx < image.tiles_x; tx++)
+		{
+			if(!image.dirty_tiles[ty * image.tiles_x + tx])
+				continue;
+			const int x0 = tx * tile_size, x1 = std::min(x0 + tile_size, image.width);
+			const int y0 = ty * tile_size, y1 = std::min(y0 + tile_size, image.height);
+			for(int y = y0; y < y1; y++)
+			{
+				image.resolve(&mapped[y * image.width + x0], y * image.width + x0, x1 - x0);
+			}
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, image.width);
+	for(int ty = 0; ty < image.tiles_y; ty++)
+	{
+		int tx = 0;
+		while(tx < image.tiles_x)
+		{
+			if(!image.dirty_tiles[ty * image.tiles_x + tx])
+			{
+				tx++;
+				continue;
+			}
+			int run_end = tx;
+			while(run_end < image.tiles_x && image.dirty_tiles[ty * image.tiles_x + run_end])
+			{
+				image.dirty_tiles[ty * image.tiles_x + run_end] = 0;
+				run_end++;
+			}
+			const int x0 = tx * tile_size, x1 = std::min(run_end * tile_size, image.width);
+			const int y0 = ty * tile_size, y1 = std::min(y0 + tile_size, image.height);
+			const size_t offset = (y0 * image.width + x0) * sizeof(vec4);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, GL_RGBA, GL_FLOAT, (void*)offset);
+			tx = run_end;
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
 void display(void)
 {
 	{ ///////////////////////////////////////////////////////////////////////
@@ -136,8 +261,9 @@ void display(void)
 		{
 			pathtracer::resize(w, h);
 			windowWidth = w;
-			windowWidth = h;
+			windowHeight = h;
 			old_subsampling = pathtracer::settings.subsampling;
+			resizeResultTexture();
 		}
 	}
 
@@ -154,8 +280,7 @@ void display(void)
 	///////////////////////////////////////////////////////////////////////////
 	// Copy pathtraced image to texture for display
 	///////////////////////////////////////////////////////////////////////////
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, pathtracer::rendered_image.width,
-	             pathtracer::rendered_image.height, 0, GL_RGB, GL_FLOAT, pathtracer::rendered_image.getPtr());
+	uploadResultTexture();
 
 	///////////////////////////////////////////////////////////////////////////
 	// Render a fullscreen quad, textured with our pathtraced image.
@@ -167,6 +292,8 @@ void display(void)
 	glEnable(GL_CULL_FACE);
 	SDL_GetWindowSize(g_window, &windowWidth, &windowHeight);
 	glUseProgram(shaderProgram);
+	labhelper::setUniformSlow(shaderProgram, "exposure", exposure);
+	labhelper::setUniformSlow(shaderProgram, "tonemapper", tonemapper);
 	labhelper::drawFullScreenQuad();
 }
 
@@ -309,12 +436,121 @@ void gui()
 		ImGui::SliderInt("Subsampling", &pathtracer::settings.subsampling, 1, 16);
 		ImGui::SliderInt("Max Bounces", &pathtracer::settings.max_bounces, 0, 16);
 		ImGui::SliderInt("Max Paths Per Pixel", &pathtracer::settings.max_paths_per_pixel, 0, 1024);
+		if(ImGui::Checkbox("Rasterize primary visibility", &pathtracer::settings.rasterize_primary_visibility))
+		{
+			pathtracer::restart();
+		}
+		ImGui::SliderFloat("Exposure", &exposure, 0.0f, 10.0f);
+		ImGui::Combo("Tonemapper", &tonemapper, "Clamp\0Reinhard\0Filmic\0");
 		if(ImGui::Button("Restart Pathtracing"))
 		{
 			pathtracer::restart();
 		}
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	// Photon mapped caustics
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Caustics", "caustics_ch", true, false))
+	{
+		pathtracer::CausticSettings& caustics = pathtracer::caustic_settings;
+		bool changed = ImGui::Checkbox("Photon mapped caustics", &caustics.enabled);
+		changed |= ImGui::SliderInt("Photons per pass", &caustics.photons_per_pass, 1000, 1000000);
+		changed |= ImGui::SliderFloat("Initial radius", &caustics.initial_radius, 0.01f, 5.0f);
+		changed |= ImGui::SliderFloat("Radius reduction (alpha)", &caustics.alpha, 0.1f, 0.99f);
+		if(changed)
+		{
+			pathtracer::restart();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Radiance cache
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Radiance cache", "radiance_cache_ch", true, false))
+	{
+		pathtracer::RadianceCacheSettings& cache = pathtracer::radiance_cache_settings;
+		bool changed = ImGui::Checkbox("Enable radiance cache", &cache.enabled);
+		bool clear = ImGui::SliderFloat("Cell size", &cache.cell_size, 0.05f, 5.0f);
+		changed |= ImGui::SliderInt("Min samples per cell", &cache.min_samples, 1, 256);
+		clear |= ImGui::Button("Clear cache");
+		if(clear)
+		{
+			pathtracer::resetRadianceCache();
+		}
+		if(changed || clear)
+		{
+			pathtracer::restart();
+		}
+		ImGui::Text("Used cells: %d, dropped samples: %d", pathtracer::radiance_cache_stats.used_cells,
+		            pathtracer::radiance_cache_stats.dropped_inserts);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Path guiding
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Path guiding", "guiding_ch", true, false))
+	{
+		pathtracer::GuidingSettings& guiding = pathtracer::guiding_settings;
+		pathtracer::GuidingStats& stats = pathtracer::guiding_stats;
+		bool retrain = ImGui::Checkbox("Enable guiding", &guiding.enabled);
+		retrain |= ImGui::SliderInt("Training iterations", &guiding.training_iterations, 1, 10);
+		retrain |= ImGui::SliderInt("Spatial threshold", &guiding.spatial_threshold, 100, 20000);
+		ImGui::SliderFloat("BSDF sampling fraction", &guiding.bsdf_sampling_fraction, 0.1f, 1.0f);
+		retrain |= ImGui::Button("Retrain");
+		if(retrain)
+		{
+			pathtracer::resetGuiding();
+			pathtracer::restart();
+		}
+		ImGui::Text("Iteration %d%s", stats.iteration, stats.training ? " (training)" : "");
+		ImGui::Text("Training passes: %.1f ms, refinement: %.1f ms", stats.training_pass_ms, stats.refine_ms);
+		ImGui::Text("Spatial leaves: %d, directional nodes: %d", stats.spatial_leaves, stats.directional_nodes);
+		ImGui::Text("Last pass: %.1f ms, variance %.5f", stats.last_pass_ms, stats.last_pass_variance);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Render statistics of the last pass
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Statistics", "statistics_ch", true, false))
+	{
+		const pathtracer::PassStats& stats = pathtracer::pass_stats;
+		ImGui::Text("Pass %d: %.1f ms (photons %.1f ms), %.2f Mrays/s", stats.pass, stats.pass_ms, stats.photon_ms,
+		            stats.mrays_per_second);
+		ImGui::Text("Rays: %llu primary, %llu bounce, %llu shadow, %llu photon",
+		            (unsigned long long)stats.primary_rays, (unsigned long long)stats.bounce_rays,
+		            (unsigned long long)stats.shadow_rays, (unsigned long long)stats.photon_rays);
+		if(stats.rasterized_primaries > 0)
+		{
+			ImGui::Text("Rasterized %llu primary hits in %.1f ms", (unsigned long long)stats.rasterized_primaries,
+			            stats.raster_ms);
+		}
+		ImGui::Text("Average path length: %.2f", stats.average_path_length);
+		if(pathtracer::timing_stats)
+		{
+			ImGui::Text("Embree: %.1f ms, shading: %.1f ms (all threads)", stats.embree_ms, stats.shading_ms);
+		}
+		ImGui::Text("SIMD kernels: %s", stats.kernel_isa ? stats.kernel_isa : "-");
+		if(pathtracer::timing_stats && !stats.thread_busy_ms.empty())
+		{
+			ImGui::PlotHistogram("Busy ms per thread", &stats.thread_busy_ms[0], int(stats.thread_busy_ms.size()),
+			                     0, nullptr, 0.0f, stats.pass_ms, ImVec2(0, 60));
+		}
+		static char log_filename[256] = "pathtracer_stats.csv";
+		ImGui::InputText("Log file (.csv or .json)", log_filename, 256);
+		if(!pathtracer::statsLogOpen())
+		{
+			if(ImGui::Button("Start logging"))
+			{
+				pathtracer::startStatsLog(log_filename);
+			}
+		}
+		else if(ImGui::Button("Stop logging"))
+		{
+			pathtracer::stopStatsLog();
+		}
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	// Choose a model to modify
 	///////////////////////////////////////////////////////////////////////////
@@ -373,13 +609,23 @@ void gui()
 			{
 				material.m_name = name;
 			}
-			ImGui::ColorEdit3("Color", &material.m_color.x);
-			ImGui::SliderFloat("Reflectivity", &material.m_reflectivity, 0.0f, 1.0f);
-			ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
-			ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
-			ImGui::SliderFloat("shininess", &material.m_shininess, 0.0f, 25000.0f);
-			ImGui::SliderFloat("Emission", &material.m_emission, 0.0f, 10.0f);
-			ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
+			bool material_changed = ImGui::ColorEdit3("Color", &material.m_color.x);
+			material_changed |= ImGui::SliderFloat("Reflectivity", &material.m_reflectivity, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("shininess", &material.m_shininess, 0.0f, 25000.0f);
+			material_changed |= ImGui::SliderFloat("Emission", &material.m_emission, 0.0f, 10.0f);
+			material_changed |= ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
+			if(ImGui::Checkbox("Casts shadows", &material.m_casts_shadows))
+			{
+				pathtracer::updateGeometryMasks();
+				material_changed = true;
+			}
+			// Cached radiance is only valid for the materials it was computed with
+			if(material_changed)
+			{
+				pathtracer::resetRadianceCache();
+			}
 
 			///////////////////////////////////////////////////////////////////////////
 			// A button for saving your results
@@ -396,10 +642,26 @@ void gui()
 	///////////////////////////////////////////////////////////////////////////
 	if(ImGui::CollapsingHeader("Light sources", "lights_ch", true, true))
 	{
-		ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier, 0.0f, 10.0f);
-		ImGui::ColorEdit3("Point light color", &pathtracer::point_light.color.x);
-		ImGui::SliderFloat("Point light intensity multiplier", &pathtracer::point_light.intensity_multiplier,
-		                   0.0f, 10000.0f);
+		bool light_changed =
+		    ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier, 0.0f, 10.0f);
+		ImGui::SliderInt("Light samples", &pathtracer::settings.light_samples, 1, 16);
+		static int light_index = 0;
+		if(!pathtracer::lights.empty())
+		{
+			light_index = std::min(light_index, int(pathtracer::lights.size()) - 1);
+			ImGui::SliderInt("Light", &light_index, 0, int(pathtracer::lights.size()) - 1);
+			pathtracer::PointLight& light = pathtracer::lights[light_index];
+			light_changed |= ImGui::ColorEdit3("Point light color", &light.color.x);
+			light_changed |= ImGui::SliderFloat("Point light intensity multiplier", &light.intensity_multiplier,
+			                                    0.0f, 10000.0f);
+			light_changed |= ImGui::SliderAngle("Spot cone angle", &light.cone_angle, 0.0f, 180.0f);
+			light_changed |= ImGui::SliderAngle("Spot cone falloff", &light.cone_falloff, 0.0f, 90.0f);
+		}
+		if(light_changed)
+		{
+			pathtracer::buildLightTree();
+			pathtracer::resetRadianceCache();
+		}
 	}
 
 	ImGui::End(); // Control Panel
@@ -410,8 +672,132 @@ void gui()
 
 int main(int argc, char* argv[])
 {
+	///////////////////////////////////////////////////////////////////////////
+	// pathtracer --microbenchmark times the SIMD kernels, and needs no window
+	///////////////////////////////////////////////////////////////////////////
+	if(argc > 1 && string(argv[1]) == "--microbenchmark")
+	{
+		return pathtracer::runMicrobenchmark();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// pathtracer --submit <job file> <output.png|.hdr> [port] sends a job to
+	// a server started with --serve, and pathtracer --submit shutdown [port]
+	// stops it. See service.h.
+	///////////////////////////////////////////////////////////////////////////
+	if(argc > 2 && string(argv[1]) == "--submit")
+	{
+		const bool shutdown = string(argv[2]) == "shutdown";
+		const int port_arg = shutdown ? 3 : 4;
+		if(!shutdown && argc < 4)
+		{
+			cout << "Usage: pathtracer --submit <job file> <output> [port]\n";
+			return 1;
+		}
+		return pathtracer::submitRenderJob(argv[2], shutdown ? "" : argv[3],
+		                                   argc > port_arg ? atoi(argv[port_arg]) : pathtracer::DEFAULT_SERVICE_PORT);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// The path tracer reads the models on the CPU only, so they are not
+	// uploaded to the GPU, and the modes that show no window below run
+	// without a GL context
+	///////////////////////////////////////////////////////////////////////////
+	labhelper::loader_settings.upload_to_gpu = false;
+
+	///////////////////////////////////////////////////////////////////////////
+	// pathtracer --benchmark [reference directory] renders the benchmark
+	// scenes and exits
+	///////////////////////////////////////////////////////////////////////////
+	if(argc > 1 && string(argv[1]) == "--benchmark")
+	{
+		return pathtracer::runBenchmark(argc > 2 ? argv[2] : "../scenes");
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// pathtracer --batch <camera path> [--output frame_%04d.png]
+	// [--size 640x360] [--samples 256] [--views 4] renders every camera of the
+	// path with the scene of initializeScene(), and exits
+	///////////////////////////////////////////////////////////////////////////
+	if(argc > 2 && string(argv[1]) == "--batch")
+	{
+		pathtracer::BatchSettings batch_settings;
+		batch_settings.exposure = exposure;
+		batch_settings.tonemapper = tonemapper;
+		for(int i = 3; i + 1 < argc; i += 2)
+		{
+			string option = argv[i], value = argv[i + 1];
+			if(option == "--output")
+				batch_settings.output_pattern = value;
+			else if(option == "--size")
+			{
+				int width, height;
+				if(sscanf(value.c_str(), "%dx%d", &width, &height) != 2 || width < 1 || height < 1
+				   || width > 16384 || height > 16384)
+				{
+					cout << "ERROR: --size must be <width>x<height>, between 1 and 16384, not \"" << value
+					     << "\"\n";
+					return 1;
+				}
+				batch_settings.width = width;
+				batch_settings.height = height;
+			}
+			else if(option == "--samples")
+				batch_settings.samples = atoi(value.c_str());
+			else if(option == "--views")
+				batch_settings.views_in_flight = atoi(value.c_str());
+			else
+				cout << "Ignoring unknown option " << option << "\n";
+		}
+		initializeScene();
+		vector<pathtracer::BatchCamera> cameras;
+		int result = 1;
+		if(pathtracer::loadCameraPath(argv[2], cameras))
+		{
+			result = pathtracer::renderBatch(cameras, batch_settings);
+		}
+		for(auto& m : models)
+		{
+			labhelper::freeModel(m.first);
+		}
+		return result;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// pathtracer --serve [port] renders jobs sent over a local socket until
+	// it is told to shut down. The scene of initializeScene() stays the
+	// default environment and lights of the jobs.
+	///////////////////////////////////////////////////////////////////////////
+	if(argc > 1 && string(argv[1]) == "--serve")
+	{
+		initializeScene();
+		int result = pathtracer::runRenderService(argc > 2 ? atoi(argv[2]) : pathtracer::DEFAULT_SERVICE_PORT);
+		for(auto& m : models)
+		{
+			labhelper::freeModel(m.first);
+		}
+		return result;
+	}
+
 	g_window = labhelper::init_window_SDL("Pathtracer", 1280, 720);
 
+	///////////////////////////////////////////////////////////////////////////
+	// pathtracer --layoutbenchmark [obj files] times the vertex stage of
+	// drawing the models with each vertex layout and format
+	///////////////////////////////////////////////////////////////////////////
+	if(argc > 1 && string(argv[1]) == "--layoutbenchmark")
+	{
+		vector<string> files(argv + 2, argv + argc);
+		if(files.empty())
+		{
+			files = { "../scenes/NewShip.obj", "../scenes/BigSphere.obj", "../scenes/wheatley.obj",
+			          "../scenes/city.obj",    "../scenes/landingpad2.obj" };
+		}
+		int result = labhelper::benchmarkVertexLayouts(files);
+		labhelper::shutDown(g_window);
+		return result;
+	}
+
 	initialize();
 
 	bool stopRendering = false;
@@ -1,5 +1,6 @@
 #include "material.h"
 #include "sampling.h"
+#include "kernels.h"
 
 namespace pathtracer
 {
@@ -17,6 +18,7 @@ vec3 Diffuse::f(const vec3& wi, const vec3& wo, const vec3& n)
 
 vec3 Diffuse::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 {
+	sampled_specular = false;
 	vec3 tangent = normalize(perpendicular(n));
 	vec3 bitangent = normalize(cross(tangent, n));
 	vec3 sample = cosineSampleHemisphere();
@@ -28,6 +30,11 @@ vec3 Diffuse::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 	return f(wi, wo, n);
 }
 
+float Diffuse::pdf(const vec3& wi, const vec3& /*wo*/, const vec3& n)
+{
+	return max(0.0f, dot(n, wi)) / M_PI;
+}
+
 // Refraction Project
 vec3 Refraction::f(const vec3& wi, const vec3& wo, const vec3& n)
 {
@@ -36,6 +43,7 @@ vec3 Refraction::f(const vec3& wi, const vec3& wo, const vec3& n)
 
 vec3 Refraction::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 {
+	sampled_specular = true;
 	p = 1.0f;
 	
 	float cosi = clamp(-1.0f, 1.0f, dot(-wo, n));
@@ -62,6 +70,11 @@ vec3 Refraction::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 	return color;
 }
 
+float Refraction::pdf(const vec3& /*wi*/, const vec3& /*wo*/, const vec3& /*n*/)
+{
+	return 0.0f;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // A Blinn Phong Dielectric Microfacet BRFD
 ///////////////////////////////////////////////////////////////////////////
@@ -79,7 +92,7 @@ vec3 BlinnPhong::refraction_brdf(const vec3& wi, const vec3& wo, const vec3& n)
 	}
 	vec3 wh = normalize(wi + wo);
 	float wh_wi = max(0.0f, dot(wh, wi));
-	float F_wi = R0 + (1.0f - R0) * pow(1.0f - wh_wi, 5.0f);
+	float F_wi = schlickFresnel(R0, wh_wi);
 
 
 	return (1 - F_wi) * refraction_layer->f(wi, wo, n);
@@ -101,7 +114,7 @@ vec3 BlinnPhong::reflection_brdf(const vec3& wi, const vec3& wo, const vec3& n)
 	// Computing D(wh), G(wi, wo) and F(wi).
 	float D_wh = ((shininess + 2.0f) / (2.0f * M_PI)) * pow(max(0.0f, dot(n, wh)), shininess);
 	float G_wi_wo = min(1.0f, min(2.0f * max(0.00001f, dot(n, wh) * dot(n, wo)) / max(0.00001f, dot(wo, wh)), 2.0f * max(0.00001f, dot(n, wh) * dot(n, wi)) / max(0.00001f, dot(wo, wh))));
-	float F_wi = R0 + (1.0f - R0) * pow(max(0.0f, 1.0f - dot(wh, wi)), 5.0f);
+	float F_wi = schlickFresnel(R0, min(1.0f, dot(wh, wi)));
 
 	float brdf = (F_wi * D_wh * G_wi_wo) / (4 * max(0.0001f, dot(n, wo) * dot(n, wi)));
 
@@ -115,6 +128,7 @@ vec3 BlinnPhong::f(const vec3& wi, const vec3& wo, const vec3& n)
 
 vec3 BlinnPhong::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 {
+	sampled_specular = false;
 	vec3 tangent = normalize(perpendicular(n));
 	vec3 bitangent = normalize(cross(tangent, n));
 	float phi = 2.0f * M_PI * randf();
@@ -145,16 +159,36 @@ vec3 BlinnPhong::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 		}
 		// Sample a direction for the underlying layer
 		vec3 brdf = refraction_layer->sample_wi(wi, wo, n, p);
+		sampled_specular = refraction_layer->sampled_specular;
 		p *= 0.5f;
 
 		// We need to attenuate the refracted brdf with (1 - F)
-		float F = R0 + (1.0f - R0) * pow(max(0.0f, 1.0f - abs(dot(wh, wi))), 5.0f);
+		float F = schlickFresnel(R0, min(1.0f, abs(dot(wh, wi))));
 
 		return (1.0f - F) * brdf;
 
 	}
 }
 
+float BlinnPhong::reflection_pdf(const vec3& wi, const vec3& wo, const vec3& n)
+{
+	if(dot(wo, n) <= 0.0f || length(wi + wo) < 0.00001f)
+		return 0.0f;
+	vec3 wh = normalize(wi + wo);
+	float p_wh = (shininess + 1.0f) * pow(max(0.0f, dot(n, wh)), shininess) / (2.0f * M_PI);
+	return p_wh / (4.0f * max(0.0001f, dot(wo, wh)));
+}
+
+float BlinnPhong::pdf(const vec3& wi, const vec3& wo, const vec3& n)
+{
+	if(dot(wo, n) <= 0.0f)
+		return 0.0f;
+	float p = 0.5f * reflection_pdf(wi, wo, n);
+	if(refraction_layer != NULL)
+		p += 0.5f * refraction_layer->pdf(wi, wo, n);
+	return p;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // A Blinn Phong Metal Microfacet BRFD (extends the BlinnPhong class)
 ///////////////////////////////////////////////////////////////////////////
@@ -197,6 +231,7 @@ vec3 LinearBlend::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 	{
 		//p *= w;
 		vec3 brdf = bsdf0->sample_wi(wi, wo, n, p);
+		sampled_specular = bsdf0->sampled_specular;
 
 		return brdf;
 	}
@@ -204,11 +239,21 @@ vec3 LinearBlend::sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p)
 	{
 		//p *= (1.0f - w);
 		vec3 brdf = bsdf1->sample_wi(wi, wo, n, p);
+		sampled_specular = bsdf1->sampled_specular;
 
 		return brdf;
 	}
 }
 
+float LinearBlend::pdf(const vec3& wi, const vec3& wo, const vec3& n)
+{
+	if(bsdf0 == NULL || bsdf1 == NULL)
+	{
+		return 0.0f;
+	}
+	return w * bsdf0->pdf(wi, wo, n) + (1.0f - w) * bsdf1->pdf(wi, wo, n);
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // A perfect specular refraction.
 ///////////////////////////////////////////////////////////////////////////
@@ -18,6 +18,12 @@ public:
 	// Sample a suitable direction and return the brdf in that direction as
 	// well as the pdf (~probability) that the direction was chosen.
 	virtual vec3 sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p) = 0;
+	// Return the pdf with which sample_wi() would choose wi. Perfectly
+	// specular lobes can not be hit by another strategy and return 0.
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) = 0;
+	// Set by sample_wi() when the direction came from a perfectly specular
+	// lobe (for which f() and pdf() are zero).
+	bool sampled_specular = false;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -32,6 +38,7 @@ public:
 	}
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) override;
 	virtual vec3 sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p) override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) override;
 };
 
 // Refraction Project
@@ -44,6 +51,7 @@ public:
 	}
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) override;
 	virtual vec3 sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p) override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) override;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -63,6 +71,8 @@ public:
 	virtual vec3 reflection_brdf(const vec3& wi, const vec3& wo, const vec3& n);
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) override;
 	virtual vec3 sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p) override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) override;
+	virtual float reflection_pdf(const vec3& wi, const vec3& wo, const vec3& n);
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -91,6 +101,73 @@ public:
 	LinearBlend(float _w, BRDF* a, BRDF* b) : w(_w), bsdf0(a), bsdf1(b){};
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) override;
 	virtual vec3 sample_wi(vec3& wi, const vec3& wo, const vec3& n, float& p) override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) override;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The material parameters at one point of a surface, i.e. the constants
+// of a labhelper::Material with any textures applied.
+///////////////////////////////////////////////////////////////////////////
+struct SurfaceProperties
+{
+	vec3 color;
+	float reflectivity;
+	float shininess;
+	float metalness;
+	float fresnel;
+	float transparency;
+	// Emitted radiance
+	vec3 emission;
+	SurfaceProperties(const labhelper::Material* m)
+	    : color(m->m_color)
+	    , reflectivity(m->m_reflectivity)
+	    , shininess(m->m_shininess)
+	    , metalness(m->m_metalness)
+	    , fresnel(m->m_fresnel)
+	    , transparency(m->m_transparency)
+	    , emission(m->m_emission * m->m_color)
+	{
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The complete material for a hit: a metal or a dielectric, blended by
+// reflectivity with a blend of refraction and diffuse.
+///////////////////////////////////////////////////////////////////////////
+struct MaterialTree
+{
+	Diffuse diffuse;
+	Refraction refractive;
+	LinearBlend refractive_blend;
+	BlinnPhong dielectric;
+	BlinnPhongMetal metal;
+	LinearBlend metal_blend;
+	LinearBlend reflectivity_blend;
+	MaterialTree(const SurfaceProperties& s)
+	    : diffuse(s.color)
+	    , refractive(s.color)
+	    , refractive_blend(s.transparency, &refractive, &diffuse)
+	    , dielectric(s.shininess, s.fresnel, &refractive_blend)
+	    , metal(s.color, s.shininess, s.fresnel)
+	    , metal_blend(s.metalness, &metal, &dielectric)
+	    , reflectivity_blend(s.reflectivity, &metal_blend, &refractive_blend)
+	{
+	}
+	MaterialTree(const labhelper::Material* m) : MaterialTree(SurfaceProperties(m))
+	{
+	}
+	// The members point to each other, so the tree must not be copied
+	MaterialTree(const MaterialTree&) = delete;
+	BRDF& root()
+	{
+		return reflectivity_blend;
+	}
+	// The diffuse lobe of root().f(), without the reflections
+	vec3 diffuse_f(const vec3& wi, const vec3& wo, const vec3& n)
+	{
+		return reflectivity_blend.w * (1.0f - metal_blend.w) * dielectric.refraction_brdf(wi, wo, n)
+		       + (1.0f - reflectivity_blend.w) * refractive_blend.f(wi, wo, n);
+	}
 };
 
 } // namespace pathtracer
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include "photonmap.h"
+#include "material.h"
+#include "embree.h"
+#include "lights.h"
+#include "sampling.h"
+#include "texture.h"
+#include "stats.h"
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+///////////////////////////////////////////////////////////////////////////////
+CausticSettings caustic_settings = { false, 100000, 0.5f, 2.0f / 3.0f };
+
+struct Photon
+{
+	vec3 position;
+	vec3 normal;
+	vec3 wi;
+	vec3 power;
+	// Emitted photon index and bounce, makes the order within a grid cell
+	// independent of how the photons were scheduled on threads
+	uint32_t id;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The photons of the current pass, stored in a hashed grid with a cell
+// size of twice the radius. cell_start[h]..cell_start[h+1] are the
+// photons in the cells with hash h.
+///////////////////////////////////////////////////////////////////////////
+static vector<Photon> photons;
+static vector<uint32_t> cell_start;
+static uint32_t hash_mask = 0;
+static float radius = 0.0f;
+static float cell_size = 1.0f;
+static int pass = 0;
+static int emitted_photons = 0;
+static bool have_emissive_triangles = false;
+
+static uint32_t cellHash(const ivec3& c)
+{
+	return (uint32_t(c.x) * 73856093u ^ uint32_t(c.y) * 19349663u ^ uint32_t(c.z) * 83492791u) & hash_mask;
+}
+
+static ivec3 cellOf(const vec3& p)
+{
+	return ivec3(floor(p / cell_size));
+}
+
+void resetCaustics()
+{
+	pass = 0;
+	radius = caustic_settings.initial_radius;
+}
+
+bool causticsCoverEmitters()
+{
+	return caustic_settings.enabled && have_emissive_triangles;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Something that emits photons: a point light or an emissive triangle
+///////////////////////////////////////////////////////////////////////////
+struct Emitter
+{
+	int light_index;
+	EmissiveTriangle triangle;
+	vec3 flux;
+};
+
+static uint32_t nextPowerOfTwo(uint32_t v)
+{
+	uint32_t p = 1;
+	while(p < v)
+		p <<= 1;
+	return p;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Follow one photon. It is stored only when it reaches a non specular
+// surface after at least one specular bounce, and is then terminated,
+// since everything else is handled well by the path tracer.
+///////////////////////////////////////////////////////////////////////////
+static void tracePhoton(Ray ray, vec3 power, uint32_t id, vector<Photon>& stored)
+{
+	bool specular_chain = false;
+	for(int bounce = 0; bounce < settings.max_bounces; bounce++)
+	{
+		threadStats().photon_rays++;
+		// Photons carry light, so they pass through geometry that casts no
+		// shadows, like shadow rays do
+		ray.mask = RAY_MASK_LIGHT;
+		if(!intersect(ray))
+			return;
+		Intersection hit = getIntersection(ray);
+		// Photons carry no ray cone, so textures are sampled at full detail
+		MaterialTree material(evaluateSurface(hit, 0.0f));
+		BRDF& mat = material.root();
+
+		float pdf;
+		vec3 wi;
+		vec3 brdf = mat.sample_wi(wi, hit.wo, hit.shading_normal, pdf);
+		if(specular_chain && !mat.sampled_specular)
+		{
+			Photon photon;
+			photon.position = hit.position;
+			photon.normal = hit.geometry_normal;
+			photon.wi = hit.wo;
+			photon.power = power;
+			photon.id = id * 32 + uint32_t(bounce);
+			stored.push_back(photon);
+			return;
+		}
+		if(!mat.sampled_specular || pdf < 0.00001f)
+			return;
+		specular_chain = true;
+		power *= brdf * abs(dot(wi, hit.shading_normal)) / pdf;
+		if(power == vec3(0.0f))
+			return;
+		ray = Ray(hit.position + (dot(wi, hit.geometry_normal) < 0.0f ? -EPSILON : EPSILON) * hit.geometry_normal,
+		          wi);
+	}
+}
+
+void tracePhotons()
+{
+	if(!caustic_settings.enabled)
+		return;
+
+	///////////////////////////////////////////////////////////////////////
+	// Collect the emitters, and how much power each one emits
+	///////////////////////////////////////////////////////////////////////
+	vector<Emitter> emitters;
+	for(int i = 0; i < int(lights.size()); i++)
+	{
+		Emitter emitter;
+		emitter.light_index = i;
+		emitter.flux = 4.0f * M_PI * lights[i].intensity_multiplier * lights[i].color;
+		emitters.push_back(emitter);
+	}
+	vector<EmissiveTriangle> triangles;
+	getEmissiveTriangles(triangles);
+	have_emissive_triangles = !triangles.empty();
+	for(const EmissiveTriangle& triangle : triangles)
+	{
+		Emitter emitter;
+		emitter.light_index = -1;
+		emitter.triangle = triangle;
+		// Both sides emit the same radiance; pi * area * L per side
+		float area = 0.5f * length(cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+		emitter.flux = 2.0f * M_PI * area * triangle.material->m_emission * triangle.material->m_color;
+		emitters.push_back(emitter);
+	}
+	vector<float> cdf(emitters.size() + 1, 0.0f);
+	for(size_t i = 0; i < emitters.size(); i++)
+		cdf[i + 1] = cdf[i] + luminance(emitters[i].flux);
+	if(emitters.empty() || cdf.back() <= 0.0f)
+	{
+		photons.clear();
+		return;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Shoot the photons in parallel
+	///////////////////////////////////////////////////////////////////////
+	emitted_photons = caustic_settings.photons_per_pass;
+	vector<vector<Photon>> thread_photons(omp_get_max_threads());
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(int i = 0; i < emitted_photons; i++)
+	{
+		seedRandom(uint32_t(i), uint32_t(pass) + settings.seed_offset, RANDOM_STREAM_PHOTONS);
+		float u = randf() * cdf.back();
+		int e = int(upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+		e = clamp(e, 0, int(emitters.size()) - 1);
+		const Emitter& emitter = emitters[e];
+		const float p_emitter = luminance(emitter.flux) / cdf.back();
+		if(p_emitter <= 0.0f)
+			continue;
+
+		Ray ray;
+		vec3 power;
+		if(emitter.light_index >= 0)
+		{
+			// Uniform direction on the sphere, the cone of spot lights
+			// enters through the radiance in that direction
+			const PointLight& light = lights[emitter.light_index];
+			float z = 1.0f - 2.0f * randf();
+			float r = sqrt(std::max(0.0f, 1.0f - z * z));
+			float phi = 2.0f * M_PI * randf();
+			vec3 d(r * cos(phi), r * sin(phi), z);
+			vec3 towards = light.position + d;
+			float spot = luminance(lightRadiance(light, towards)) / std::max(EPSILON, luminance(light.intensity_multiplier * light.color));
+			power = spot * emitter.flux / (float(emitted_photons) * p_emitter);
+			ray = Ray(light.position, d);
+		}
+		else
+		{
+			// Uniform point on the triangle, cosine weighted direction on
+			// a random side
+			const EmissiveTriangle& t = emitter.triangle;
+			float su = sqrt(randf());
+			float b0 = 1.0f - su, b1 = randf() * su;
+			vec3 position = b0 * t.v0 + b1 * t.v1 + (1.0f - b0 - b1) * t.v2;
+			vec3 n = normalize(cross(t.v1 - t.v0, t.v2 - t.v0));
+			if(randf() < 0.5f)
+				n = -n;
+			vec3 tangent = normalize(perpendicular(n));
+			vec3 bitangent = normalize(cross(tangent, n));
+			vec3 s = cosineSampleHemisphere();
+			vec3 d = normalize(s.x * tangent + s.y * bitangent + s.z * n);
+			power = emitter.flux / (float(emitted_photons) * p_emitter);
+			ray = Ray(position + EPSILON * n, d);
+		}
+		tracePhoton(ray, power, uint32_t(i), thread_photons[omp_get_thread_num()]);
+	}
+	photons.clear();
+	for(auto& v : thread_photons)
+		photons.insert(photons.end(), v.begin(), v.end());
+
+	///////////////////////////////////////////////////////////////////////
+	// Shrink the radius as in progressive photon mapping, then sort the
+	// photons into the hashed grid: count per cell, prefix sum, scatter,
+	// and finally order each cell by photon id.
+	///////////////////////////////////////////////////////////////////////
+	if(pass == 0)
+		radius = caustic_settings.initial_radius;
+	else
+		radius *= sqrt((pass + caustic_settings.alpha) / (pass + 1.0f));
+	pass += 1;
+	cell_size = 2.0f * radius;
+	hash_mask = nextPowerOfTwo(std::max<uint32_t>(uint32_t(photons.size()), 1024)) - 1;
+	const int number_of_photons = int(photons.size());
+	vector<uint32_t> hashes(number_of_photons);
+	cell_start.assign(hash_mask + 2, 0);
+	#pragma omp parallel for
+	for(int i = 0; i < number_of_photons; i++)
+	{
+		hashes[i] = cellHash(cellOf(photons[i].position));
+		#pragma omp atomic
+		cell_start[hashes[i] + 1]++;
+	}
+	for(size_t i = 1; i < cell_start.size(); i++)
+		cell_start[i] += cell_start[i - 1];
+	vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+	vector<Photon> sorted(number_of_photons);
+	#pragma omp parallel for
+	for(int i = 0; i < number_of_photons; i++)
+	{
+		uint32_t slot;
+		#pragma omp atomic capture
+		slot = fill[hashes[i]]++;
+		sorted[slot] = photons[i];
+	}
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for(int h = 0; h <= int(hash_mask); h++)
+	{
+		sort(sorted.begin() + cell_start[h], sorted.begin() + cell_start[h + 1],
+		     [](const Photon& a, const Photon& b) { return a.id < b.id; });
+	}
+	photons.swap(sorted);
+}
+
+vec3 causticRadiance(const Intersection& hit, MaterialTree& material)
+{
+	const vec3& position = hit.position;
+	vec3 L(0.0f);
+	if(!caustic_settings.enabled || photons.empty())
+		return L;
+	const float radius2 = radius * radius;
+	ivec3 lo = cellOf(position - vec3(radius));
+	ivec3 hi = cellOf(position + vec3(radius));
+	for(int z = lo.z; z <= hi.z; z++)
+	{
+		for(int y = lo.y; y <= hi.y; y++)
+		{
+			for(int x = lo.x; x <= hi.x; x++)
+			{
+				uint32_t h = cellHash(ivec3(x, y, z));
+				for(uint32_t i = cell_start[h]; i < cell_start[h + 1]; i++)
+				{
+					const Photon& photon = photons[i];
+					vec3 d = photon.position - position;
+					if(dot(d, d) > radius2 || dot(photon.normal, hit.geometry_normal) < 0.5f)
+						continue;
+					L += material.diffuse_f(photon.wi, hit.wo, hit.shading_normal) * photon.power;
+				}
+			}
+		}
+	}
+	return L / (M_PI * radius2);
+}
+} // namespace pathtracer
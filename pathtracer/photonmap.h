@@ -0,0 +1,54 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "material.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+class BRDF;
+
+///////////////////////////////////////////////////////////////////////////
+// Caustics through progressive photon mapping. Every pass, photons are
+// shot from the point lights and emissive surfaces, followed through
+// specular (refractive) chains, and stored where they land on a non
+// specular surface. The path tracer then estimates the caustic radiance
+// at its hits from the photons within a radius that shrinks from pass to
+// pass, so that the estimate converges.
+///////////////////////////////////////////////////////////////////////////
+extern struct CausticSettings
+{
+	bool enabled;
+	int photons_per_pass;
+	// Gather radius of the first pass, in world units
+	float initial_radius;
+	// Controls how fast the radius shrinks (0 < alpha < 1)
+	float alpha;
+} caustic_settings;
+
+///////////////////////////////////////////////////////////////////////////
+// Start over with the initial radius (called on restart())
+///////////////////////////////////////////////////////////////////////////
+void resetCaustics();
+
+///////////////////////////////////////////////////////////////////////////
+// Trace and store the photons for the next pass
+///////////////////////////////////////////////////////////////////////////
+void tracePhotons();
+
+///////////////////////////////////////////////////////////////////////////
+// Are emissive surfaces included in the photon map? If so, paths that
+// reach an emitter through a specular chain after a non specular bounce
+// are already accounted for and must not add the emission again.
+///////////////////////////////////////////////////////////////////////////
+bool causticsCoverEmitters();
+
+///////////////////////////////////////////////////////////////////////////
+// The caustic radiance leaving a hit point towards hit.wo. Photons are
+// only stored at non specular bounces, so only the diffuse lobe of the
+// material is used.
+///////////////////////////////////////////////////////////////////////////
+vec3 causticRadiance(const Intersection& hit, MaterialTree& material);
+} // namespace pathtracer
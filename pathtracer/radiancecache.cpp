@@ -0,0 +1,147 @@
+#include "radiancecache.h"
+#include <atomic>
+#include <memory>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+///////////////////////////////////////////////////////////////////////////////
+RadianceCacheSettings radiance_cache_settings = { false, 0.5f, 16 };
+RadianceCacheStats radiance_cache_stats = {};
+
+///////////////////////////////////////////////////////////////////////////
+// One slot in the table. A key of 0 marks an empty slot; a slot is claimed
+// with a compare and swap on the key, after which the sums are only ever
+// added to.
+///////////////////////////////////////////////////////////////////////////
+struct CacheEntry
+{
+	atomic<uint64_t> key;
+	atomic<float> radiance[3];
+	atomic<uint32_t> count;
+};
+static const int TABLE_SIZE_LOG2 = 20;
+static const uint32_t TABLE_SIZE = 1u << TABLE_SIZE_LOG2;
+static const int MAX_PROBES = 16;
+static unique_ptr<CacheEntry[]> table;
+static atomic<int> used_cells(0);
+static atomic<int> dropped_inserts(0);
+
+static void atomicAdd(atomic<float>& a, float value)
+{
+	float old = a.load(memory_order_relaxed);
+	while(!a.compare_exchange_weak(old, old + value, memory_order_relaxed))
+		;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// 21 bits per grid coordinate and 3 bits for the normal direction. The
+// key is never 0 since the direction is stored plus one.
+///////////////////////////////////////////////////////////////////////////
+static uint64_t makeKey(const vec3& position, const vec3& normal)
+{
+	ivec3 cell = ivec3(floor(position / radiance_cache_settings.cell_size));
+	vec3 a = abs(normal);
+	int axis = (a.x > a.y && a.x > a.z) ? 0 : (a.y > a.z ? 1 : 2);
+	uint64_t direction = uint64_t(axis * 2 + (normal[axis] < 0.0f ? 1 : 0) + 1);
+	const uint64_t mask = (1u << 21) - 1;
+	return (uint64_t(cell.x) & mask) | ((uint64_t(cell.y) & mask) << 21) | ((uint64_t(cell.z) & mask) << 42)
+	       | (direction << 61);
+}
+
+static uint32_t slotOf(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	return uint32_t(key) & (TABLE_SIZE - 1);
+}
+
+void resetRadianceCache()
+{
+	if(!table)
+		table.reset(new CacheEntry[TABLE_SIZE]);
+	for(uint32_t i = 0; i < TABLE_SIZE; i++)
+	{
+		table[i].key.store(0, memory_order_relaxed);
+		table[i].radiance[0].store(0.0f, memory_order_relaxed);
+		table[i].radiance[1].store(0.0f, memory_order_relaxed);
+		table[i].radiance[2].store(0.0f, memory_order_relaxed);
+		table[i].count.store(0, memory_order_relaxed);
+	}
+	used_cells = 0;
+	dropped_inserts = 0;
+	radiance_cache_stats = {};
+}
+
+bool lookupRadianceCache(const vec3& position, const vec3& normal, vec3& radiance)
+{
+	if(!table)
+		return false;
+	const uint64_t key = makeKey(position, normal);
+	uint32_t slot = slotOf(key);
+	for(int probe = 0; probe < MAX_PROBES; probe++, slot = (slot + 1) & (TABLE_SIZE - 1))
+	{
+		uint64_t k = table[slot].key.load(memory_order_acquire);
+		if(k == 0)
+			return false;
+		if(k != key)
+			continue;
+		uint32_t count = table[slot].count.load(memory_order_relaxed);
+		if(count < uint32_t(radiance_cache_settings.min_samples))
+			return false;
+		radiance = vec3(table[slot].radiance[0].load(memory_order_relaxed),
+		                table[slot].radiance[1].load(memory_order_relaxed),
+		                table[slot].radiance[2].load(memory_order_relaxed))
+		           / float(count);
+		return true;
+	}
+	return false;
+}
+
+void insertRadianceCache(const vec3& position, const vec3& normal, const vec3& radiance)
+{
+	if(!table || any(isnan(radiance)) || any(isinf(radiance)))
+		return;
+	const uint64_t key = makeKey(position, normal);
+	uint32_t slot = slotOf(key);
+	for(int probe = 0; probe < MAX_PROBES; probe++, slot = (slot + 1) & (TABLE_SIZE - 1))
+	{
+		uint64_t k = table[slot].key.load(memory_order_acquire);
+		if(k == 0)
+		{
+			uint64_t expected = 0;
+			if(table[slot].key.compare_exchange_strong(expected, key, memory_order_acq_rel))
+			{
+				used_cells++;
+				k = key;
+			}
+			else
+			{
+				k = expected;
+			}
+		}
+		if(k != key)
+			continue;
+		atomicAdd(table[slot].radiance[0], radiance.x);
+		atomicAdd(table[slot].radiance[1], radiance.y);
+		atomicAdd(table[slot].radiance[2], radiance.z);
+		// The count is bumped last, so a reader never divides a sum by a
+		// count that includes samples that are not yet in the sum.
+		table[slot].count.fetch_add(1, memory_order_release);
+		return;
+	}
+	dropped_inserts++;
+}
+
+void updateRadianceCacheStats()
+{
+	radiance_cache_stats.used_cells = used_cells;
+	radiance_cache_stats.dropped_inserts = dropped_inserts;
+}
+} // namespace pathtracer
@@ -0,0 +1,53 @@
+#pragma once
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A world space radiance cache for diffuse surfaces. Radiance leaving
+// diffuse surfaces is stored in a hashed grid, keyed by grid cell and the
+// dominant axis of the normal. Once a cell has seen enough samples, paths
+// that reach it after a diffuse bounce are terminated with the cached
+// value instead of being traced further. The table uses open addressing
+// and is filled lazily from all threads with lock-free insertion.
+///////////////////////////////////////////////////////////////////////////
+extern struct RadianceCacheSettings
+{
+	bool enabled;
+	float cell_size;
+	// Number of samples a cell needs before it is used
+	int min_samples;
+} radiance_cache_settings;
+
+extern struct RadianceCacheStats
+{
+	int used_cells;
+	int dropped_inserts;
+} radiance_cache_stats;
+
+///////////////////////////////////////////////////////////////////////////
+// Empty the cache. Needed when lights, materials or the cache settings
+// change, but not when only the camera moves.
+///////////////////////////////////////////////////////////////////////////
+void resetRadianceCache();
+
+///////////////////////////////////////////////////////////////////////////
+// Get the cached radiance for a point. Returns false if the cell is
+// missing or does not have enough samples yet.
+///////////////////////////////////////////////////////////////////////////
+bool lookupRadianceCache(const vec3& position, const vec3& normal, vec3& radiance);
+
+///////////////////////////////////////////////////////////////////////////
+// Add a sample of the radiance leaving a point. Safe to call from several
+// threads.
+///////////////////////////////////////////////////////////////////////////
+void insertRadianceCache(const vec3& position, const vec3& normal, const vec3& radiance);
+
+///////////////////////////////////////////////////////////////////////////
+// Copy the counters of the cache into radiance_cache_stats. Called once
+// per pass, after the paths are traced.
+///////////////////////////////////////////////////////////////////////////
+void updateRadianceCacheStats();
+} // namespace pathtracer
@@ -0,0 +1,317 @@
+#include "raster.h"
+#include "Pathtracer.h"
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+static const int RASTER_TILE_SIZE = Image::tile_size;
+static const uint32_t NO_TRIANGLE = 0xFFFFFFFF;
+// Camera rays start in the camera, so triangles are clipped just in front
+// of it rather than at the near plane of the projection
+static const float RASTER_NEAR_W = 1e-4f;
+
+///////////////////////////////////////////////////////////////////////////
+// World space copy of the embree scene
+///////////////////////////////////////////////////////////////////////////
+static vector<SceneTriangle> scene_triangles;
+static vector<uint32_t> first_triangle_of_geometry;
+static uint32_t raster_scene_version = 0xFFFFFFFF;
+
+static void updateRasterScene()
+{
+	if(raster_scene_version == getSceneVersion())
+		return;
+	getSceneTriangles(scene_triangles);
+	first_triangle_of_geometry.clear();
+	for(uint32_t i = 0; i < scene_triangles.size(); i++)
+	{
+		const SceneTriangle& triangle = scene_triangles[i];
+		if(triangle.geomID >= first_triangle_of_geometry.size())
+			first_triangle_of_geometry.resize(triangle.geomID + 1, 0);
+		if(triangle.primID == 0)
+			first_triangle_of_geometry[triangle.geomID] = i;
+	}
+	raster_scene_version = getSceneVersion();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A clipped and projected triangle. Vertices are in pixels, wound counter
+// clockwise, and the 1/w of each vertex is premultiplied by the inverse
+// of the (doubled) screen area so that the depth of a pixel is a dot
+// product with its edge functions.
+///////////////////////////////////////////////////////////////////////////
+struct SetupTriangle
+{
+	vec2 p0, p1, p2;
+	vec3 inv_w;
+	int x0, y0, x1, y1;
+	uint32_t triangle;
+};
+
+// Each thread bins the triangles it set up into its own lists, so the
+// setup needs no synchronization
+struct ThreadBins
+{
+	vector<SetupTriangle> triangles;
+	vector<vector<uint32_t>> bins;
+};
+static vector<ThreadBins> thread_bins;
+
+inline static float edgeFunction(const vec2& a, const vec2& b, float x, float y)
+{
+	return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+static void setupTriangle(const vec4& c0, const vec4& c1, const vec4& c2, uint32_t triangle, int width,
+                          int height, const vec2& jitter, int tiles_x, ThreadBins& tb)
+{
+	SetupTriangle t;
+	t.p0 = vec2((c0.x / c0.w * 0.5f + 0.5f) * width, (c0.y / c0.w * 0.5f + 0.5f) * height);
+	t.p1 = vec2((c1.x / c1.w * 0.5f + 0.5f) * width, (c1.y / c1.w * 0.5f + 0.5f) * height);
+	t.p2 = vec2((c2.x / c2.w * 0.5f + 0.5f) * width, (c2.y / c2.w * 0.5f + 0.5f) * height);
+	t.inv_w = vec3(1.0f / c0.w, 1.0f / c1.w, 1.0f / c2.w);
+	float area = edgeFunction(t.p0, t.p1, t.p2.x, t.p2.y);
+	if(area == 0.0f || !std::isfinite(area))
+		return;
+	// Both sides of a triangle are visible to the path tracer
+	if(area < 0.0f)
+	{
+		swap(t.p1, t.p2);
+		swap(t.inv_w.y, t.inv_w.z);
+		area = -area;
+	}
+	t.inv_w /= area;
+	// The pixels whose sample positions are inside the bounding box
+	const float min_x = std::min(t.p0.x, std::min(t.p1.x, t.p2.x));
+	const float max_x = std::max(t.p0.x, std::max(t.p1.x, t.p2.x));
+	const float min_y = std::min(t.p0.y, std::min(t.p1.y, t.p2.y));
+	const float max_y = std::max(t.p0.y, std::max(t.p1.y, t.p2.y));
+	t.x0 = int(std::max(0.0f, std::ceil(min_x - jitter.x)));
+	t.y0 = int(std::max(0.0f, std::ceil(min_y - jitter.y)));
+	t.x1 = int(std::min(float(width - 1), std::floor(max_x - jitter.x)));
+	t.y1 = int(std::min(float(height - 1), std::floor(max_y - jitter.y)));
+	if(t.x0 > t.x1 || t.y0 > t.y1)
+		return;
+	t.triangle = triangle;
+	const uint32_t index = uint32_t(tb.triangles.size());
+	tb.triangles.push_back(t);
+	for(int ty = t.y0 / RASTER_TILE_SIZE; ty <= t.y1 / RASTER_TILE_SIZE; ty++)
+		for(int tx = t.x0 / RASTER_TILE_SIZE; tx <= t.x1 / RASTER_TILE_SIZE; tx++)
+			tb.bins[ty * tiles_x + tx].push_back(index);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Clip a triangle against the plane w = RASTER_NEAR_W, which leaves zero,
+// one or two triangles, and set those up
+///////////////////////////////////////////////////////////////////////////
+static void clipAndSetupTriangle(const vec4 clip[3], uint32_t triangle, int width, int height, const vec2& jitter,
+                                 int tiles_x, ThreadBins& tb)
+{
+	vec4 polygon[4];
+	int n = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		const vec4& a = clip[i];
+		const vec4& b = clip[(i + 1) % 3];
+		const float da = a.w - RASTER_NEAR_W, db = b.w - RASTER_NEAR_W;
+		if(da >= 0.0f)
+			polygon[n++] = a;
+		if((da >= 0.0f) != (db >= 0.0f))
+			polygon[n++] = a + (b - a) * (da / (da - db));
+	}
+	for(int i = 2; i < n; i++)
+		setupTriangle(polygon[0], polygon[i - 1], polygon[i], triangle, width, height, jitter, tiles_x, tb);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Intersect a ray with one triangle, with embree's conventions for u, v
+// and t. Returns false if the ray misses the triangle's plane.
+///////////////////////////////////////////////////////////////////////////
+static bool intersectTriangle(const vec3& o, const vec3& d, const SceneTriangle& triangle, VisibilitySample& s)
+{
+	const vec3 e1 = triangle.v1 - triangle.v0;
+	const vec3 e2 = triangle.v2 - triangle.v0;
+	const vec3 pv = cross(d, e2);
+	const float det = dot(e1, pv);
+	if(det == 0.0f)
+		return false;
+	const float inv_det = 1.0f / det;
+	const vec3 tv = o - triangle.v0;
+	const vec3 qv = cross(tv, e1);
+	const float t = dot(e2, qv) * inv_det;
+	if(!(t > 0.0f))
+		return false;
+	// Sample positions on an edge may land just outside the triangle
+	float u = clamp(dot(tv, pv) * inv_det, 0.0f, 1.0f);
+	float v = clamp(dot(d, qv) * inv_det, 0.0f, 1.0f);
+	if(u + v > 1.0f)
+	{
+		const float scale = 1.0f / (u + v);
+		u *= scale;
+		v *= scale;
+	}
+	s.geomID = triangle.geomID;
+	s.primID = triangle.primID;
+	s.u = u;
+	s.v = v;
+	s.depth = t;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Rasterize the binned triangles of one tile and resolve the closest one
+// of each pixel into the visibility buffer
+///////////////////////////////////////////////////////////////////////////
+static void rasterizeTile(int tile, int tiles_x, const mat4& inverse_view_projection, const vec3& camera_pos,
+                          VisibilityBuffer& vb)
+{
+	const int tile_x0 = (tile % tiles_x) * RASTER_TILE_SIZE;
+	const int tile_y0 = (tile / tiles_x) * RASTER_TILE_SIZE;
+	const int tile_x1 = std::min(tile_x0 + RASTER_TILE_SIZE, vb.width) - 1;
+	const int tile_y1 = std::min(tile_y0 + RASTER_TILE_SIZE, vb.height) - 1;
+
+	// Larger 1/w is closer, and 0 is infinitely far away
+	float depth[RASTER_TILE_SIZE * RASTER_TILE_SIZE];
+	uint32_t closest[RASTER_TILE_SIZE * RASTER_TILE_SIZE];
+	std::fill(depth, depth + RASTER_TILE_SIZE * RASTER_TILE_SIZE, 0.0f);
+	std::fill(closest, closest + RASTER_TILE_SIZE * RASTER_TILE_SIZE, NO_TRIANGLE);
+
+	for(const ThreadBins& tb : thread_bins)
+	{
+		for(uint32_t index : tb.bins[tile])
+		{
+			const SetupTriangle& t = tb.triangles[index];
+			const int x0 = std::max(t.x0, tile_x0), x1 = std::min(t.x1, tile_x1);
+			const int y0 = std::max(t.y0, tile_y0), y1 = std::min(t.y1, tile_y1);
+			for(int y = y0; y <= y1; y++)
+			{
+				const float sy = float(y) + vb.jitter.y;
+				for(int x = x0; x <= x1; x++)
+				{
+					const float sx = float(x) + vb.jitter.x;
+					// Samples on an edge are inside both triangles that share
+					// it, so no pixels fall between them
+					const float w0 = edgeFunction(t.p1, t.p2, sx, sy);
+					const float w1 = edgeFunction(t.p2, t.p0, sx, sy);
+					const float w2 = edgeFunction(t.p0, t.p1, sx, sy);
+					if(w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+					const float inv_w = w0 * t.inv_w.x + w1 * t.inv_w.y + w2 * t.inv_w.z;
+					const int i = (y - tile_y0) * RASTER_TILE_SIZE + (x - tile_x0);
+					if(inv_w > depth[i])
+					{
+						depth[i] = inv_w;
+						closest[i] = t.triangle;
+					}
+				}
+			}
+		}
+	}
+
+	// Intersect the camera rays with the visible triangles
+	float sx[RASTER_TILE_SIZE], sy[RASTER_TILE_SIZE];
+	float dx[RASTER_TILE_SIZE], dy[RASTER_TILE_SIZE], dz[RASTER_TILE_SIZE];
+	const int count = tile_x1 - tile_x0 + 1;
+	for(int y = tile_y0; y <= tile_y1; y++)
+	{
+		for(int x = tile_x0; x <= tile_x1; x++)
+		{
+			sx[x - tile_x0] = (float(x) + vb.jitter.x) / float(vb.width);
+			sy[x - tile_x0] = (float(y) + vb.jitter.y) / float(vb.height);
+		}
+		simd::generateCameraRays(&inverse_view_projection[0][0], &camera_pos.x, sx, sy, dx, dy, dz, count);
+		for(int x = tile_x0; x <= tile_x1; x++)
+		{
+			VisibilitySample& s = vb.samples[y * vb.width + x];
+			s.geomID = RTC_INVALID_GEOMETRY_ID;
+			const uint32_t triangle = closest[(y - tile_y0) * RASTER_TILE_SIZE + (x - tile_x0)];
+			if(triangle == NO_TRIANGLE)
+				continue;
+			const int i = x - tile_x0;
+			if(!intersectTriangle(camera_pos, vec3(dx[i], dy[i], dz[i]), scene_triangles[triangle], s))
+				s.geomID = RTC_INVALID_GEOMETRY_ID;
+		}
+	}
+}
+
+void rasterizeVisibility(const mat4& V, const mat4& P, int width, int height, const vec2& jitter,
+                         VisibilityBuffer& vb)
+{
+	updateRasterScene();
+	vb.width = width;
+	vb.height = height;
+	vb.jitter = jitter;
+	vb.samples.resize(size_t(width) * height);
+
+	const mat4 view_projection = P * V;
+	const mat4 inverse_view_projection = inverse(view_projection);
+	const vec3 camera_pos = vec3(inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	const int tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	const int tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	const int number_of_tiles = tiles_x * tiles_y;
+	const int number_of_triangles = int(scene_triangles.size());
+
+	// All bins are emptied here, not by the threads that fill them, since
+	// the region may run with fewer threads than there are bins, and
+	// rasterizeTile() reads them all
+	thread_bins.resize(omp_get_max_threads());
+	for(ThreadBins& tb : thread_bins)
+	{
+		tb.triangles.clear();
+		tb.bins.resize(number_of_tiles);
+		for(auto& bin : tb.bins)
+			bin.clear();
+	}
+	#pragma omp parallel
+	{
+		ThreadBins& tb = thread_bins[omp_get_thread_num()];
+		#pragma omp for schedule(static)
+		for(int i = 0; i < number_of_triangles; i++)
+		{
+			const SceneTriangle& triangle = scene_triangles[i];
+			vec4 clip[3] = { view_projection * vec4(triangle.v0, 1.0f), view_projection * vec4(triangle.v1, 1.0f),
+				             view_projection * vec4(triangle.v2, 1.0f) };
+			// Reject triangles entirely outside one of the side planes
+			if((clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w)
+			   || (clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w)
+			   || (clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w)
+			   || (clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w))
+			{
+				continue;
+			}
+			clipAndSetupTriangle(clip, uint32_t(i), width, height, jitter, tiles_x, tb);
+		}
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int tile = 0; tile < number_of_tiles; tile++)
+	{
+		rasterizeTile(tile, tiles_x, inverse_view_projection, camera_pos, vb);
+	}
+}
+
+bool getVisibilityHit(const VisibilityBuffer& vb, int x, int y, Ray& r)
+{
+	const VisibilitySample& s = vb.samples[y * vb.width + x];
+	if(s.geomID == RTC_INVALID_GEOMETRY_ID)
+		return false;
+	const SceneTriangle& triangle = scene_triangles[first_triangle_of_geometry[s.geomID] + s.primID];
+	// Only embree knows whether the ray passes through the texture
+	if(triangle.alpha_tested)
+		return false;
+	r.geomID = s.geomID;
+	r.primID = s.primID;
+	r.u = s.u;
+	r.v = s.v;
+	r.tfar = s.depth;
+	// Embree's unnormalized geometry normal
+	r.n = cross(triangle.v0 - triangle.v1, triangle.v2 - triangle.v0);
+	return true;
+}
+} // namespace pathtracer
@@ -0,0 +1,57 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "embree.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Primary visibility by rasterization. Primary rays all start in the
+// camera, so instead of tracing them through the BVH the scene triangles
+// are rasterized on the CPU: they are clipped and projected in parallel,
+// binned into screen tiles, and each tile is then rasterized by one
+// thread with a depth test. The triangle found for a pixel is intersected
+// exactly with the pixel's camera ray, so that the hit data matches what
+// embree would have returned for the same ray.
+///////////////////////////////////////////////////////////////////////////
+struct VisibilitySample
+{
+	// RTC_INVALID_GEOMETRY_ID where nothing was rasterized. Such pixels
+	// are traced instead, which also catches the rare sample that falls
+	// between two rasterized triangles through rounding.
+	uint32_t geomID;
+	uint32_t primID;
+	// Barycentric coordinates, as in embree's Ray::u and Ray::v
+	float u, v;
+	// Distance along the normalized camera ray
+	float depth;
+};
+
+struct VisibilityBuffer
+{
+	int width = 0, height = 0;
+	// The sample position within each pixel (in [0, 1)), the same for
+	// all pixels of a pass
+	vec2 jitter;
+	std::vector<VisibilitySample> samples;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Fill a visibility buffer for a view. Camera rays go through pixel
+// (x, y) at screen position ((x + jitter.x) / width, (y + jitter.y) /
+// height), as generated by simd::generateCameraRays(). The triangles are
+// copied from the embree scene the first time after each buildBVH().
+///////////////////////////////////////////////////////////////////////////
+void rasterizeVisibility(const mat4& V, const mat4& P, int width, int height, const vec2& jitter,
+                         VisibilityBuffer& vb);
+
+///////////////////////////////////////////////////////////////////////////
+// Set the hit data of a camera ray from a visibility buffer, as if
+// intersect() had been called for it. Returns false if the pixel must be
+// traced instead, which includes hits on alpha tested triangles.
+///////////////////////////////////////////////////////////////////////////
+bool getVisibilityHit(const VisibilityBuffer& vb, int x, int y, Ray& r);
+} // namespace pathtracer
@@ -10,13 +10,38 @@ using namespace glm;
 namespace pathtracer
 {
 ///////////////////////////////////////////////////////////////////////////////
-// Get a random float. Note that we need one "generator" per thread, or we
-// would need to lock everytime someone called randf().
+// Get a random float. Every thread has its own PCG32 state, which is reset
+// by seedRandom() before each sample. The numbers used for a sample then
+// only depend on the seed, and not on which thread happens to run it.
 ///////////////////////////////////////////////////////////////////////////////
-std::mt19937 generators[24]; // Assuming no more than 24 cores
+static thread_local uint64_t random_state = 0x853c49e6748fea9bull;
+static const uint64_t PCG_MULTIPLIER = 6364136223846793005ull;
+static const uint64_t PCG_INCREMENT = 1442695040888963407ull;
+
+static inline uint32_t nextRandom()
+{
+	uint64_t old = random_state;
+	random_state = old * PCG_MULTIPLIER + PCG_INCREMENT;
+	uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+	uint32_t rot = uint32_t(old >> 59u);
+	return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+}
+
+void seedRandom(uint32_t a, uint32_t b, uint32_t stream)
+{
+	// splitmix64 of the packed arguments, so that neighbouring pixels and
+	// samples get unrelated sequences
+	uint64_t z = (uint64_t(a) << 32 | b) + 0x9e3779b97f4a7c15ull * (uint64_t(stream) + 1);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	random_state = z ^ (z >> 31);
+	nextRandom();
+}
+
 float randf()
 {
-	return float(generators[omp_get_thread_num()]() / double(generators[omp_get_thread_num()].max()));
+	// 24 random bits, so the result is always < 1
+	return float(nextRandom() >> 8) * (1.0f / 16777216.0f);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1,5 +1,6 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstdint>
 
 namespace pathtracer
 {
@@ -8,6 +9,20 @@ namespace pathtracer
 ///////////////////////////////////////////////////////////////////////////
 float randf();
 ///////////////////////////////////////////////////////////////////////////
+// Restart the random sequence of the calling thread. Seeding with e.g. the
+// pixel and the sample number makes rendering independent of the number
+// of threads and of the OpenMP schedule. 'stream' separates users that
+// would otherwise use the same a and b.
+///////////////////////////////////////////////////////////////////////////
+enum RandomStream
+{
+	RANDOM_STREAM_CAMERA = 0,
+	RANDOM_STREAM_PHOTONS = 1,
+	RANDOM_STREAM_PIXEL_JITTER = 2,
+	RANDOM_STREAM_RASTER_JITTER = 3,
+};
+void seedRandom(uint32_t a, uint32_t b, uint32_t stream);
+///////////////////////////////////////////////////////////////////////////
 // Generate uniform points on a disc
 ///////////////////////////////////////////////////////////////////////////
 void concentricSampleDisk(float* dx, float* dy);
@@ -0,0 +1,915 @@
+#include "service.h"
+#include "Pathtracer.h"
+#include "embree.h"
+#include "batch.h"
+#include "guiding.h"
+#include "radiancecache.h"
+#include <Model.h>
+#include <stb_image.h>
+#include <glm/gtx/transform.hpp>
+#include <sys/stat.h>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET Socket;
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int Socket;
+static const Socket INVALID_SOCKET = -1;
+#endif
+
+// Do not get killed by SIGPIPE when a client goes away in the middle of a job
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Thin layer over BSD sockets and winsock
+///////////////////////////////////////////////////////////////////////////
+static bool startSockets()
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+#else
+	return true;
+#endif
+}
+
+static void stopSockets()
+{
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+static void closeSocket(Socket s)
+{
+#ifdef _WIN32
+	closesocket(s);
+#else
+	close(s);
+#endif
+}
+
+// Blocking calls on the socket give up after this long, so that a stuck
+// client can not stall the server
+static void setSocketTimeout(Socket s, int ms)
+{
+#ifdef _WIN32
+	DWORD timeout = ms;
+#else
+	timeval timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+#endif
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+// Errors of select() and accept() after which the listener is of no use
+static bool listenerFailed()
+{
+#ifdef _WIN32
+	const int error = WSAGetLastError();
+	return error == WSANOTINITIALISED || error == WSAENOTSOCK || error == WSAEINVAL || error == WSAEOPNOTSUPP
+	       || error == WSAEFAULT;
+#else
+	return errno == EBADF || errno == ENOTSOCK || errno == EINVAL || errno == EOPNOTSUPP || errno == EFAULT;
+#endif
+}
+
+static sockaddr_in localAddress(int port)
+{
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(uint16_t(port));
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return address;
+}
+
+static bool sendAll(Socket s, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while(size > 0)
+	{
+		const int sent = send(s, bytes, int(std::min(size, size_t(1) << 20)), SEND_FLAGS);
+		if(sent <= 0)
+			return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool sendLine(Socket s, const string& line)
+{
+	return sendAll(s, (line + "\n").data(), line.size() + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Buffered reads of text lines and binary payloads from a socket
+///////////////////////////////////////////////////////////////////////////
+struct SocketReader
+{
+	Socket s;
+	string buffer;
+	size_t position = 0;
+
+	bool fill()
+	{
+		if(position > 0)
+		{
+			buffer.erase(0, position);
+			position = 0;
+		}
+		char chunk[64 * 1024];
+		const int received = recv(s, chunk, sizeof(chunk), 0);
+		if(received <= 0)
+			return false;
+		buffer.append(chunk, received);
+		return true;
+	}
+	bool readLine(string& line)
+	{
+		size_t end;
+		while((end = buffer.find('\n', position)) == string::npos)
+		{
+			if(!fill())
+				return false;
+		}
+		line = buffer.substr(position, end - position);
+		if(!line.empty() && line.back() == '\r')
+			line.pop_back();
+		position = end + 1;
+		return true;
+	}
+	bool read(void* data, size_t size)
+	{
+		while(buffer.size() - position < size)
+		{
+			if(!fill())
+				return false;
+		}
+		memcpy(data, buffer.data() + position, size);
+		position += size;
+		return true;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Jobs
+///////////////////////////////////////////////////////////////////////////
+struct ServiceModel
+{
+	string filename;
+	vec3 translation;
+	// Hash of the OBJ file, its material libraries and textures
+	uint64_t files_hash;
+};
+
+struct ServiceJob
+{
+	uint32_t id;
+	Socket client;
+	vector<ServiceModel> models;
+	// Empty for the environment the server started with
+	string environment;
+	float environment_multiplier = 1.0f;
+	BatchCamera camera;
+	int width = 640, height = 360;
+	int samples = 64;
+	int bounces = 8;
+	int interval_ms = 500;
+	// Jobs with the same scene hash share the BVH. Jobs with the same group
+	// hash also share environment and settings, and are rendered together.
+	uint64_t scene_hash, group_hash;
+	Image image;
+	chrono::high_resolution_clock::time_point last_update;
+};
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+	// FNV-1a
+	const uint8_t* bytes = (const uint8_t*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const string& s)
+{
+	return hashBytes(hash, s.c_str(), s.size() + 1);
+}
+
+// Hash the name, size and modification time of a file, so that a file
+// that changed on disk gets loaded again. Returns false if it is missing.
+static bool hashFile(uint64_t& hash, const string& filename)
+{
+	struct stat info;
+	if(stat(filename.c_str(), &info) != 0)
+		return false;
+	const int64_t size = int64_t(info.st_size), time = int64_t(info.st_mtime);
+	hash = hashString(hash, filename);
+	hash = hashBytes(hash, &size, sizeof(size));
+	hash = hashBytes(hash, &time, sizeof(time));
+	return true;
+}
+
+static const uint64_t HASH_BASIS = 14695981039346656037ull;
+
+///////////////////////////////////////////////////////////////////////////
+// The files each model is loaded from. Finding them means reading the
+// whole OBJ file, so they are kept for as long as none of them change:
+// the list can only change with an edit to the OBJ file or a material
+// library, which changes the hash.
+///////////////////////////////////////////////////////////////////////////
+struct KnownModelFiles
+{
+	uint64_t hash;
+	labhelper::ModelFiles files;
+};
+static mutex model_files_mutex;
+static map<string, KnownModelFiles> model_files;
+
+static bool hashModelFiles(const labhelper::ModelFiles& files, uint64_t& hash, string& error)
+{
+	hash = HASH_BASIS;
+	for(const vector<string>* list : { &files.sources, &files.textures })
+	{
+		for(const string& filename : *list)
+		{
+			if(!hashFile(hash, filename))
+			{
+				error = "can not open " + filename;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Hash everything a model is loaded from, and check that it can be
+// loaded, since the loaders exit on what they can not read. Returns false
+// with a message in 'error' otherwise.
+static bool hashModel(const string& filename, uint64_t& hash, string& error)
+{
+	const size_t separator = filename.find_last_of("\\/");
+	if(filename.find('.', separator == string::npos ? 0 : separator) == string::npos)
+	{
+		error = filename + " is not an OBJ file";
+		return false;
+	}
+	KnownModelFiles known;
+	bool found;
+	{
+		lock_guard<mutex> lock(model_files_mutex);
+		auto it = model_files.find(filename);
+		found = it != model_files.end();
+		if(found)
+			known = it->second;
+	}
+	uint64_t current;
+	string ignored;
+	if(found && hashModelFiles(known.files, current, ignored) && current == known.hash)
+	{
+		hash = current;
+		return true;
+	}
+	known.files = labhelper::findModelFiles(filename);
+	if(!hashModelFiles(known.files, known.hash, error))
+		return false;
+	for(const string& texture : known.files.textures)
+	{
+		int width, height, components;
+		if(!stbi_info(texture.c_str(), &width, &height, &components))
+		{
+			error = "can not read the image " + texture;
+			return false;
+		}
+	}
+	lock_guard<mutex> lock(model_files_mutex);
+	model_files[filename] = known;
+	hash = known.hash;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Read a job description from a client. Returns false with a message in
+// 'error' if the job can not be rendered.
+///////////////////////////////////////////////////////////////////////////
+static bool parseJob(const vector<string>& lines, ServiceJob& job, string& error)
+{
+	bool has_camera = false;
+	for(const string& full_line : lines)
+	{
+		istringstream fields(full_line.substr(0, full_line.find('#')));
+		string keyword;
+		if(!(fields >> keyword))
+			continue;
+		if(keyword == "model")
+		{
+			ServiceModel model;
+			model.translation = vec3(0.0f);
+			fields >> model.filename;
+			fields >> model.translation.x >> model.translation.y >> model.translation.z;
+			job.models.push_back(model);
+		}
+		else if(keyword == "environment")
+		{
+			fields >> job.environment >> job.environment_multiplier;
+		}
+		else if(keyword == "camera")
+		{
+			fields >> job.camera.position.x >> job.camera.position.y >> job.camera.position.z;
+			fields >> job.camera.target.x >> job.camera.target.y >> job.camera.target.z;
+			if(!(fields >> job.camera.fov_y))
+				job.camera.fov_y = 45.0f;
+			has_camera = true;
+		}
+		else if(keyword == "size")
+			fields >> job.width >> job.height;
+		else if(keyword == "samples")
+			fields >> job.samples;
+		else if(keyword == "bounces")
+			fields >> job.bounces;
+		else if(keyword == "interval")
+			fields >> job.interval_ms;
+		else
+		{
+			error = "unknown keyword " + keyword;
+			return false;
+		}
+	}
+	if(job.models.empty() || !has_camera)
+	{
+		error = "a job needs at least one model and a camera";
+		return false;
+	}
+	if(job.width <= 0 || job.height <= 0 || int64_t(job.width) * job.height > 8192 * 8192 || job.samples <= 0)
+	{
+		error = "bad image size or sample count";
+		return false;
+	}
+
+	job.scene_hash = HASH_BASIS;
+	for(ServiceModel& model : job.models)
+	{
+		if(!hashModel(model.filename, model.files_hash, error))
+			return false;
+		job.scene_hash = hashString(job.scene_hash, model.filename);
+		job.scene_hash = hashBytes(job.scene_hash, &model.files_hash, sizeof(model.files_hash));
+		job.scene_hash = hashBytes(job.scene_hash, &model.translation, sizeof(model.translation));
+	}
+	job.group_hash = job.scene_hash;
+	if(!job.environment.empty() && !hashFile(job.group_hash, job.environment))
+	{
+		error = "can not open " + job.environment;
+		return false;
+	}
+	int width, height, components;
+	if(!job.environment.empty() && !stbi_info(job.environment.c_str(), &width, &height, &components))
+	{
+		error = "can not read the image " + job.environment;
+		return false;
+	}
+	job.group_hash = hashBytes(job.group_hash, &job.environment_multiplier, sizeof(job.environment_multiplier));
+	job.group_hash = hashBytes(job.group_hash, &job.bounces, sizeof(job.bounces));
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// What the server keeps between jobs
+///////////////////////////////////////////////////////////////////////////
+struct SceneCache
+{
+	// The scene the BVH was last built for
+	uint64_t built_scene = 0;
+	// The models by filename, with the hash of the files they were loaded
+	// from
+	struct CachedModel
+	{
+		uint64_t file_hash = 0;
+		labhelper::Model* model = nullptr;
+	};
+	map<string, CachedModel> models;
+	// Environments not in use. The one in use lives in environment.map.
+	map<string, unique_ptr<HDRImage>> environments;
+	string current_environment;
+};
+
+static void swapImages(HDRImage& a, HDRImage& b)
+{
+	std::swap(a.width, b.width);
+	std::swap(a.height, b.height);
+	std::swap(a.components, b.components);
+	std::swap(a.data, b.data);
+}
+
+// Set up the scene, environment and settings for a group of jobs, loading
+// and building only what the last group did not already have. Returns
+// false with a message in 'error' if something can not be loaded.
+static bool prepareScene(const ServiceJob& job, SceneCache& cache, string& error)
+{
+	bool changed = false;
+	if(job.environment != cache.current_environment)
+	{
+		// Load the new environment before giving up the current one
+		unique_ptr<HDRImage>& next = cache.environments[job.environment];
+		if(!next)
+		{
+			next.reset(new HDRImage);
+			if(!next->tryLoad(job.environment))
+			{
+				cache.environments.erase(job.environment);
+				error = "can not load " + job.environment;
+				return false;
+			}
+		}
+		unique_ptr<HDRImage>& previous = cache.environments[cache.current_environment];
+		previous.reset(new HDRImage);
+		swapImages(*previous, environment.map);
+		swapImages(*next, environment.map);
+		cache.environments.erase(job.environment);
+		cache.current_environment = job.environment;
+		changed = true;
+	}
+	if(job.scene_hash != cache.built_scene)
+	{
+		clearScene();
+		cache.built_scene = 0;
+		for(const ServiceModel& m : job.models)
+		{
+			// A model whose files changed since it was loaded is loaded
+			// again. It is freed first, so that its textures are not shared
+			// with the new one. The scene was cleared, so it is not in use.
+			SceneCache::CachedModel& cached = cache.models[m.filename];
+			if(cached.model != nullptr && cached.file_hash != m.files_hash)
+			{
+				labhelper::freeModel(cached.model);
+				cached.model = nullptr;
+			}
+			if(cached.model == nullptr)
+			{
+				cached.model = labhelper::loadModelFromOBJ(m.filename);
+				cached.file_hash = m.files_hash;
+			}
+			addModel(cached.model, translate(m.translation));
+		}
+		buildBVH();
+		cache.built_scene = job.scene_hash;
+		changed = true;
+		cout << "Built scene " << hex << job.scene_hash << dec << " for job " << job.id << "\n";
+	}
+	if(job.environment_multiplier != environment.multiplier || job.bounces != settings.max_bounces)
+	{
+		environment.multiplier = job.environment_multiplier;
+		settings.max_bounces = job.bounces;
+		changed = true;
+	}
+	if(changed)
+	{
+		resetGuiding();
+		resetRadianceCache();
+	}
+	restart();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Send the tiles of a job that got new samples since they were last sent
+///////////////////////////////////////////////////////////////////////////
+static bool sendTiles(ServiceJob& job)
+{
+	Image& image = job.image;
+	vector<vec4> resolved(Image::tile_size);
+	vector<float> payload;
+	for(int tile_y = 0; tile_y < image.tiles_y; tile_y++)
+	{
+		for(int tile_x = 0; tile_x < image.tiles_x; tile_x++)
+		{
+			uint8_t& dirty = image.dirty_tiles[tile_y * image.tiles_x + tile_x];
+			if(!dirty)
+				continue;
+			dirty = 0;
+			const int x0 = tile_x * Image::tile_size, y0 = tile_y * Image::tile_size;
+			const int w = std::min(Image::tile_size, image.width - x0);
+			const int h = std::min(Image::tile_size, image.height - y0);
+			payload.resize(size_t(w) * h * 3);
+			for(int y = 0; y < h; y++)
+			{
+				image.resolve(resolved.data(), size_t(y0 + y) * image.width + x0, w);
+				for(int x = 0; x < w; x++)
+				{
+					float* rgb = &payload[(size_t(y) * w + x) * 3];
+					rgb[0] = resolved[x].r;
+					rgb[1] = resolved[x].g;
+					rgb[2] = resolved[x].b;
+				}
+			}
+			ostringstream header;
+			header << "tile " << x0 << " " << y0 << " " << w << " " << h << " " << image.number_of_samples;
+			if(!sendLine(job.client, header.str())
+			   || !sendAll(job.client, payload.data(), payload.size() * sizeof(float)))
+				return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The server. One thread accepts clients, a thread per client reads its
+// job into a queue, and the calling thread renders them.
+///////////////////////////////////////////////////////////////////////////
+struct JobQueue
+{
+	deque<unique_ptr<ServiceJob>> jobs;
+	mutex queue_mutex;
+	condition_variable queue_changed;
+	bool shutdown = false;
+	// Clients whose jobs are being read
+	int readers = 0;
+	uint32_t next_id = 1;
+};
+
+// Clients read at the same time, beyond which new ones are turned away
+static const int MAX_READERS = 64;
+
+static void readJob(Socket client, JobQueue& queue)
+{
+	setSocketTimeout(client, 10000);
+	SocketReader reader;
+	reader.s = client;
+	vector<string> lines;
+	string line;
+	bool complete = false, shutdown = false;
+	while(reader.readLine(line))
+	{
+		if(line == "end" || line == "shutdown")
+		{
+			complete = true;
+			shutdown = line == "shutdown";
+			break;
+		}
+		lines.push_back(line);
+	}
+	unique_ptr<ServiceJob> job(new ServiceJob);
+	job->client = client;
+	string error = "incomplete job";
+	if(shutdown)
+	{
+		sendLine(client, "shutting down");
+		closeSocket(client);
+	}
+	else if(!complete || !parseJob(lines, *job, error))
+	{
+		sendLine(client, "error " + error);
+		closeSocket(client);
+	}
+	else
+	{
+		// The id is only taken once the job is accepted, and the reply is
+		// sent under the lock so that the ids go out in order
+		lock_guard<mutex> lock(queue.queue_mutex);
+		if(queue.shutdown)
+		{
+			sendLine(client, "error the server is shutting down");
+			closeSocket(client);
+		}
+		else
+		{
+			job->id = queue.next_id;
+			ostringstream reply;
+			reply << "accepted " << job->id << " " << job->width << " " << job->height;
+			if(sendLine(client, reply.str()))
+			{
+				queue.next_id++;
+				queue.jobs.push_back(std::move(job));
+			}
+			else
+			{
+				closeSocket(client);
+			}
+		}
+	}
+	lock_guard<mutex> lock(queue.queue_mutex);
+	queue.shutdown = queue.shutdown || shutdown;
+	queue.readers--;
+	queue.queue_changed.notify_all();
+}
+
+static void acceptJobs(Socket listener, JobQueue& queue)
+{
+	while(true)
+	{
+		{
+			lock_guard<mutex> lock(queue.queue_mutex);
+			if(queue.shutdown)
+				break;
+		}
+		// Wait for a client for a while at a time, to notice a shutdown
+		// that came from another client
+		fd_set waiting;
+		FD_ZERO(&waiting);
+		FD_SET(listener, &waiting);
+		timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 200000;
+		const int ready = select(int(listener + 1), &waiting, nullptr, nullptr, &timeout);
+		Socket client = INVALID_SOCKET;
+		if(ready > 0)
+			client = accept(listener, nullptr, nullptr);
+		if(ready == 0)
+			continue;
+		if(client == INVALID_SOCKET)
+		{
+			if(listenerFailed())
+			{
+				cout << "ERROR: acceptJobs(): Can not accept clients any more, shutting down\n";
+				lock_guard<mutex> lock(queue.queue_mutex);
+				queue.shutdown = true;
+				queue.queue_changed.notify_all();
+				break;
+			}
+			// Out of descriptors or memory, or the client gave up already.
+			// Give it a moment rather than trying again right away.
+			this_thread::sleep_for(chrono::milliseconds(100));
+			continue;
+		}
+		lock_guard<mutex> lock(queue.queue_mutex);
+		if(queue.readers >= MAX_READERS)
+		{
+			sendLine(client, "error too many clients");
+			closeSocket(client);
+			continue;
+		}
+		queue.readers++;
+		thread(readJob, client, std::ref(queue)).detach();
+	}
+	closeSocket(listener);
+}
+
+int runRenderService(int port)
+{
+	if(!startSockets())
+	{
+		cout << "ERROR: runRenderService(): Could not initialize sockets\n";
+		return 1;
+	}
+	Socket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+	sockaddr_in address = localAddress(port);
+	if(listener == INVALID_SOCKET || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0
+	   || listen(listener, 16) != 0)
+	{
+		cout << "ERROR: runRenderService(): Could not listen on port " << port << "\n";
+		if(listener != INVALID_SOCKET)
+			closeSocket(listener);
+		stopSockets();
+		return 1;
+	}
+	cout << "Serving render jobs on 127.0.0.1:" << port << "\n";
+
+	// The service decides the number of passes itself
+	const int max_paths_per_pixel = settings.max_paths_per_pixel;
+	settings.max_paths_per_pixel = 0;
+
+	JobQueue queue;
+	thread acceptor(acceptJobs, listener, std::ref(queue));
+	SceneCache cache;
+	vector<unique_ptr<ServiceJob>> active;
+	while(true)
+	{
+		// Take the jobs at the front of the queue that can join the running
+		// group, in order, so that jobs for other scenes are not starved
+		{
+			unique_lock<mutex> lock(queue.queue_mutex);
+			queue.queue_changed.wait(lock, [&]() {
+				return !active.empty() || !queue.jobs.empty() || queue.shutdown;
+			});
+			if(active.empty() && queue.jobs.empty())
+				break;
+			while(!queue.jobs.empty()
+			      && (active.empty() || queue.jobs.front()->group_hash == active.front()->group_hash))
+			{
+				unique_ptr<ServiceJob> job = std::move(queue.jobs.front());
+				queue.jobs.pop_front();
+				if(active.empty())
+				{
+					lock.unlock();
+					string error;
+					const bool prepared = prepareScene(*job, cache, error);
+					lock.lock();
+					if(!prepared)
+					{
+						cout << "Dropped job " << job->id << ": " << error << "\n";
+						sendLine(job->client, "error " + error);
+						closeSocket(job->client);
+						continue;
+					}
+				}
+				job->image.resize(job->width, job->height);
+				job->last_update = chrono::high_resolution_clock::now();
+				active.push_back(std::move(job));
+			}
+		}
+
+		vector<RenderView> views(active.size());
+		for(size_t i = 0; i < active.size(); i++)
+		{
+			const ServiceJob& job = *active[i];
+			views[i].V = lookAt(job.camera.position, job.camera.target, vec3(0.0f, 1.0f, 0.0f));
+			views[i].P = perspective(radians(job.camera.fov_y), float(job.width) / float(job.height), 0.1f, 100.0f);
+			views[i].image = &active[i]->image;
+		}
+		tracePaths(views);
+
+		const auto now = chrono::high_resolution_clock::now();
+		for(size_t i = 0; i < active.size();)
+		{
+			ServiceJob& job = *active[i];
+			const bool finished = job.image.number_of_samples >= job.samples;
+			const bool update = finished
+			                    || chrono::duration<float, milli>(now - job.last_update).count() >= job.interval_ms;
+			bool connected = true;
+			if(update)
+			{
+				connected = sendTiles(job);
+				job.last_update = now;
+			}
+			if(finished && connected)
+			{
+				connected = sendLine(job.client, "done " + to_string(job.id));
+				cout << "Finished job " << job.id << " (" << job.width << "x" << job.height << ", "
+				     << job.image.number_of_samples << " samples)\n";
+			}
+			if(finished || !connected)
+			{
+				if(!connected)
+					cout << "Dropped job " << job.id << ", the client went away\n";
+				closeSocket(job.client);
+				active.erase(active.begin() + i);
+				continue;
+			}
+			i++;
+		}
+	}
+	acceptor.join();
+	{
+		// The readers still hold the queue
+		unique_lock<mutex> lock(queue.queue_mutex);
+		queue.queue_changed.wait(lock, [&]() { return queue.readers == 0; });
+	}
+	settings.max_paths_per_pixel = max_paths_per_pixel;
+	for(auto& m : cache.models)
+	{
+		labhelper::freeModel(m.second.model);
+	}
+	stopSockets();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The client
+///////////////////////////////////////////////////////////////////////////
+int submitRenderJob(const string& job_file, const string& output, int port)
+{
+	// "shutdown" instead of a job file stops the server
+	string request;
+	if(job_file == "shutdown")
+	{
+		request = "shutdown\n";
+	}
+	else
+	{
+		ifstream file(job_file);
+		if(!file)
+		{
+			cout << "ERROR: submitRenderJob(): Could not open " << job_file << "\n";
+			return 1;
+		}
+		ostringstream contents;
+		contents << file.rdbuf();
+		request = contents.str() + "\nend\n";
+	}
+
+	if(!startSockets())
+	{
+		cout << "ERROR: submitRenderJob(): Could not initialize sockets\n";
+		return 1;
+	}
+	Socket s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in address = localAddress(port);
+	if(s == INVALID_SOCKET || connect(s, (sockaddr*)&address, sizeof(address)) != 0 || !sendAll(s, request.data(), request.size()))
+	{
+		cout << "ERROR: submitRenderJob(): Could not reach a server on port " << port << "\n";
+		if(s != INVALID_SOCKET)
+			closeSocket(s);
+		stopSockets();
+		return 1;
+	}
+
+	SocketReader reader;
+	reader.s = s;
+	int result = 1;
+	int width = 0, height = 0, samples_shown = 0;
+	vector<vec3> pixels;
+	vector<float> payload;
+	string line;
+	while(reader.readLine(line))
+	{
+		istringstream fields(line);
+		string keyword;
+		fields >> keyword;
+		if(keyword == "accepted")
+		{
+			int id;
+			fields >> id >> width >> height;
+			pixels.assign(size_t(width) * height, vec3(0.0f));
+			cout << "Job " << id << " accepted, " << width << "x" << height << "\n";
+		}
+		else if(keyword == "tile")
+		{
+			int x0, y0, w, h, samples;
+			fields >> x0 >> y0 >> w >> h >> samples;
+			if(!fields || x0 < 0 || y0 < 0 || w <= 0 || h <= 0 || x0 + w > width || y0 + h > height)
+			{
+				cout << "ERROR: submitRenderJob(): Bad tile \"" << line << "\"\n";
+				break;
+			}
+			payload.resize(size_t(w) * h * 3);
+			if(!reader.read(payload.data(), payload.size() * sizeof(float)))
+				break;
+			for(int y = 0; y < h; y++)
+			{
+				for(int x = 0; x < w; x++)
+				{
+					const float* rgb = &payload[(size_t(y) * w + x) * 3];
+					pixels[size_t(y0 + y) * width + x0 + x] = vec3(rgb[0], rgb[1], rgb[2]);
+				}
+			}
+			if(samples != samples_shown)
+			{
+				samples_shown = samples;
+				cout << "Received " << samples << " samples per pixel\n";
+			}
+		}
+		else if(keyword == "done")
+		{
+			result = writeImage(output, width, height, pixels, 1.0f, 0) ? 0 : 1;
+			if(result == 0)
+				cout << "Wrote " << output << "\n";
+			else
+				cout << "ERROR: submitRenderJob(): Could not write " << output << "\n";
+			break;
+		}
+		else if(keyword == "shutting")
+		{
+			cout << "Server is shutting down\n";
+			result = 0;
+			break;
+		}
+		else
+		{
+			cout << "ERROR: submitRenderJob(): Server says \"" << line << "\"\n";
+			break;
+		}
+	}
+	closeSocket(s);
+	stopSockets();
+	return result;
+}
+} // namespace pathtracer
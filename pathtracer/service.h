@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A render service on a local TCP socket (127.0.0.1 only). Clients send a
+// job as text lines, terminated by a line "end":
+//
+//   model <obj file> [tx ty tz]      one line per model, optional offset
+//   environment <hdr file> [multiplier]
+//   camera px py pz tx ty tz [fov_y]
+//   size <width> <height>
+//   samples <samples per pixel>
+//   bounces <max bounces>
+//   interval <ms between tile updates>
+//
+// A single line "shutdown" stops the server instead. The server answers
+// "accepted <job> <width> <height>" (or "error <message>"), and then
+// streams the image as it converges: "tile <x> <y> <w> <h> <samples>",
+// followed by w * h rgb float32 radiance values, rows bottom to top.
+// "done <job>" ends the stream.
+//
+// Without an environment line, a job gets the environment the server
+// started with.
+//
+// A job whose files can not be read gets "error <message>" instead, also
+// after "accepted" if loading fails then.
+//
+// The server keeps the last scene built, keyed by a hash of the models,
+// their offsets and the sizes and times of the obj files, material
+// libraries and textures they are loaded from, so repeated jobs for
+// the same scene neither load models nor rebuild the BVH. Loaded models
+// and environments are kept too, for jobs that switch between scenes.
+// Queued jobs that share scene, environment and bounces are rendered
+// together in the same passes on the shared thread pool.
+///////////////////////////////////////////////////////////////////////////
+static const int DEFAULT_SERVICE_PORT = 7311;
+
+///////////////////////////////////////////////////////////////////////////
+// Serve jobs until a client sends "shutdown". Needs no GL context, as long
+// as labhelper::loader_settings.upload_to_gpu is off. Returns the exit
+// code for main().
+///////////////////////////////////////////////////////////////////////////
+int runRenderService(int port);
+
+///////////////////////////////////////////////////////////////////////////
+// Send the job in 'job_file' to a server on this machine and write the
+// finished image to 'output' (.png or .hdr, see batch.h). Needs no GL.
+///////////////////////////////////////////////////////////////////////////
+int submitRenderJob(const std::string& job_file, const std::string& output, int port);
+} // namespace pathtracer
@@ -5,9 +5,28 @@ precision highp float;
 
 layout(location = 0) out vec4 fragmentColor;
 layout(binding = 0) uniform sampler2D image;
+uniform float exposure = 1.0;
+uniform int tonemapper = 0;
 in vec2 texCoord;
 
+///////////////////////////////////////////////////////////////////////////////
+// Filmic curve fitted to ACES, from Krzysztof Narkowicz
+///////////////////////////////////////////////////////////////////////////////
+vec3 filmic(vec3 x)
+{
+	return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
 void main()
 {
-	fragmentColor = texture(image, texCoord);
+	vec3 color = exposure * texture(image, texCoord).rgb;
+	if(tonemapper == 1)
+	{
+		color = color / (vec3(1.0) + color);
+	}
+	else if(tonemapper == 2)
+	{
+		color = filmic(color);
+	}
+	fragmentColor = vec4(clamp(color, 0.0, 1.0), 1.0);
 }
@@ -0,0 +1,141 @@
+#include "stats.h"
+#include "kernels.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+using namespace std;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+///////////////////////////////////////////////////////////////////////////////
+vector<ThreadStats, AlignedAllocator<ThreadStats>> thread_stats(omp_get_max_threads());
+PassStats pass_stats = {};
+
+static int pass_counter = 0;
+static chrono::high_resolution_clock::time_point pass_start;
+static uint64_t pass_start_ticks = 0;
+static float photon_ms = 0.0f;
+static float raster_ms = 0.0f;
+static ofstream log_file;
+static bool log_json = false;
+
+void beginStatsPass()
+{
+	memset(&thread_stats[0], 0, thread_stats.size() * sizeof(ThreadStats));
+	pass_start = chrono::high_resolution_clock::now();
+	pass_start_ticks = readTicks();
+	raster_ms = 0.0f;
+}
+
+void endPhotonStats()
+{
+	photon_ms = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - pass_start).count();
+}
+
+void endRasterStats()
+{
+	raster_ms = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - pass_start).count() - photon_ms;
+}
+
+static void writeLog(const PassStats& s)
+{
+	if(!log_file.is_open())
+		return;
+	if(log_json)
+	{
+		log_file << "{\"pass\": " << s.pass << ", \"pass_ms\": " << s.pass_ms << ", \"photon_ms\": " << s.photon_ms
+		         << ", \"raster_ms\": " << s.raster_ms << ", \"primary_rays\": " << s.primary_rays
+		         << ", \"rasterized_primaries\": " << s.rasterized_primaries << ", \"bounce_rays\": " << s.bounce_rays
+		         << ", \"shadow_rays\": " << s.shadow_rays << ", \"photon_rays\": " << s.photon_rays
+		         << ", \"average_path_length\": " << s.average_path_length
+		         << ", \"mrays_per_second\": " << s.mrays_per_second << ", \"embree_ms\": " << s.embree_ms
+		         << ", \"shading_ms\": " << s.shading_ms << ", \"kernel_isa\": \"" << s.kernel_isa << "\""
+		         << ", \"thread_busy_ms\": [";
+		for(size_t i = 0; i < s.thread_busy_ms.size(); i++)
+			log_file << (i ? ", " : "") << s.thread_busy_ms[i];
+		log_file << "]}\n";
+	}
+	else
+	{
+		log_file << s.pass << "," << s.pass_ms << "," << s.photon_ms << "," << s.raster_ms << "," << s.primary_rays
+		         << "," << s.rasterized_primaries << "," << s.bounce_rays << "," << s.shadow_rays << ","
+		         << s.photon_rays << "," << s.average_path_length << "," << s.mrays_per_second << "," << s.embree_ms << "," << s.shading_ms << "," << s.kernel_isa;
+		for(float busy : s.thread_busy_ms)
+			log_file << "," << busy;
+		log_file << "\n";
+	}
+	log_file.flush();
+}
+
+void endStatsPass()
+{
+	const float ms = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - pass_start).count();
+	const uint64_t ticks = readTicks() - pass_start_ticks;
+	// Calibrate the tick rate against the wall clock over the whole pass
+	const double ms_per_tick = ticks > 0 ? double(ms) / double(ticks) : 0.0;
+
+	PassStats s = {};
+	s.pass = pass_counter++;
+	s.pass_ms = ms;
+	s.photon_ms = photon_ms;
+	s.raster_ms = raster_ms;
+	uint64_t intersect_rays = 0, paths = 0, path_vertices = 0, busy_ticks = 0, embree_ticks = 0;
+	for(const ThreadStats& t : thread_stats)
+	{
+		s.primary_rays += t.primary_rays;
+		s.rasterized_primaries += t.rasterized_primaries;
+		s.shadow_rays += t.shadow_rays;
+		s.photon_rays += t.photon_rays;
+		intersect_rays += t.intersect_rays;
+		paths += t.paths;
+		path_vertices += t.path_vertices;
+		busy_ticks += t.busy_ticks;
+		embree_ticks += t.embree_ticks;
+		s.thread_busy_ms.push_back(float(t.busy_ticks * ms_per_tick));
+	}
+	s.bounce_rays = intersect_rays - (s.primary_rays - s.rasterized_primaries) - s.photon_rays;
+	s.average_path_length = paths > 0 ? float(path_vertices) / float(paths) : 0.0f;
+	s.mrays_per_second = ms > 0.0f ? float(intersect_rays + s.shadow_rays) / (ms * 1000.0f) : 0.0f;
+	s.embree_ms = float(embree_ticks * ms_per_tick);
+	s.shading_ms = float(busy_ticks * ms_per_tick) - s.embree_ms;
+	s.kernel_isa = simd::isa();
+	pass_stats = s;
+	writeLog(s);
+}
+
+bool startStatsLog(const string& filename)
+{
+	stopStatsLog();
+	log_file.open(filename);
+	if(!log_file.is_open())
+	{
+		cout << "ERROR: startStatsLog(): Could not open " << filename << "\n";
+		return false;
+	}
+	log_json = filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0;
+	if(!log_json)
+	{
+		log_file << "pass,pass_ms,photon_ms,raster_ms,primary_rays,rasterized_primaries,bounce_rays,shadow_rays,"
+		            "photon_rays,average_path_length,mrays_per_second,embree_ms,shading_ms,kernel_isa";
+		for(size_t i = 0; i < thread_stats.size(); i++)
+			log_file << ",thread" << i << "_busy_ms";
+		log_file << "\n";
+	}
+	return true;
+}
+
+void stopStatsLog()
+{
+	if(log_file.is_open())
+		log_file.close();
+}
+
+bool statsLogOpen()
+{
+	return log_file.is_open();
+}
+} // namespace pathtracer
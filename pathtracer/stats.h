@@ -0,0 +1,112 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <omp.h>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PATHTRACER_RDTSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define PATHTRACER_RDTSC
+#endif
+#include "Pathtracer.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Counters and timers kept by each render thread. Every thread owns a
+// cache line aligned block, so counting is a plain add without any
+// sharing between cores. Times are in cpu ticks (rdtsc, or the steady
+// clock where there is none), and are converted to milliseconds once per
+// pass. The times are only taken when built with PATHTRACER_TIMING
+// (CMake option), since they read the clock around every ray cast.
+///////////////////////////////////////////////////////////////////////////
+#ifdef PATHTRACER_TIMING
+static const bool timing_stats = true;
+#else
+static const bool timing_stats = false;
+#endif
+
+struct alignas(64) ThreadStats
+{
+	uint64_t primary_rays;
+	// Primary rays whose first hit came from the rasterizer
+	uint64_t rasterized_primaries;
+	uint64_t intersect_rays;
+	uint64_t shadow_rays;
+	uint64_t photon_rays;
+	uint64_t paths;
+	uint64_t path_vertices;
+	uint64_t busy_ticks;
+	uint64_t embree_ticks;
+};
+extern std::vector<ThreadStats, AlignedAllocator<ThreadStats>> thread_stats;
+
+inline ThreadStats& threadStats()
+{
+	return thread_stats[omp_get_thread_num()];
+}
+
+inline uint64_t readTicks()
+{
+#ifdef PATHTRACER_RDTSC
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+	                    std::chrono::steady_clock::now().time_since_epoch())
+	                    .count());
+#endif
+}
+
+// readTicks() for the timers of ThreadStats, or 0 without timing_stats, so
+// that timing them compiles to nothing
+inline uint64_t timerTicks()
+{
+	return timing_stats ? readTicks() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The totals of one pass of tracePaths()
+///////////////////////////////////////////////////////////////////////////
+extern struct PassStats
+{
+	int pass;
+	float pass_ms;
+	float photon_ms;
+	float raster_ms;
+	uint64_t primary_rays;
+	uint64_t rasterized_primaries;
+	uint64_t bounce_rays;
+	uint64_t shadow_rays;
+	uint64_t photon_rays;
+	float average_path_length;
+	float mrays_per_second;
+	// Summed over all threads
+	float embree_ms;
+	float shading_ms;
+	std::vector<float> thread_busy_ms;
+	// The instruction set of the SIMD kernels in use
+	const char* kernel_isa;
+} pass_stats;
+
+///////////////////////////////////////////////////////////////////////////
+// Clear the counters at the start of a pass. The photon phase ends with
+// endPhotonStats(), primary visibility rasterization (if enabled) with
+// endRasterStats(), and the whole pass with endStatsPass(), which fills
+// in pass_stats and appends it to the log, if one is open.
+///////////////////////////////////////////////////////////////////////////
+void beginStatsPass();
+void endPhotonStats();
+void endRasterStats();
+void endStatsPass();
+
+///////////////////////////////////////////////////////////////////////////
+// Write one line per pass to a file, as CSV or (if the filename ends in
+// .json) as JSON lines. Only one log is open at a time.
+///////////////////////////////////////////////////////////////////////////
+bool startStatsLog(const std::string& filename);
+void stopStatsLog();
+bool statsLogOpen();
+} // namespace pathtracer
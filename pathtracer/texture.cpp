@@ -0,0 +1,248 @@
+#include "texture.h"
+#include <map>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// The converted textures of each material. Materials without any texture
+// are not in the map.
+///////////////////////////////////////////////////////////////////////////
+struct MaterialTextures
+{
+	const CPUTexture* color = nullptr;
+	const CPUTexture* reflectivity = nullptr;
+	const CPUTexture* shininess = nullptr;
+	const CPUTexture* metalness = nullptr;
+	const CPUTexture* fresnel = nullptr;
+	const CPUTexture* emission = nullptr;
+	// The color texture has texels that are not fully opaque
+	bool alpha_test = false;
+};
+static map<const labhelper::Material*, MaterialTextures> material_textures;
+static vector<unique_ptr<CPUTexture>> textures;
+// Materials that share a labhelper texture share its conversion too
+static map<pair<const uint8_t*, int>, const CPUTexture*> converted_textures;
+
+static const int TILE_SIZE_LOG2 = 3;
+static const int TILE_SIZE = 1 << TILE_SIZE_LOG2;
+
+///////////////////////////////////////////////////////////////////////////
+// Interleave the bits of the coordinates within a tile
+///////////////////////////////////////////////////////////////////////////
+static inline int morton(int x, int y)
+{
+	static const uint8_t spread[TILE_SIZE] = { 0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15 };
+	return spread[x] | (spread[y] << 1);
+}
+
+static inline size_t texelOffset(const MipLevel& level, int x, int y)
+{
+	int tile = (y >> TILE_SIZE_LOG2) * level.tiles_x + (x >> TILE_SIZE_LOG2);
+	return size_t(tile) * TILE_SIZE * TILE_SIZE + morton(x & (TILE_SIZE - 1), y & (TILE_SIZE - 1));
+}
+
+void CPUTexture::build(const labhelper::Texture& texture, int _components)
+{
+	components = _components;
+	levels.clear();
+
+	// The level being built, as floats in row major order
+	int w = texture.width, h = texture.height;
+	vector<vec4> current(size_t(w) * h, vec4(0.0f));
+	for(int i = 0; i < w * h; i++)
+		for(int c = 0; c < components; c++)
+			current[i][c] = texture.data[size_t(i) * components + c] / 255.0f;
+
+	for(;;)
+	{
+		MipLevel level;
+		level.width = w;
+		level.height = h;
+		level.tiles_x = (w + TILE_SIZE - 1) / TILE_SIZE;
+		int tiles_y = (h + TILE_SIZE - 1) / TILE_SIZE;
+		level.texels.assign(size_t(level.tiles_x) * tiles_y * TILE_SIZE * TILE_SIZE * components, 0);
+		for(int y = 0; y < h; y++)
+		{
+			for(int x = 0; x < w; x++)
+			{
+				uint8_t* texel = &level.texels[texelOffset(level, x, y) * components];
+				for(int c = 0; c < components; c++)
+					texel[c] = uint8_t(clamp(current[y * w + x][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+			}
+		}
+		levels.push_back(std::move(level));
+		if(w == 1 && h == 1)
+			break;
+
+		// Box filter down to the next level. Odd sizes clamp the last row
+		// and column.
+		int next_w = std::max(1, w / 2), next_h = std::max(1, h / 2);
+		vector<vec4> next(size_t(next_w) * next_h);
+		for(int y = 0; y < next_h; y++)
+		{
+			int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+			for(int x = 0; x < next_w; x++)
+			{
+				int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+				next[y * next_w + x] = 0.25f * (current[y0 * w + x0] + current[y0 * w + x1] + current[y1 * w + x0]
+				                                + current[y1 * w + x1]);
+			}
+		}
+		current.swap(next);
+		w = next_w;
+		h = next_h;
+	}
+}
+
+vec4 CPUTexture::sampleLevel(int l, const vec2& uv) const
+{
+	const MipLevel& level = levels[l];
+	// Texel centers are at half integers
+	float fx = uv.x * level.width - 0.5f;
+	float fy = uv.y * level.height - 0.5f;
+	float x_floor = floor(fx), y_floor = floor(fy);
+	float tx = fx - x_floor, ty = fy - y_floor;
+	// Repeat wrapping (the result of % can be negative)
+	int x0 = int(x_floor) % level.width, y0 = int(y_floor) % level.height;
+	if(x0 < 0)
+		x0 += level.width;
+	if(y0 < 0)
+		y0 += level.height;
+	int x1 = x0 + 1 == level.width ? 0 : x0 + 1;
+	int y1 = y0 + 1 == level.height ? 0 : y0 + 1;
+
+	const uint8_t* t00 = &level.texels[texelOffset(level, x0, y0) * components];
+	const uint8_t* t10 = &level.texels[texelOffset(level, x1, y0) * components];
+	const uint8_t* t01 = &level.texels[texelOffset(level, x0, y1) * components];
+	const uint8_t* t11 = &level.texels[texelOffset(level, x1, y1) * components];
+	vec4 result(0.0f, 0.0f, 0.0f, 1.0f);
+	for(int c = 0; c < components; c++)
+	{
+		float top = mix(float(t00[c]), float(t10[c]), tx);
+		float bottom = mix(float(t01[c]), float(t11[c]), tx);
+		result[c] = mix(top, bottom, ty) * (1.0f / 255.0f);
+	}
+	return result;
+}
+
+vec4 CPUTexture::sample(const vec2& uv, float lod) const
+{
+	const int last = int(levels.size()) - 1;
+	if(!(lod > 0.0f))
+		return sampleLevel(0, uv);
+	if(lod >= float(last))
+		return sampleLevel(last, uv);
+	int l = int(lod);
+	float t = lod - float(l);
+	return mix(sampleLevel(l, uv), sampleLevel(l + 1, uv), t);
+}
+
+static const CPUTexture* convertTexture(const labhelper::Texture& texture, int components)
+{
+	if(!texture.valid || texture.data == nullptr)
+		return nullptr;
+	const CPUTexture*& converted = converted_textures[make_pair(texture.data, components)];
+	if(converted == nullptr)
+	{
+		textures.emplace_back(new CPUTexture);
+		textures.back()->build(texture, components);
+		converted = textures.back().get();
+	}
+	return converted;
+}
+
+void addMaterialTextures(const labhelper::Model* model)
+{
+	for(auto& material : model->m_materials)
+	{
+		MaterialTextures t;
+		t.color = convertTexture(material.m_color_texture, 4);
+		t.reflectivity = convertTexture(material.m_reflectivity_texture, 1);
+		t.shininess = convertTexture(material.m_shininess_texture, 1);
+		t.metalness = convertTexture(material.m_metalness_texture, 1);
+		t.fresnel = convertTexture(material.m_fresnel_texture, 1);
+		t.emission = convertTexture(material.m_emission_texture, 4);
+		if(t.color)
+		{
+			const labhelper::Texture& texture = material.m_color_texture;
+			for(size_t i = 3; i < size_t(texture.width) * texture.height * 4 && !t.alpha_test; i += 4)
+				t.alpha_test = texture.data[i] < 255;
+		}
+		if(t.color || t.reflectivity || t.shininess || t.metalness || t.fresnel || t.emission)
+			material_textures[&material] = t;
+	}
+}
+
+void clearMaterialTextures()
+{
+	material_textures.clear();
+	converted_textures.clear();
+	textures.clear();
+}
+
+bool hasAlphaTest(const labhelper::Material* material)
+{
+	auto it = material_textures.find(material);
+	return it != material_textures.end() && it->second.alpha_test;
+}
+
+float sampleAlpha(const labhelper::Material* material, const vec2& uv)
+{
+	auto it = material_textures.find(material);
+	if(it == material_textures.end() || !it->second.alpha_test)
+		return 1.0f;
+	return it->second.color->sampleLevel(0, uv).w;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The mip level for a texture, from the ray cone footprint and the texel
+// density of the hit triangle:
+//   lod = 0.5 * log2(texels per world area) + log2(cone width / cos)
+///////////////////////////////////////////////////////////////////////////
+static float textureLod(const CPUTexture& texture, const Intersection& hit, float cone_width)
+{
+	const MipLevel& base = texture.levels[0];
+	float cos_theta = std::max(abs(dot(hit.geometry_normal, hit.wo)), 0.01f);
+	return hit.uv_density + 0.5f * log2(float(base.width) * float(base.height)) + log2(cone_width / cos_theta);
+}
+
+SurfaceProperties evaluateSurface(const Intersection& hit, float cone_width)
+{
+	SurfaceProperties s(hit.material);
+	auto it = material_textures.find(hit.material);
+	if(it == material_textures.end())
+		return s;
+	const MaterialTextures& t = it->second;
+	if(t.color)
+		s.color = vec3(t.color->sample(hit.uv, textureLod(*t.color, hit, cone_width)));
+	if(t.reflectivity)
+		s.reflectivity = t.reflectivity->sample(hit.uv, textureLod(*t.reflectivity, hit, cone_width)).x;
+	if(t.metalness)
+		s.metalness = t.metalness->sample(hit.uv, textureLod(*t.metalness, hit, cone_width)).x;
+	if(t.fresnel)
+		s.fresnel = t.fresnel->sample(hit.uv, textureLod(*t.fresnel, hit, cone_width)).x;
+	if(t.shininess)
+	{
+		// The texture holds roughness, use the usual Beckmann to Blinn Phong
+		// conversion (alpha = roughness^2)
+		float roughness = t.shininess->sample(hit.uv, textureLod(*t.shininess, hit, cone_width)).x;
+		float alpha = std::max(roughness * roughness, 0.01f);
+		s.shininess = std::min(2.0f / (alpha * alpha) - 2.0f, 25000.0f);
+	}
+	if(t.emission)
+	{
+		s.emission = hit.material->m_emission
+		             * vec3(t.emission->sample(hit.uv, textureLod(*t.emission, hit, cone_width)));
+	}
+	else
+	{
+		s.emission = hit.material->m_emission * s.color;
+	}
+	return s;
+}
+} // namespace pathtracer
@@ -0,0 +1,58 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <Model.h>
+#include "embree.h"
+#include "material.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A CPU copy of a texture, prepared for random access from the path
+// tracer. Every mip level is stored in 8x8 texel tiles, and the texels
+// inside a tile are in Morton (Z) order, so that a bilinear footprint
+// almost always stays within one or two cache lines.
+///////////////////////////////////////////////////////////////////////////
+struct MipLevel
+{
+	int width, height;
+	int tiles_x;
+	std::vector<uint8_t> texels;
+};
+
+struct CPUTexture
+{
+	int components;
+	std::vector<MipLevel> levels;
+	// Build the mip chain from the 8 bit texels of a loaded texture
+	void build(const labhelper::Texture& texture, int components);
+	// Bilinear lookup in one level, with repeat wrapping
+	vec4 sampleLevel(int level, const vec2& uv) const;
+	// Trilinear lookup, 'lod' is the (fractional) mip level
+	vec4 sample(const vec2& uv, float lod) const;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Convert the textures of all materials of a model. Called by addModel().
+///////////////////////////////////////////////////////////////////////////
+void addMaterialTextures(const labhelper::Model* model);
+void clearMaterialTextures();
+
+///////////////////////////////////////////////////////////////////////////
+// Materials whose color texture has transparent texels are alpha tested:
+// a ray passes through the surface where the alpha is below one half.
+// sampleAlpha() reads the finest mip level, and returns 1 for materials
+// without alpha test.
+///////////////////////////////////////////////////////////////////////////
+bool hasAlphaTest(const labhelper::Material* material);
+float sampleAlpha(const labhelper::Material* material, const vec2& uv);
+
+///////////////////////////////////////////////////////////////////////////
+// Evaluate the material at an intersection. The mip level is chosen from
+// the width of a ray cone ('cone_width', the world space footprint of
+// the path at the hit), which stands in for full ray differentials.
+///////////////////////////////////////////////////////////////////////////
+SurfaceProperties evaluateSurface(const Intersection& hit, float cone_width);
+} // namespace pathtracer
@@ -114,8 +114,12 @@ void initGL()
 	simpleShaderProgram = labhelper::loadShaderProgram("../project/simple.vert", "../project/simple.frag");
 
 	///////////////////////////////////////////////////////////////////////
-	// Load models and set up model matrices
+	// Load models and set up model matrices. The shaders decode the
+	// compressed vertices. Only the GPU needs the models.
 	///////////////////////////////////////////////////////////////////////
+	labhelper::loader_settings.compress_vertices = true;
+	labhelper::loader_settings.compress_textures = true;
+	labhelper::loader_settings.keep_cpu_data = false;
 	fighterModel = labhelper::loadModelFromOBJ("../scenes/NewShip.obj");
 	landingpadModel = labhelper::loadModelFromOBJ("../scenes/landingpad.obj");
 	sphereModel = labhelper::loadModelFromOBJ("../scenes/sphere.obj");
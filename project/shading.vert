@@ -13,6 +13,30 @@ uniform mat4 normalMatrix;
 uniform mat4 modelViewMatrix;
 uniform mat4 modelViewProjectionMatrix;
 
+///////////////////////////////////////////////////////////////////////////////
+// Compressed vertices (labhelper::LoaderSettings::compress_vertices): the
+// position is within the bounding box of the mesh, the normal octahedral
+// encoded in xy.
+///////////////////////////////////////////////////////////////////////////////
+uniform bool compressed_vertices;
+uniform vec3 vertex_position_offset;
+uniform vec3 vertex_position_scale;
+
+vec3 decodePosition(vec3 p)
+{
+	return compressed_vertices ? vertex_position_offset + vertex_position_scale * p : p;
+}
+
+vec3 decodeNormal(vec3 n)
+{
+	if(!compressed_vertices)
+		return n;
+	vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+	if(v.z < 0.0)
+		v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(v);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Output to fragment shader
 ///////////////////////////////////////////////////////////////////////////////
@@ -23,9 +47,10 @@ out vec3 viewSpacePosition;
 
 void main()
 {
-	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	vec3 p = decodePosition(position);
+	gl_Position = modelViewProjectionMatrix * vec4(p, 1.0);
 	texCoord = texCoordIn;
-	viewSpaceNormal = (normalMatrix * vec4(normalIn, 0.0)).xyz;
-	viewSpacePosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
+	viewSpaceNormal = (normalMatrix * vec4(decodeNormal(normalIn), 0.0)).xyz;
+	viewSpacePosition = (modelViewMatrix * vec4(p, 1.0)).xyz;
 
 }
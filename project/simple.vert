@@ -3,7 +3,20 @@
 layout(location = 0) in vec3 position;
 uniform mat4 modelViewProjectionMatrix;
 
+///////////////////////////////////////////////////////////////////////////////
+// Compressed vertices (labhelper::LoaderSettings::compress_vertices): the
+// position is within the bounding box of the mesh.
+///////////////////////////////////////////////////////////////////////////////
+uniform bool compressed_vertices;
+uniform vec3 vertex_position_offset;
+uniform vec3 vertex_position_scale;
+
+vec3 decodePosition(vec3 p)
+{
+	return compressed_vertices ? vertex_position_offset + vertex_position_scale * p : p;
+}
+
 void main()
 {
-	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	gl_Position = modelViewProjectionMatrix * vec4(decodePosition(position), 1.0);
 }